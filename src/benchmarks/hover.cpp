@@ -0,0 +1,74 @@
+#include "langserveroptions.hpp"
+#include "langserverutils.hpp"
+#include "lsptypes.hpp"
+#include "mesonmetadata.hpp"
+#include "polyfill.hpp"
+#include "typenamespace.hpp"
+#include "workspace.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+
+// A project with `numIdentifiers` variables, each one assigned, passed to a
+// function and used in a method call.
+static std::filesystem::path writeProject(int64_t numIdentifiers) {
+  const auto root = std::filesystem::temp_directory_path() /
+                    std::format("mesonlsp-hover-{}", numIdentifiers);
+  std::filesystem::create_directories(root);
+  std::ofstream out(root / "meson.build");
+  out << "project('hover')\n";
+  for (int64_t i = 0; i < numIdentifiers; i++) {
+    out << std::format("var_{} = 'value_{}'\nmessage(var_{}.to_upper())\n", i,
+                       i, i);
+  }
+  return root;
+}
+
+struct Project {
+  LanguageServerOptions options;
+  TypeNamespace ns;
+  std::unique_ptr<Workspace> workspace;
+  std::filesystem::path mesonBuild;
+
+  explicit Project(int64_t numIdentifiers) {
+    const auto root = writeProject(numIdentifiers);
+    this->mesonBuild = root / "meson.build";
+    this->workspace = std::make_unique<Workspace>(
+        WorkspaceFolder(pathToUrl(root), "hover"), this->options);
+    this->workspace->parse(this->ns);
+  }
+};
+
+static void hover(benchmark::State &state) {
+  const Project project(state.range(0));
+  const std::map<std::string, std::string> descriptions;
+  // The usage of the last variable
+  const auto line = (uint64_t)(2 * state.range(0));
+  for (auto _ : state) {
+    auto result = project.workspace->hover(project.mesonBuild,
+                                           LSPPosition(line, 9), descriptions);
+    benchmark::DoNotOptimize(result);
+    (void)_;
+  }
+}
+
+// What every hover, highlight and rename paid before the metadata was
+// shared: A copy of all of it.
+static void copyMetadata(benchmark::State &state) {
+  const Project project(state.range(0));
+  const auto snapshot = project.workspace->snapshot();
+  for (auto _ : state) {
+    MesonMetadata copy = *snapshot->trees.front()->metadata;
+    benchmark::DoNotOptimize(copy);
+    (void)_;
+  }
+}
+
+BENCHMARK(hover)->Arg(1000)->Arg(5000)->Arg(20000);
+BENCHMARK(copyMetadata)->Arg(1000)->Arg(5000)->Arg(20000);
+BENCHMARK_MAIN();
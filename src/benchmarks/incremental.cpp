@@ -0,0 +1,110 @@
+#include "node.hpp"
+#include "parsecache.hpp"
+#include "polyfill.hpp"
+#include "sourcefile.hpp"
+
+#include <array>
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <tree_sitter/api.h>
+
+// A meson.build with `numStatements` assignments and function calls
+static std::string generateFile(int64_t numStatements) {
+  std::string ret = "project('incremental')\n";
+  for (int64_t i = 0; i < numStatements; i++) {
+    ret += std::format("var_{} = ['a', 'b', {}]\nmessage(var_{}[0])\n", i, i,
+                       i);
+  }
+  return ret;
+}
+
+// The file with one character in the middle changed, like a keystroke
+static std::string typeInMiddle(const std::string &contents) {
+  auto ret = contents;
+  const auto offset = ret.find("'a'", ret.size() / 2);
+  ret[offset + 1] = 'x';
+  return ret;
+}
+
+// What every edit paid before: Parsing the file from scratch
+static void fullReparse(benchmark::State &state) {
+  const auto contents = generateFile(state.range(0));
+  const auto edited = typeInMiddle(contents);
+  const std::filesystem::path path = "meson.build";
+  auto sourceFile = std::make_shared<MemorySourceFile>(edited, path);
+  for (auto _ : state) {
+    TSTree *tree = ts_parser_parse_string(threadParser(), nullptr,
+                                          edited.data(),
+                                          (uint32_t)edited.length());
+    auto rootNode = makeNode(sourceFile, ts_tree_root_node(tree));
+    rootNode->setParents();
+    benchmark::DoNotOptimize(rootNode);
+    ts_tree_delete(tree);
+    (void)_;
+  }
+}
+
+// Alternating between the two versions, so every parse edits the tree of the
+// one before.
+static void incrementalReparse(benchmark::State &state) {
+  const std::array<std::string, 2> versions{
+      generateFile(state.range(0)), typeInMiddle(generateFile(state.range(0)))};
+  const std::filesystem::path path = "meson.build";
+  ParseCache cache;
+  ts_tree_delete(cache.parse(path, versions[1]));
+  size_t idx = 0;
+  for (auto _ : state) {
+    const auto &contents = versions[idx];
+    idx = 1 - idx;
+    TSTree *tree = cache.parse(path, contents);
+    auto sourceFile = std::make_shared<MemorySourceFile>(contents, path);
+    auto rootNode = makeNode(sourceFile, ts_tree_root_node(tree));
+    rootNode->setParents();
+    benchmark::DoNotOptimize(rootNode);
+    ts_tree_delete(tree);
+    (void)_;
+  }
+}
+
+// Only the tree-sitter part of the two above, without building the nodes
+static void fullTreeSitterParse(benchmark::State &state) {
+  const auto edited = typeInMiddle(generateFile(state.range(0)));
+  for (auto _ : state) {
+    TSTree *tree = ts_parser_parse_string(threadParser(), nullptr,
+                                          edited.data(),
+                                          (uint32_t)edited.length());
+    benchmark::DoNotOptimize(tree);
+    ts_tree_delete(tree);
+    (void)_;
+  }
+}
+
+static void incrementalTreeSitterParse(benchmark::State &state) {
+  const auto contents = generateFile(state.range(0));
+  const auto edited = typeInMiddle(contents);
+  const auto edit = editBetween(contents, edited);
+  TSTree *old = ts_parser_parse_string(threadParser(), nullptr,
+                                       contents.data(),
+                                       (uint32_t)contents.length());
+  for (auto _ : state) {
+    TSTree *copy = ts_tree_copy(old);
+    ts_tree_edit(copy, &edit);
+    TSTree *tree = ts_parser_parse_string(threadParser(), copy, edited.data(),
+                                          (uint32_t)edited.length());
+    benchmark::DoNotOptimize(tree);
+    ts_tree_delete(tree);
+    ts_tree_delete(copy);
+    (void)_;
+  }
+  ts_tree_delete(old);
+}
+
+BENCHMARK(fullReparse)->Arg(1000)->Arg(5000)->Arg(20000);
+BENCHMARK(incrementalReparse)->Arg(1000)->Arg(5000)->Arg(20000);
+BENCHMARK(fullTreeSitterParse)->Arg(1000)->Arg(5000)->Arg(20000);
+BENCHMARK(incrementalTreeSitterParse)->Arg(1000)->Arg(5000)->Arg(20000);
+BENCHMARK_MAIN();
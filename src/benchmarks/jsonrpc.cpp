@@ -0,0 +1,67 @@
+#include "jsonrpc.hpp"
+#include "polyfill.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <string>
+
+class NullJsonRpcHandler : public jsonrpc::JsonRpcHandler {
+public:
+  void handleNotification(std::string /*method*/,
+                          nlohmann::json /*params*/) override {}
+
+  void handleRequest(
+      std::string /*method*/, nlohmann::json /*callId*/,
+      nlohmann::json /*params*/,
+      std::shared_ptr<CancellationToken> /*token*/) override {}
+};
+
+static std::string makeDidChange(int64_t version, size_t textSize) {
+  nlohmann::json data;
+  data["jsonrpc"] = "2.0";
+  data["method"] = "textDocument/didChange";
+  data["params"] = {
+      {"textDocument", {{"uri", "file:///tmp/meson.build"},
+                        {"version", version}}},
+      {"contentChanges", {{{"text", std::string(textSize, 'x')}}}}};
+  std::string payload = data.dump();
+  return std::format("Content-Length: {}\r\n\r\n{}", payload.size(), payload);
+}
+
+static std::string makeStream(int64_t numMessages, size_t textSize) {
+  std::string ret;
+  for (int64_t i = 0; i < numMessages; i++) {
+    ret += makeDidChange(i, textSize);
+  }
+  return ret;
+}
+
+static void jsonRpcFraming(benchmark::State &state) {
+  const auto numMessages = state.range(0);
+  const auto textSize = (size_t)state.range(1);
+  const auto stream = makeStream(numMessages, textSize);
+  for (auto _ : state) {
+    std::istringstream input(stream);
+    std::ostringstream output;
+    auto handler = std::make_shared<NullJsonRpcHandler>();
+    auto server = std::make_shared<jsonrpc::JsonRpcServer>(input, output);
+    handler->server = server;
+    server->loop(handler);
+    server->wait();
+    benchmark::DoNotOptimize(output);
+    (void)_;
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)stream.size());
+  state.SetItemsProcessed(state.iterations() * numMessages);
+}
+
+BENCHMARK(jsonRpcFraming)
+    ->Args({1000, 64})
+    ->Args({100, 16 * 1024})
+    ->Args({50, 256 * 1024})
+    ->Args({10, 2 * 1024 * 1024});
+
+BENCHMARK_MAIN();
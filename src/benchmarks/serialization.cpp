@@ -0,0 +1,155 @@
+#include "documentsymbolvisitor.hpp"
+#include "foldingrangevisitor.hpp"
+#include "jsonwriter.hpp"
+#include "lexer.hpp"
+#include "lsptypes.hpp"
+#include "messagewriter.hpp"
+#include "node.hpp"
+#include "parser.hpp"
+#include "polyfill.hpp"
+#include "semantictokensvisitor.hpp"
+#include "sourcefile.hpp"
+#include "utils.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+static std::shared_ptr<Node> parseFile() {
+  const std::filesystem::path path = "meson.build";
+  const auto fileContent = readFile(path);
+  Lexer lexer(fileContent);
+  lexer.tokenize();
+  auto sourceFile = std::make_shared<MemorySourceFile>(fileContent, path);
+  Parser parser(lexer, sourceFile);
+  auto rootNode = parser.parse(lexer.errors);
+  rootNode->setParents();
+  return rootNode;
+}
+
+// What the server did before: Build the DOM, dump it, frame it.
+static std::string domReply(const nlohmann::json &result) {
+  nlohmann::json data;
+  data["jsonrpc"] = "2.0";
+  data["id"] = 1;
+  data["result"] = result;
+  const auto &payload = data.dump();
+  return std::format("Content-Length: {}\r\n\r\n{}", payload.size(), payload);
+}
+
+template <typename Func>
+static std::string streamingReply(std::string buffer, const Func &func) {
+  jsonrpc::OutgoingMessage message(std::move(buffer));
+  message.buffer.append(R"({"id":1,"jsonrpc":"2.0","result":)");
+  JsonWriter writer(message.buffer);
+  func(writer);
+  message.buffer.push_back('}');
+  message.finish();
+  return std::move(message.buffer);
+}
+
+template <typename T>
+static void domArray(benchmark::State &state, const std::vector<T> &values) {
+  for (auto _ : state) {
+    auto jsonObjects = nlohmann::json::array();
+    for (const auto &value : values) {
+      jsonObjects.push_back(value.toJson());
+    }
+    auto framed = domReply(jsonObjects);
+    benchmark::DoNotOptimize(framed);
+    (void)_;
+  }
+}
+
+template <typename T>
+static void streamingArray(benchmark::State &state,
+                           const std::vector<T> &values) {
+  // Like the buffers recycled by the MessageWriter
+  std::string buffer;
+  for (auto _ : state) {
+    buffer = streamingReply(std::move(buffer), [&values](JsonWriter &writer) {
+      writer.beginArray();
+      for (const auto &value : values) {
+        value.writeJson(writer);
+      }
+      writer.endArray();
+    });
+    benchmark::DoNotOptimize(buffer);
+    (void)_;
+  }
+}
+
+static std::vector<SymbolInformation> documentSymbols() {
+  DocumentSymbolVisitor visitor;
+  parseFile()->visit(&visitor);
+  return visitor.symbols;
+}
+
+static std::vector<FoldingRange> foldingRanges() {
+  FoldingRangeVisitor visitor;
+  parseFile()->visit(&visitor);
+  return visitor.ranges;
+}
+
+static std::vector<uint64_t> semanticTokens() {
+  SemanticTokensVisitor visitor;
+  parseFile()->visit(&visitor);
+  return visitor.finish();
+}
+
+static void domDocumentSymbols(benchmark::State &state) {
+  domArray(state, documentSymbols());
+}
+
+static void streamingDocumentSymbols(benchmark::State &state) {
+  streamingArray(state, documentSymbols());
+}
+
+static void domFoldingRanges(benchmark::State &state) {
+  domArray(state, foldingRanges());
+}
+
+static void streamingFoldingRanges(benchmark::State &state) {
+  streamingArray(state, foldingRanges());
+}
+
+static void domSemanticTokens(benchmark::State &state) {
+  const auto &tokens = semanticTokens();
+  for (auto _ : state) {
+    auto framed = domReply({{"data", tokens}});
+    benchmark::DoNotOptimize(framed);
+    (void)_;
+  }
+}
+
+static void streamingSemanticTokens(benchmark::State &state) {
+  const auto &tokens = semanticTokens();
+  std::string buffer;
+  for (auto _ : state) {
+    buffer = streamingReply(std::move(buffer), [&tokens](JsonWriter &writer) {
+      writer.beginObject();
+      writer.key("data");
+      writer.beginArray();
+      for (const auto token : tokens) {
+        writer.number(token);
+      }
+      writer.endArray();
+      writer.endObject();
+    });
+    benchmark::DoNotOptimize(buffer);
+    (void)_;
+  }
+}
+
+BENCHMARK(domDocumentSymbols);
+BENCHMARK(streamingDocumentSymbols);
+BENCHMARK(domFoldingRanges);
+BENCHMARK(streamingFoldingRanges);
+BENCHMARK(domSemanticTokens);
+BENCHMARK(streamingSemanticTokens);
+BENCHMARK_MAIN();
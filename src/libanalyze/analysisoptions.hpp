@@ -38,4 +38,6 @@ public:
         disableIterationVariableShadowingLint(
             disableIterationVariableShadowingLint),
         enableIterationVariableLint(enableIterationVariableLint) {}
+
+  bool operator==(const AnalysisOptions &other) const = default;
 };
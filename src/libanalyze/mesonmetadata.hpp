@@ -33,11 +33,12 @@ enum class Severity {
 
 #define FIND(type, variable)                                                   \
   std::optional<type *> /*NOLINT*/ find##type##At(                             \
-      const std::filesystem::path &path, uint64_t line, uint64_t column) {     \
+      const std::filesystem::path &path, uint64_t line, uint64_t column)       \
+      const {                                                                  \
     if (!this->fileMetadata.contains(path)) {                                  \
       return std::nullopt;                                                     \
     }                                                                          \
-    for (auto &var : this->fileMetadata[path].variable) {                      \
+    for (const auto &var : this->fileMetadata.at(path).variable) {             \
       if (MesonMetadata::contains(var->id.get(), line, column)) {              \
         return var;                                                            \
       }                                                                        \
@@ -8,13 +8,16 @@
 #include "optiondiagnosticvisitor.hpp"
 #include "optionextractor.hpp"
 #include "optionstate.hpp"
+#include "parsecache.hpp"
 #include "parser.hpp"
 #include "polyfill.hpp"
 #include "scope.hpp"
 #include "sourcefile.hpp"
+#include "stats.hpp"
 #include "typeanalyzer.hpp"
 #include "utils.hpp"
 
+#include <atomic>
 #include <chrono> // IWYU pragma: keep Needed for std::formatting std::filesystem::last_write_time result
 #include <cstdint>
 #include <filesystem>
@@ -22,10 +25,28 @@
 #include <string>
 #include <tree_sitter/api.h>
 
-extern "C" TSLanguage *tree_sitter_meson(); // NOLINT
-
 const static Logger LOG("analyze::mesontree"); // NOLINT
 
+static std::shared_ptr<const Lexer> lex(ParseCache *cache,
+                                        const std::filesystem::path &path,
+                                        const std::string &contents) {
+  if (cache) {
+    return cache->lex(path, contents);
+  }
+  auto lexer = std::make_shared<Lexer>(contents);
+  lexer->tokenize();
+  return lexer;
+}
+
+static TSTree *parseTree(ParseCache *cache, const std::filesystem::path &path,
+                         const std::string &contents) {
+  if (cache) {
+    return cache->parse(path, contents);
+  }
+  return ts_parser_parse_string(threadParser(), nullptr, contents.data(),
+                                (uint32_t)contents.length());
+}
+
 static std::string createId(const std::filesystem::path &path) {
   using namespace std::chrono_literals;
   const std::filesystem::file_time_type &mtime =
@@ -47,10 +68,9 @@ OptionState MesonTree::parseFile(const std::filesystem::path &path,
     auto sourceFile =
         overridden ? std::make_shared<MemorySourceFile>(fileContent, path)
                    : std::make_shared<SourceFile>(path);
-    Lexer lexer(fileContent);
-    lexer.tokenize();
-    Parser parser(lexer, sourceFile);
-    auto rootNode = parser.parse(lexer.errors);
+    const auto lexer = lex(this->parseCache.get(), path, fileContent);
+    Parser parser(*lexer, sourceFile);
+    auto rootNode = parser.parse(lexer->errors);
     this->asts[rootNode->file->file] = {rootNode};
     rootNode->setParents();
     rootNode->visit(&visitor);
@@ -62,9 +82,11 @@ OptionState MesonTree::parseFile(const std::filesystem::path &path,
     const auto &fileId = createId(path);
     if (!this->savedTrees.contains(fileId)) {
       LOG.info(std::format("Cache miss for {}", fileId));
+      globalStats().savedTreesMisses.fetch_add(1, std::memory_order_relaxed);
       goto slow;
     }
     LOG.info(std::format("Cache hit for {}", fileId));
+    globalStats().savedTreesHits.fetch_add(1, std::memory_order_relaxed);
     const auto *node = this->savedTrees[fileId];
     auto rootNode =
         makeNode(std::make_shared<SourceFile>(path), ts_tree_root_node(node));
@@ -77,11 +99,8 @@ OptionState MesonTree::parseFile(const std::filesystem::path &path,
   LOG.info(
       std::format("Using contents from editor for {}", path.generic_string()));
 slow:
-  TSParser *parser = ts_parser_new();
-  ts_parser_set_language(parser, tree_sitter_meson());
   const auto fileContent = overridden ? this->overrides[path] : readFile(path);
-  TSTree *tree = ts_parser_parse_string(parser, nullptr, fileContent.data(),
-                                        (uint32_t)fileContent.length());
+  TSTree *tree = parseTree(this->parseCache.get(), path, fileContent);
   auto sourceFile = overridden
                         ? std::make_shared<MemorySourceFile>(fileContent, path)
                         : std::make_shared<SourceFile>(path);
@@ -95,7 +114,6 @@ slow:
   } else {
     ts_tree_delete(tree);
   }
-  ts_parser_delete(parser);
   return OptionState{visitor.options};
 }
 
@@ -126,22 +144,18 @@ std::shared_ptr<Node> MesonTree::parseFile(const std::filesystem::path &path) {
     auto sourceFile =
         overridden ? std::make_shared<MemorySourceFile>(fileContent, path)
                    : std::make_shared<SourceFile>(path);
-    Lexer lexer(fileContent);
-    lexer.tokenize();
-    Parser parser(lexer, sourceFile);
-    auto rootNode = parser.parse(lexer.errors);
+    const auto lexer = lex(this->parseCache.get(), path, fileContent);
+    Parser parser(*lexer, sourceFile);
+    auto rootNode = parser.parse(lexer->errors);
     this->asts[rootNode->file->file].push_back(rootNode);
     rootNode->setParents();
     return rootNode;
   }
-  TSParser *parser = ts_parser_new();
-  ts_parser_set_language(parser, tree_sitter_meson());
   if (this->overrides.contains(path)) {
     LOG.info(std::format("Using contents from editor for {}",
                          path.generic_string()));
     const auto fileContent = this->overrides[path];
-    TSTree *tree = ts_parser_parse_string(parser, nullptr, fileContent.data(),
-                                          (uint32_t)fileContent.length());
+    TSTree *tree = parseTree(this->parseCache.get(), path, fileContent);
     auto sourceFile = std::make_shared<MemorySourceFile>(fileContent, path);
     auto rootNode = makeNode(sourceFile, ts_tree_root_node(tree));
     this->ownedFiles.insert(std::filesystem::absolute(path));
@@ -151,12 +165,12 @@ std::shared_ptr<Node> MesonTree::parseFile(const std::filesystem::path &path) {
     this->asts[rootNode->file->file].push_back(rootNode);
     rootNode->setParents();
     ts_tree_delete(tree);
-    ts_parser_delete(parser);
     return rootNode;
   }
   const auto &fileId = createId(path);
   if (this->savedTrees.contains(fileId)) {
     LOG.info(std::format("Cache hit for {}", fileId));
+    globalStats().savedTreesHits.fetch_add(1, std::memory_order_relaxed);
     const auto *node = this->savedTrees[fileId];
     auto rootNode =
         makeNode(std::make_shared<SourceFile>(path), ts_tree_root_node(node));
@@ -170,9 +184,9 @@ std::shared_ptr<Node> MesonTree::parseFile(const std::filesystem::path &path) {
     return rootNode;
   }
   LOG.info(std::format("Cache miss for {}", fileId));
+  globalStats().savedTreesMisses.fetch_add(1, std::memory_order_relaxed);
   const auto fileContent = readFile(path);
-  TSTree *tree = ts_parser_parse_string(parser, nullptr, fileContent.data(),
-                                        (uint32_t)fileContent.length());
+  TSTree *tree = parseTree(this->parseCache.get(), path, fileContent);
   auto sourceFile = std::make_shared<SourceFile>(path);
   auto rootNode = makeNode(sourceFile, ts_tree_root_node(tree));
   if (!this->asts.contains(rootNode->file->file)) {
@@ -182,7 +196,6 @@ std::shared_ptr<Node> MesonTree::parseFile(const std::filesystem::path &path) {
   rootNode->setParents();
   this->asts[rootNode->file->file].push_back(rootNode);
   this->savedTrees[createId(path)] = tree;
-  ts_parser_delete(parser);
   return rootNode;
 }
 
@@ -199,11 +212,13 @@ std::shared_ptr<Node> MesonTree::parseRootFile() {
   return this->parseFile(rootFile);
 }
 
-void MesonTree::partialParse(AnalysisOptions analysisOptions) {
+void MesonTree::partialParse(AnalysisOptions analysisOptions,
+                             const CancellationToken *token) {
+  const ScopedTimer timer(globalStats().partialParse);
   LOG.info(std::format("Parsing {} ({})", this->identifier,
                        this->root.generic_string()));
   // First fetch all the options
-  const auto &optState = parseOptions(this->root, &this->metadata);
+  const auto &optState = parseOptions(this->root, this->metadata.get());
   // Then fetch diagnostics for the options
   // Then parse the root meson.build file
   const auto rootNode = this->parseRootFile();
@@ -215,9 +230,24 @@ void MesonTree::partialParse(AnalysisOptions analysisOptions) {
   this->scope.variables["host_machine"] = {this->ns.types.at("host_machine")};
   this->scope.variables["target_machine"] = {
       this->ns.types.at("target_machine")};
-  TypeAnalyzer visitor(this->ns, &this->metadata, this, this->scope,
-                       analysisOptions, optState);
+  TypeAnalyzer visitor(this->ns, this->metadata.get(), this, this->scope,
+                       analysisOptions, optState, token);
   rootNode->setParents();
   rootNode->visit(&visitor);
   this->options = visitor.options;
 }
+
+std::shared_ptr<const MesonTree> MesonTree::snapshot() const {
+  auto ret = std::make_shared<MesonTree>(this->root, this->ns);
+  ret->identifier = this->identifier;
+  ret->ownedFiles = this->ownedFiles;
+  ret->asts = this->asts;
+  ret->scope = this->scope;
+  ret->metadata = this->metadata;
+  ret->options = this->options;
+  ret->depth = this->depth;
+  ret->name = this->name;
+  ret->version = this->version;
+  ret->useCustomParser = this->useCustomParser;
+  return ret;
+}
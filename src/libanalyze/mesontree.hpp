@@ -1,16 +1,20 @@
 #pragma once
 
 #include "analysisoptions.hpp"
+#include "cancellation.hpp"
 #include "mesonmetadata.hpp"
 #include "node.hpp"
 #include "optionstate.hpp"
+#include "parsecache.hpp"
 #include "scope.hpp"
+#include "stats.hpp"
 #include "subprojects/subprojectstate.hpp"
 #include "tree_sitter/api.h"
 #include "typenamespace.hpp"
 #include "version.hpp"
 
 #include <filesystem>
+#include <functional>
 #include <map>
 #include <memory>
 #include <set>
@@ -29,7 +33,10 @@ public:
   std::map<std::string, TSTree *> savedTrees;
   SubprojectState state;
   Scope scope;
-  MesonMetadata metadata;
+  // Written by the analysis only. The next analysis starts with a new one
+  // instead of clearing it, so it can be shared with snapshots rather than
+  // copied.
+  std::shared_ptr<MesonMetadata> metadata = std::make_shared<MesonMetadata>();
   OptionState options;
   MesonTree *parent{nullptr};
   const TypeNamespace &ns;
@@ -37,13 +44,20 @@ public:
   std::string name = "root";
   Version version = Version("9999.9999.9999");
   bool useCustomParser = false;
+  // Called with the name of each subproject right before it is parsed,
+  // inherited by the subprojects.
+  std::function<void(const std::string &)> onSubproject;
+  // Shared with the subprojects and the trees of later parses, may be null.
+  std::shared_ptr<ParseCache> parseCache;
 
   MesonTree(const std::filesystem::path &root, const TypeNamespace &ns)
       : root(root), state(SubprojectState(root)), ns(ns) {}
 
-  void partialParse(AnalysisOptions analysisOptions);
+  void partialParse(AnalysisOptions analysisOptions,
+                    const CancellationToken *token = nullptr);
 
   void fullParse(AnalysisOptions analysisOptions, bool downloadSubprojects) {
+    const ScopedTimer timer(globalStats().fullParse);
     if (this->depth < MAX_TREE_DEPTH) {
       this->parseRootFile();
       this->state.used = true;
@@ -57,12 +71,18 @@ public:
   void clear() {
     this->ownedFiles.clear();
     this->asts = {};
-    this->metadata.clear();
+    this->metadata = std::make_shared<MesonMetadata>();
     this->version = Version("9999.9999.9999");
   }
 
   std::shared_ptr<Node> parseFile(const std::filesystem::path &path);
 
+  // Copies the results of the last analysis into a tree of its own, that
+  // stays unchanged while this one is parsed again. The ASTs and the metadata
+  // are shared, as every parse creates new ones anyway. Neither subprojects,
+  // nor the parent or the parser caches are part of the copy.
+  [[nodiscard]] std::shared_ptr<const MesonTree> snapshot() const;
+
   [[nodiscard]] std::vector<const MesonTree *> flatten() const {
     std::vector<const MesonTree *> ret;
     for (const auto &subproj : this->state.subprojects) {
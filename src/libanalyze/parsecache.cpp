@@ -0,0 +1,178 @@
+#include "parsecache.hpp"
+
+#include "lexer.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tree_sitter/api.h>
+
+extern "C" TSLanguage *tree_sitter_meson(); // NOLINT
+
+TSParser *threadParser() {
+  thread_local const std::unique_ptr<TSParser, void (*)(TSParser *)> parser(
+      []() {
+        auto *ret = ts_parser_new();
+        ts_parser_set_language(ret, tree_sitter_meson());
+        return ret;
+      }(),
+      ts_parser_delete);
+  return parser.get();
+}
+
+static TSPoint pointAt(const std::string &text, size_t offset) {
+  const auto *begin = text.data();
+  const auto *end = begin + offset;
+  const auto row = std::count(begin, end, '\n');
+  const auto *lineStart = begin;
+  for (const auto *chr = end; chr != begin; chr--) {
+    if (chr[-1] == '\n') {
+      lineStart = chr;
+      break;
+    }
+  }
+  return TSPoint{.row = (uint32_t)row, .column = (uint32_t)(end - lineStart)};
+}
+
+TSInputEdit editBetween(const std::string &before, const std::string &after) {
+  const auto shorter = std::min(before.size(), after.size());
+  size_t prefix = 0;
+  while (prefix < shorter && before[prefix] == after[prefix]) {
+    prefix++;
+  }
+  size_t suffix = 0;
+  while (suffix < shorter - prefix && before[before.size() - suffix - 1] ==
+                                          after[after.size() - suffix - 1]) {
+    suffix++;
+  }
+  const auto oldEnd = before.size() - suffix;
+  const auto newEnd = after.size() - suffix;
+  return TSInputEdit{.start_byte = (uint32_t)prefix,
+                     .old_end_byte = (uint32_t)oldEnd,
+                     .new_end_byte = (uint32_t)newEnd,
+                     .start_point = pointAt(before, prefix),
+                     .old_end_point = pointAt(before, oldEnd),
+                     .new_end_point = pointAt(after, newEnd)};
+}
+
+ParseCache::~ParseCache() {
+  for (const auto &[_, entry] : this->entries) {
+    if (entry.tree) {
+      ts_tree_delete(entry.tree);
+    }
+  }
+}
+
+ParseCache::Entry &ParseCache::entryFor(const std::filesystem::path &path,
+                                        const std::string &contents) {
+  const auto hash = std::hash<std::string>{}(contents);
+  const auto &key = path.generic_string();
+  auto [iter, inserted] = this->entries.try_emplace(key);
+  auto &entry = iter->second;
+  if (inserted) {
+    this->order.push_front(key);
+  } else {
+    this->order.splice(this->order.begin(), this->order, entry.position);
+  }
+  entry.position = this->order.begin();
+  if (!entry.contents || entry.hash != hash || *entry.contents != contents) {
+    if (entry.tree) {
+      ts_tree_delete(entry.tree);
+    }
+    if (entry.contents) {
+      this->totalSize -= entry.contents->size();
+    }
+    entry.hash = hash;
+    entry.contents = std::make_shared<const std::string>(contents);
+    entry.lexer = nullptr;
+    entry.tree = nullptr;
+    this->totalSize += contents.size();
+    this->evict();
+  }
+  return entry;
+}
+
+void ParseCache::evict() {
+  // The most recently used entry is kept, as the caller is still using it
+  while (this->totalSize > this->capacity && this->order.size() > 1) {
+    const auto &iter = this->entries.find(this->order.back());
+    if (iter->second.tree) {
+      ts_tree_delete(iter->second.tree);
+    }
+    this->totalSize -= iter->second.contents->size();
+    this->entries.erase(iter);
+    this->order.pop_back();
+  }
+}
+
+size_t ParseCache::size() {
+  std::scoped_lock const lock(this->mtx);
+  return this->entries.size();
+}
+
+std::shared_ptr<const Lexer>
+ParseCache::lex(const std::filesystem::path &path,
+                const std::string &contents) {
+  {
+    std::scoped_lock const lock(this->mtx);
+    const auto &entry = this->entryFor(path, contents);
+    if (entry.lexer) {
+      globalStats().parseCacheHits.fetch_add(1, std::memory_order_relaxed);
+      return entry.lexer;
+    }
+  }
+  globalStats().parseCacheMisses.fetch_add(1, std::memory_order_relaxed);
+  auto lexer = std::make_shared<Lexer>(contents);
+  lexer->tokenize();
+  std::scoped_lock const lock(this->mtx);
+  this->entryFor(path, contents).lexer = lexer;
+  return lexer;
+}
+
+TSTree *ParseCache::parse(const std::filesystem::path &path,
+                          const std::string &contents) {
+  TSTree *oldTree = nullptr;
+  std::shared_ptr<const std::string> oldContents;
+  {
+    std::scoped_lock const lock(this->mtx);
+    const auto &iter = this->entries.find(path.generic_string());
+    if (iter != this->entries.end() && iter->second.tree) {
+      oldTree = ts_tree_copy(iter->second.tree);
+      oldContents = iter->second.contents;
+    }
+    const auto &entry = this->entryFor(path, contents);
+    if (entry.tree) {
+      globalStats().parseCacheHits.fetch_add(1, std::memory_order_relaxed);
+      if (oldTree) {
+        ts_tree_delete(oldTree);
+      }
+      // Copies are cheap and may be used on another thread than the original
+      return ts_tree_copy(entry.tree);
+    }
+  }
+  globalStats().parseCacheMisses.fetch_add(1, std::memory_order_relaxed);
+  if (oldTree) {
+    const auto edit = editBetween(*oldContents, contents);
+    ts_tree_edit(oldTree, &edit);
+    globalStats().incrementalParses.fetch_add(1, std::memory_order_relaxed);
+  }
+  TSTree *tree = ts_parser_parse_string(threadParser(), oldTree,
+                                        contents.data(),
+                                        (uint32_t)contents.length());
+  if (oldTree) {
+    ts_tree_delete(oldTree);
+  }
+  std::scoped_lock const lock(this->mtx);
+  auto &entry = this->entryFor(path, contents);
+  if (!entry.tree) {
+    entry.tree = ts_tree_copy(tree);
+  }
+  return tree;
+}
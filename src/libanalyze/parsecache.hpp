@@ -0,0 +1,73 @@
+#pragma once
+
+#include "lexer.hpp"
+#include "tree_sitter/api.h"
+
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// A parser for meson.build files owned by the calling thread. Parsers can't
+// be shared between threads, but creating one for every file is wasteful.
+TSParser *threadParser();
+
+// The edit turning `before` into `after`: Everything between their common
+// prefix and common suffix was replaced. Coalesced edits become one, that
+// covers all of them.
+TSInputEdit editBetween(const std::string &before, const std::string &after);
+
+// Bytes of file contents. Their tokens and trees take a multiple of that.
+constexpr size_t DEFAULT_PARSE_CACHE_CAPACITY = 16 * 1024 * 1024;
+
+// The results of lexing and parsing files, outliving the MesonTrees that
+// produced them, e.g. across a full reparse. Only the latest contents of
+// each path are kept. As one cache is shared by every project a daemon ever
+// opened, the least recently used files are dropped once their contents
+// exceed the capacity.
+// Only what is never modified afterwards is cached, the tokens of the custom
+// parser and the tree-sitter trees. The nodes are still built from them for
+// every parse, as each analysis annotates nodes of its own.
+// If the contents of a path changed, the tree of the old ones is edited and
+// passed to tree-sitter, so only the changed part is parsed again.
+class ParseCache {
+public:
+  explicit ParseCache(size_t capacity = DEFAULT_PARSE_CACHE_CAPACITY)
+      : capacity(capacity) {}
+  ~ParseCache();
+
+  ParseCache(const ParseCache &) = delete;
+  ParseCache &operator=(const ParseCache &) = delete;
+
+  std::shared_ptr<const Lexer> lex(const std::filesystem::path &path,
+                                   const std::string &contents);
+  // The returned tree belongs to the caller.
+  TSTree *parse(const std::filesystem::path &path,
+                const std::string &contents);
+  [[nodiscard]] size_t size();
+
+private:
+  struct Entry {
+    size_t hash = 0;
+    std::shared_ptr<const std::string> contents;
+    std::shared_ptr<const Lexer> lexer;
+    TSTree *tree = nullptr;
+    std::list<std::string>::iterator position;
+  };
+
+  size_t capacity;
+  std::mutex mtx;
+  std::unordered_map<std::string, Entry> entries;
+  // Most recently used first
+  std::list<std::string> order;
+  size_t totalSize = 0;
+
+  // The entry of `path`, reset if it was for other contents. Marks it as the
+  // most recently used one and may drop others.
+  Entry &entryFor(const std::filesystem::path &path,
+                  const std::string &contents);
+  void evict();
+};
@@ -17,5 +17,12 @@ void MesonSubproject::parse(const AnalysisOptions &options, int depth,
   this->tree->depth = depth;
   this->tree->name = this->name;
   this->tree->identifier = parentIdentifier + ">" + this->name;
+  if (parent) {
+    this->tree->parseCache = parent->parseCache;
+  }
+  if (parent && parent->onSubproject) {
+    this->tree->onSubproject = parent->onSubproject;
+    parent->onSubproject(this->name);
+  }
   this->tree->fullParse(options, downloadSubprojects);
 }
@@ -16,6 +16,7 @@
 #include <filesystem>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 
@@ -151,6 +152,11 @@ void SubprojectState::findSubprojects(bool downloadSubprojects,
   }
 }
 
+std::mutex &SubprojectState::setupMutex() {
+  static std::mutex mtx;
+  return mtx;
+}
+
 void SubprojectState::initSubprojects() {
   for (const auto &subproject : this->subprojects) {
     subproject->init();
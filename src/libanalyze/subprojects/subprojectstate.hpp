@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <filesystem>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <utility>
@@ -54,12 +55,20 @@ public:
                  const std::string &parentIdentifier, const TypeNamespace &ns,
                  bool downloadSubprojects, bool useCustomParser,
                  MesonTree *tree) {
-    this->findSubprojects(downloadSubprojects, tree);
-    this->initSubprojects();
-    this->updateSubprojects();
+    {
+      // Wraps are set up in a cache shared by all workspaces, which may be
+      // analyzed in parallel.
+      std::scoped_lock const lock(setupMutex());
+      this->findSubprojects(downloadSubprojects, tree);
+      this->initSubprojects();
+      this->updateSubprojects();
+    }
     this->parseSubprojects(options, depth, parentIdentifier, ns,
                            downloadSubprojects, useCustomParser, tree);
   }
+
+private:
+  static std::mutex &setupMutex();
 };
 
 std::optional<std::string>
@@ -1,6 +1,7 @@
 // HERE BE DRAGONS
 #include "partialinterpreter.hpp"
 
+#include "cancellation.hpp"
 #include "log.hpp"
 #include "mesonoption.hpp"
 #include "node.hpp"
@@ -32,7 +33,8 @@ bool isValidFunction(const FunctionExpression *fe);
 std::vector<std::string> splitString(const std::string &str);
 
 std::vector<std::string> guessSetVariable(FunctionExpression *fe,
-                                          OptionState &opts) {
+                                          OptionState &opts,
+                                          const CancellationToken *token) {
   using enum NodeType;
   if (!fe->args || fe->args->type != ARGUMENT_LIST) {
     return {};
@@ -53,13 +55,14 @@ std::vector<std::string> guessSetVariable(FunctionExpression *fe,
     parent = parent->parent;
     assert(parent);
   }
-  PartialInterpreter calc(opts);
+  PartialInterpreter calc(opts, token);
   return calc.calculate(parent, toCalculate.get());
 }
 
 std::vector<std::string> guessSetVariable(FunctionExpression *fe,
                                           const std::string &kwargName,
-                                          OptionState &opts) {
+                                          OptionState &opts,
+                                          const CancellationToken *token) {
   const auto *al = dynamic_cast<const ArgumentList *>(fe->args.get());
   if (!al || al->args.empty()) {
     return {};
@@ -79,12 +82,13 @@ std::vector<std::string> guessSetVariable(FunctionExpression *fe,
     parent = parent->parent;
     assert(parent);
   }
-  PartialInterpreter calc(opts);
+  PartialInterpreter calc(opts, token);
   return calc.calculate(parent, toCalculate->get());
 }
 
-std::vector<std::string> guessGetVariableMethod(MethodExpression *me,
-                                                OptionState &opts) {
+std::vector<std::string>
+guessGetVariableMethod(MethodExpression *me, OptionState &opts,
+                       const CancellationToken *token) {
   const auto *al = dynamic_cast<const ArgumentList *>(me->args.get());
   if (!al || al->args.empty()) {
     return {};
@@ -100,7 +104,7 @@ std::vector<std::string> guessGetVariableMethod(MethodExpression *me,
     }
     parent = parent->parent;
   }
-  PartialInterpreter calc(opts);
+  PartialInterpreter calc(opts, token);
   return calc.calculate(parent, toCalculate.get());
 }
 
@@ -682,6 +686,7 @@ PartialInterpreter::resolveArrayOrDict(const Node *parentExpr,
 std::vector<std::shared_ptr<InterpretNode>>
 PartialInterpreter::evalStatement(const Node *stmt,
                                   const IdExpression *toResolve) {
+  CancellationToken::check(this->token);
   const auto *ass = dynamic_cast<const AssignmentStatement *>(stmt);
   if (!ass) {
     return this->fullEval(stmt, toResolve);
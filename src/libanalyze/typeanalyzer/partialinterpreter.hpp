@@ -1,5 +1,6 @@
 #pragma once
 
+#include "cancellation.hpp"
 #include "node.hpp"
 #include "optionstate.hpp"
 
@@ -8,13 +9,15 @@
 #include <utility>
 #include <vector>
 
-std::vector<std::string> guessSetVariable(FunctionExpression *fe,
-                                          OptionState &opts);
-std::vector<std::string> guessSetVariable(FunctionExpression *fe,
-                                          const std::string &kwargName,
-                                          OptionState &opts);
-std::vector<std::string> guessGetVariableMethod(MethodExpression *me,
-                                                OptionState &opts);
+std::vector<std::string>
+guessSetVariable(FunctionExpression *fe, OptionState &opts,
+                 const CancellationToken *token = nullptr);
+std::vector<std::string>
+guessSetVariable(FunctionExpression *fe, const std::string &kwargName,
+                 OptionState &opts, const CancellationToken *token = nullptr);
+std::vector<std::string>
+guessGetVariableMethod(MethodExpression *me, OptionState &opts,
+                       const CancellationToken *token = nullptr);
 
 class InterpretNode {
 public:
@@ -73,9 +76,12 @@ public:
 
 class PartialInterpreter {
   OptionState &options;
+  const CancellationToken *token;
 
 public:
-  explicit PartialInterpreter(OptionState &options) : options(options) {}
+  explicit PartialInterpreter(OptionState &options,
+                              const CancellationToken *token = nullptr)
+      : options(options), token(token) {}
 
   std::vector<std::string> calculate(const Node *parent,
                                      const Node *exprToCalculate);
@@ -896,7 +896,10 @@ void TypeAnalyzer::visitBuildDefinition(BuildDefinition *node) {
   this->sourceFileStack.push_back(node->file->file);
   this->tree->ownedFiles.insert(node->file->file);
   this->checkProjectCall(node);
-  node->visitChildren(this);
+  for (const auto &stmt : node->stmts) {
+    CancellationToken::check(this->cancellationToken);
+    stmt->visit(this);
+  }
   this->checkDeadNodes(node);
   this->checkUnusedVariables();
   this->sourceFileStack.pop_back();
@@ -972,7 +975,8 @@ void TypeAnalyzer::visitDictionaryLiteral(DictionaryLiteral *node) {
 }
 
 void TypeAnalyzer::setFunctionCallTypesImport(FunctionExpression *node) {
-  const auto &values = ::guessSetVariable(node, this->options);
+  const auto &values =
+      ::guessSetVariable(node, this->options, this->cancellationToken);
   std::set<std::string> const asSet{values.begin(), values.end()};
   std::vector<std::shared_ptr<Type>> types;
   for (const auto &modname : asSet) {
@@ -990,7 +994,8 @@ void TypeAnalyzer::setFunctionCallTypesImport(FunctionExpression *node) {
 
 void TypeAnalyzer::setFunctionCallTypesGetOption(
     FunctionExpression *node, const std::shared_ptr<Function> &func) {
-  const auto &values = ::guessSetVariable(node, this->options);
+  const auto &values =
+      ::guessSetVariable(node, this->options, this->cancellationToken);
   std::set<std::string> const asSet{values.begin(), values.end()};
   std::vector<std::shared_ptr<Type>> types;
   for (auto val : asSet) {
@@ -1040,7 +1045,8 @@ void TypeAnalyzer::setFunctionCallTypesGetOption(
 }
 
 void TypeAnalyzer::setFunctionCallTypesSubproject(FunctionExpression *node) {
-  const auto &values = ::guessSetVariable(node, this->options);
+  const auto &values =
+      ::guessSetVariable(node, this->options, this->cancellationToken);
   if (values.empty()) {
     return;
   }
@@ -1076,7 +1082,8 @@ void TypeAnalyzer::setFunctionCallTypesSubproject(FunctionExpression *node) {
 }
 
 void TypeAnalyzer::setFunctionCallTypesBuildTarget(FunctionExpression *node) {
-  const auto &values = ::guessSetVariable(node, "target_type", this->options);
+  const auto &values = ::guessSetVariable(node, "target_type", this->options,
+                                         this->cancellationToken);
   std::set<std::string> const asSet{values.begin(), values.end()};
   std::vector<std::shared_ptr<Type>> types;
   for (const auto &tgtType : asSet) {
@@ -1114,7 +1121,8 @@ void TypeAnalyzer::setFunctionCallTypesGetVariable(
     types.insert(types.end(), defaultArg->types.begin(),
                  defaultArg->types.end());
   }
-  const auto &values = ::guessSetVariable(node, this->options);
+  const auto &values =
+      ::guessSetVariable(node, this->options, this->cancellationToken);
   std::set<std::string> const asSet{values.begin(), values.end()};
   for (const auto &varname : asSet) {
     if (!this->scope.variables.contains(varname)) {
@@ -1438,7 +1446,8 @@ void TypeAnalyzer::checkCall(Node *node) {
 
 void TypeAnalyzer::guessSetVariable(std::vector<std::shared_ptr<Node>> args,
                                     FunctionExpression *node) {
-  auto guessed = ::guessSetVariable(node, this->options);
+  auto guessed =
+      ::guessSetVariable(node, this->options, this->cancellationToken);
   std::set<std::string> const asSet(guessed.begin(), guessed.end());
   LOG.info(std::format(
       "Guessed values for set_variable: {} at {}:{}", joinStrings(asSet, '|'),
@@ -1476,7 +1485,8 @@ void TypeAnalyzer::enterSubdir(FunctionExpression *node) {
   if (!al || al->args.empty()) {
     return;
   }
-  const auto &guessed = ::guessSetVariable(node, this->options);
+  const auto &guessed =
+      ::guessSetVariable(node, this->options, this->cancellationToken);
   std::vector<std::string> asSet;
   for (const auto &dir : guessed) {
     if (std::ranges::find(asSet, dir) != asSet.end()) {
@@ -2240,7 +2250,8 @@ void TypeAnalyzer::visitMethodExpression(MethodExpression *node) {
     std::vector<std::shared_ptr<Type>> newTypes;
     newTypes.insert(newTypes.end(), node->method->returnTypes.begin(),
                     node->method->returnTypes.end());
-    const auto &values = ::guessGetVariableMethod(node, this->options);
+    const auto &values = ::guessGetVariableMethod(node, this->options,
+                                                  this->cancellationToken);
     std::set<std::string> const asSet{values.begin(), values.end()};
     for (const auto &objType : node->obj->types) {
       auto *subprojType = dynamic_cast<Subproject *>(objType.get());
@@ -2398,6 +2409,7 @@ void TypeAnalyzer::visitChildren(
   std::shared_ptr<Node> firstDead = nullptr;
   std::shared_ptr<Node> lastDead = nullptr;
   for (const auto &stmt : stmts) {
+    CancellationToken::check(this->cancellationToken);
     stmt->visit(this);
     this->checkNoEffect(stmt.get());
     if (!lastAlive) {
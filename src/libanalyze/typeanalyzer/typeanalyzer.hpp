@@ -1,6 +1,7 @@
 #pragma once
 
 #include "analysisoptions.hpp"
+#include "cancellation.hpp"
 #include "deprecationstate.hpp"
 #include "function.hpp"
 #include "mesonmetadata.hpp"
@@ -34,9 +35,11 @@ public:
 
   TypeAnalyzer(const TypeNamespace &ns, MesonMetadata *metadata,
                MesonTree *tree, Scope &scope, AnalysisOptions analysisOptions,
-               OptionState options)
+               OptionState options,
+               const CancellationToken *cancellationToken = nullptr)
       : ns(ns), tree(tree), metadata(metadata), scope(scope),
-        analysisOptions(analysisOptions), options(std::move(options)) {}
+        analysisOptions(analysisOptions), options(std::move(options)),
+        cancellationToken(cancellationToken) {}
 
   void visitArgumentList(ArgumentList *node) override;
   void visitArrayLiteral(ArrayLiteral *node) override;
@@ -62,6 +65,7 @@ public:
   void visitContinueNode(ContinueNode *node) override;
 
 private:
+  const CancellationToken *cancellationToken;
   std::vector<Version> versionStack;
   std::set<std::string> mesonVersionVars;
   std::vector<std::vector<std::string>> iteratorVars;
@@ -1,18 +1,41 @@
 #include "jsonrpc.hpp"
 
+#include "messageparser.hpp"
+#include "messagewriter.hpp"
 #include "polyfill.hpp"
+#include "stats.hpp"
+#include "workerpool.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
 #include <cstdio>
-#include <future>
+#include <cstring>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <string_view>
 #include <utility>
 
+// Wraps `job`, so its queue wait and run time are recorded for `method`.
+static std::function<void()> measured(const std::string &method,
+                                      std::function<void()> job) {
+  auto &stats = globalStats().methods.get(method);
+  return [&stats, job = std::move(job),
+          queuedAt = std::chrono::steady_clock::now()]() {
+    stats.queueWait.record(std::chrono::steady_clock::now() - queuedAt);
+    const ScopedTimer timer(stats.latency);
+    job();
+  };
+}
+
 void jsonrpc::JsonRpcServer::evaluateData(
     const std::shared_ptr<jsonrpc::JsonRpcHandler> &handler,
-    nlohmann::json data) {
+    nlohmann::json data, std::shared_ptr<ParamsReader> paramsReader) {
   if (!data.contains("jsonrpc")) {
     this->returnError(nullptr, JsonrpcError::PARSE_ERROR,
                       "Missing jsonrpc key");
@@ -29,6 +52,11 @@ void jsonrpc::JsonRpcServer::evaluateData(
                       "jsonrpc is not \"2.0\"");
     return;
   }
+  if (!data.contains("method") && data.contains("id") &&
+      (data.contains("result") || data.contains("error"))) {
+    this->handleResponse(data);
+    return;
+  }
   if (!data.contains("method")) {
     this->returnError(nullptr, JsonrpcError::PARSE_ERROR, "Missing method key");
     return;
@@ -39,45 +67,145 @@ void jsonrpc::JsonRpcServer::evaluateData(
     return;
   }
   std::string const method = data["method"];
-  nlohmann::json const params =
-      data.contains("params") ? data["params"] : nullptr;
-  if (data.contains("id")) {
-    auto callId = data["id"];
-    if (this->shouldExit) {
+  nlohmann::json params =
+      data.contains("params") ? std::move(data["params"]) : nullptr;
+  if (this->shouldExit) {
+    return;
+  }
+  if (method == "$/cancelRequest") {
+    // Handled right here, as it must not wait behind the request it cancels
+    this->cancelRequest(params);
+    return;
+  }
+  const auto lane = handler->lane(method, params);
+  if (paramsReader) {
+    if (data.contains("id")) {
+      this->returnError(data["id"], JsonrpcError::INVALID_REQUEST,
+                        std::format("{} is a notification", method));
       return;
     }
-    auto future = std::async(std::launch::async, &JsonRpcHandler::handleRequest,
-                             handler, method, callId, params);
-    this->futures.push_back(std::move(future));
+    this->pool.submit(measured(method,
+                               [paramsReader = std::move(paramsReader)]() {
+                                 paramsReader->finish();
+                               }),
+                      lane);
+    return;
+  }
+  if (data.contains("id")) {
+    auto token = std::make_shared<CancellationToken>();
+    const auto &key = data["id"].dump();
+    {
+      std::scoped_lock const lock(this->requestsMutex);
+      this->pendingRequests[key] = token;
+    }
+    this->pool.submit(
+        measured(method,
+                 [this, handler, method, token, callId = std::move(data["id"]),
+                  params = std::move(params)]() mutable {
+                   if (token->isCancelled()) {
+                     this->returnError(callId, JsonrpcError::REQUEST_CANCELLED,
+                                       "Request was cancelled");
+                   } else {
+                     handler->handleRequest(method, std::move(callId),
+                                            std::move(params), token);
+                   }
+                 }),
+        lane);
   } else {
-    if (this->shouldExit) {
+    this->pool.submit(
+        measured(method,
+                 [handler, method, params = std::move(params)]() mutable {
+                   handler->handleNotification(method, std::move(params));
+                 }),
+        lane);
+  }
+}
+
+void jsonrpc::JsonRpcServer::schedule(Lane lane, std::function<void()> job) {
+  this->pool.submit(std::move(job), lane);
+}
+
+void jsonrpc::JsonRpcServer::cancelRequest(const nlohmann::json &params) {
+  if (!params.is_object() || !params.contains("id")) {
+    return;
+  }
+  std::scoped_lock const lock(this->requestsMutex);
+  const auto &iter = this->pendingRequests.find(params["id"].dump());
+  if (iter != this->pendingRequests.end()) {
+    iter->second->cancel();
+  }
+}
+
+void jsonrpc::JsonRpcServer::answered(const nlohmann::json &callId) {
+  std::scoped_lock const lock(this->requestsMutex);
+  this->pendingRequests.erase(callId.dump());
+}
+
+void jsonrpc::JsonRpcServer::handleResponse(const nlohmann::json &data) {
+  std::function<void(const nlohmann::json &)> onResult;
+  {
+    std::scoped_lock const lock(this->requestsMutex);
+    const auto &iter = this->pendingResponses.find(data["id"].dump());
+    if (iter == this->pendingResponses.end()) {
       return;
     }
-    auto future =
-        std::async(std::launch::async, &JsonRpcHandler::handleNotification,
-                   handler, method, params);
-    this->futures.push_back(std::move(future));
+    onResult = std::move(iter->second);
+    this->pendingResponses.erase(iter);
+  }
+  if (onResult && data.contains("result")) {
+    onResult(data["result"]);
   }
 }
 
+// Like nlohmann::json::dump(), but appends to the existing string
+static void appendDump(std::string &out, const nlohmann::json &data) {
+  nlohmann::detail::serializer<nlohmann::json> serializer(
+      nlohmann::detail::output_adapter<char>(out), ' ');
+  serializer.dump(data, false, false, 0);
+}
+
+jsonrpc::OutgoingMessage
+jsonrpc::JsonRpcServer::frame(const nlohmann::json &data) {
+  auto message = this->writer.newMessage();
+  appendDump(message.buffer, data);
+  message.finish();
+  return message;
+}
+
 void jsonrpc::JsonRpcServer::sendToClient(const nlohmann::json &data) {
-  std::scoped_lock<std::mutex> const guard(this->output_mutex);
-  std::string payload = data.dump();
-  auto len = payload.size();
-  auto fullMessage = std::format("Content-Length: {}\r\n\r\n{}", len, payload);
-  this->output.write(fullMessage.data(), (long)fullMessage.size());
-  this->output.flush();
+  this->writer.send(this->frame(data));
+}
+
+void jsonrpc::JsonRpcServer::sendToClient(const nlohmann::json &data,
+                                          const std::string &supersedeKey) {
+  this->writer.send(this->frame(data), supersedeKey);
 }
 
 void jsonrpc::JsonRpcServer::reply(nlohmann::json callId,
                                    nlohmann::json result) {
   nlohmann::json data;
   data["jsonrpc"] = "2.0";
+  this->answered(callId);
   data["id"] = std::move(callId);
   data["result"] = std::move(result);
   this->sendToClient(data);
 }
 
+void jsonrpc::JsonRpcServer::reply(
+    const nlohmann::json &callId,
+    const std::function<void(std::string &)> &writeResult) {
+  this->answered(callId);
+  auto message = this->writer.newMessage();
+  // Keys in the same order as nlohmann::json would dump them
+  message.buffer.append(R"({"id":)");
+  appendDump(message.buffer, callId);
+  message.buffer.append(R"(,"jsonrpc":"2.0","result":)");
+  writeResult(message.buffer);
+  message.buffer.push_back('}');
+  message.finish();
+  this->writer.send(std::move(message));
+}
+
 void jsonrpc::JsonRpcServer::returnError(nlohmann::json callId,
                                          JsonrpcError error,
                                          const std::string &message) {
@@ -87,10 +215,30 @@ void jsonrpc::JsonRpcServer::returnError(nlohmann::json callId,
   nlohmann::json data;
   data["jsonrpc"] = "2.0";
   data["error"] = err;
+  this->answered(callId);
   data["id"] = std::move(callId);
   this->sendToClient(data);
 }
 
+void jsonrpc::JsonRpcServer::request(
+    const std::string &method, nlohmann::json params,
+    std::function<void(const nlohmann::json &)> onResult) {
+  nlohmann::json data;
+  data["jsonrpc"] = "2.0";
+  data["id"] = std::format("server-{}", this->nextRequestId++);
+  data["method"] = method;
+  // Some requests have no parameters, e.g. workspace/diagnostic/refresh,
+  // and null is not allowed instead
+  if (!params.is_null()) {
+    data["params"] = std::move(params);
+  }
+  {
+    std::scoped_lock const lock(this->requestsMutex);
+    this->pendingResponses[data["id"].dump()] = std::move(onResult);
+  }
+  this->sendToClient(data);
+}
+
 void jsonrpc::JsonRpcServer::notification(const std::string &method,
                                           nlohmann::json params) {
   nlohmann::json data;
@@ -100,79 +248,135 @@ void jsonrpc::JsonRpcServer::notification(const std::string &method,
   this->sendToClient(data);
 }
 
-enum class JsonrpcState {
-  INITIAL = 0,
-  FIRST_R = 1,
-  FIRST_N = 2,
-  SECOND_R = 3,
-  READING = 4
-};
+void jsonrpc::JsonRpcServer::notification(const std::string &method,
+                                          nlohmann::json params,
+                                          const std::string &supersedeKey) {
+  nlohmann::json data;
+  data["jsonrpc"] = "2.0";
+  data["method"] = method;
+  data["params"] = std::move(params);
+  this->sendToClient(data, std::format("{}\n{}", method, supersedeKey));
+}
+
+bool jsonrpc::JsonRpcServer::fillBuffer() {
+  if (this->bufferStart == this->bufferEnd) {
+    this->bufferStart = 0;
+    this->bufferEnd = 0;
+  } else if (this->bufferEnd == this->buffer.size() && this->bufferStart != 0) {
+    std::memmove(this->buffer.data(), this->buffer.data() + this->bufferStart,
+                 this->bufferEnd - this->bufferStart);
+    this->bufferEnd -= this->bufferStart;
+    this->bufferStart = 0;
+  }
+  if (this->bufferEnd == this->buffer.size()) {
+    this->buffer.resize(this->buffer.size() * 2);
+  }
+  auto *streamBuffer = this->input.rdbuf();
+  auto available = streamBuffer->in_avail();
+  if (available <= 0) {
+    // Nothing buffered, so block until at least one byte arrives
+    const auto chr = streamBuffer->sbumpc();
+    if (chr == EOF) {
+      return false;
+    }
+    this->buffer[this->bufferEnd++] = (char)chr;
+    available = streamBuffer->in_avail();
+    if (available <= 0 || this->bufferEnd == this->buffer.size()) {
+      return true;
+    }
+  }
+  const auto toRead = std::min((size_t)available,
+                               this->buffer.size() - this->bufferEnd);
+  this->bufferEnd += (size_t)streamBuffer->sgetn(
+      this->buffer.data() + this->bufferEnd, (std::streamsize)toRead);
+  return true;
+}
+
+bool jsonrpc::JsonRpcServer::readBody(size_t contentLength) {
+  const auto buffered = this->bufferEnd - this->bufferStart;
+  if (buffered >= contentLength) {
+    return true;
+  }
+  if (this->buffer.size() - this->bufferStart < contentLength) {
+    std::memmove(this->buffer.data(), this->buffer.data() + this->bufferStart,
+                 buffered);
+    this->bufferStart = 0;
+    this->bufferEnd = buffered;
+    if (this->buffer.size() < contentLength) {
+      this->buffer.resize(contentLength);
+    }
+  }
+  // We know exactly how much is missing, so read it in one go
+  const auto missing = contentLength - buffered;
+  const auto got = (size_t)this->input.rdbuf()->sgetn(
+      this->buffer.data() + this->bufferEnd, (std::streamsize)missing);
+  this->bufferEnd += got;
+  return got == missing;
+}
 
 void jsonrpc::JsonRpcServer::loop(
     const std::shared_ptr<jsonrpc::JsonRpcHandler> &handler) {
-  std::string const prefix = "Content-Length:";
-  auto numMessages = 0;
+  constexpr std::string_view PREFIX = "Content-Length:";
+  constexpr std::string_view HEADER_END = "\r\n\r\n";
   while (true) {
-    auto state = JsonrpcState::INITIAL;
-    auto contentLength = 0;
-    auto breakFromLoop = false;
-    std::string header;
-
-    while (!breakFromLoop) {
-      auto chr = this->input.get();
-      if (chr == EOF) {
+    size_t searchFrom = 0;
+    size_t headerEnd = std::string_view::npos;
+    while (true) {
+      const std::string_view pending{this->buffer.data() + this->bufferStart,
+                                     this->bufferEnd - this->bufferStart};
+      headerEnd = pending.find(HEADER_END, searchFrom);
+      if (headerEnd != std::string_view::npos) {
+        break;
+      }
+      // Don't rescan what we already looked at, but keep enough bytes
+      // to find a terminator that is split across two reads
+      searchFrom = pending.size() < HEADER_END.size() - 1
+                       ? 0
+                       : pending.size() - (HEADER_END.size() - 1);
+      if (!this->fillBuffer()) {
         return;
       }
-      switch (chr) {
-        using enum JsonrpcState;
-      case '\r':
-        state = state == JsonrpcState::FIRST_N ? SECOND_R : FIRST_R;
-        break;
-      case '\n':
-        if (state == SECOND_R) {
-          breakFromLoop = true;
-          break;
-        }
-        state = FIRST_N;
-        if (header.starts_with(prefix)) {
-          auto numberAsStr = header.substr(prefix.length());
-          contentLength = std::stoi(numberAsStr);
-        }
-        break;
-      default:
-        header += (char)chr;
-        state = READING;
+    }
+    const std::string_view headers{this->buffer.data() + this->bufferStart,
+                                   headerEnd};
+    size_t contentLength = 0;
+    size_t lineStart = 0;
+    while (lineStart <= headers.size()) {
+      auto lineEnd = headers.find("\r\n", lineStart);
+      if (lineEnd == std::string_view::npos) {
+        lineEnd = headers.size();
       }
-      if (breakFromLoop) {
-        break;
+      auto line = headers.substr(lineStart, lineEnd - lineStart);
+      if (line.starts_with(PREFIX)) {
+        line.remove_prefix(PREFIX.size());
+        while (!line.empty() && line.front() == ' ') {
+          line.remove_prefix(1);
+        }
+        std::from_chars(line.data(), line.data() + line.size(), contentLength);
       }
+      lineStart = lineEnd + 2;
     }
+    this->bufferStart += headerEnd + HEADER_END.size();
     if (this->shouldExit) {
       return;
     }
-    std::string messageData;
-    if (this->shouldExit) {
+    if (!this->readBody(contentLength)) {
       return;
     }
-    // TODO: Efficiency!
-    for (int i = 0; i < contentLength; i++) {
-      messageData += (char)this->input.get();
-    }
-    try {
-      auto data = nlohmann::json::parse(messageData);
-      numMessages++;
-      if (numMessages == 100) {
-        for (auto &future : this->futures) {
-          future.get();
-        }
-        this->futures.clear();
-        numMessages = 0;
-      }
-      this->evaluateData(handler, data);
-    } catch (nlohmann::json::parse_error &ex) {
+    globalStats().bytesRead.fetch_add(headerEnd + HEADER_END.size() +
+                                          contentLength,
+                                      std::memory_order_relaxed);
+    const auto *bodyStart = this->buffer.data() + this->bufferStart;
+    this->bufferStart += contentLength;
+    MessageParser parser(*handler);
+    if (!nlohmann::json::sax_parse(bodyStart, bodyStart + contentLength,
+                                   &parser)) {
       this->returnError(nullptr, JsonrpcError::PARSE_ERROR,
-                        std::format("Invalid JSON: {}", ex.what()));
+                        std::format("Invalid JSON: {}", parser.error));
+      continue;
     }
+    this->evaluateData(handler, std::move(parser.message),
+                       std::move(parser.paramsReader));
   }
 }
 
@@ -184,7 +388,6 @@ void jsonrpc::JsonRpcServer::exit() {
 jsonrpc::JsonRpcHandler::JsonRpcHandler() = default;
 
 void jsonrpc::JsonRpcServer::wait() {
-  for (auto &future : this->futures) {
-    future.get();
-  }
+  this->pool.waitIdle();
+  this->writer.flush();
 }
@@ -1,13 +1,21 @@
 #pragma once
 
-#include <future>
+#include "cancellation.hpp"
+#include "messageparser.hpp"
+#include "messagewriter.hpp"
+#include "workerpool.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <istream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <nlohmann/json.hpp>
 #include <ostream>
-#include <sstream>
 #include <string>
 #include <vector>
 
@@ -19,32 +27,89 @@ enum class JsonrpcError {
   METHOD_NOT_FOUND = -32601,
   INVALID_PARAMS = -32602,
   INTERNAL_ERROR = -32603,
+  REQUEST_CANCELLED = -32800,
 };
 
 class JsonRpcHandler;
 
+constexpr size_t INITIAL_READ_BUFFER_SIZE = 64 * 1024;
+
 class JsonRpcServer {
 private:
   std::istream &input;
   std::ostream &output;
-  std::mutex output_mutex;
-  std::vector<std::future<void>> futures;
+  std::mutex requestsMutex;
+  // Requests that were received, but not answered yet, keyed by
+  // their dumped id. A handler may answer a request after handleRequest
+  // returned, e.g. once it can be handled without blocking, so they are
+  // only removed by reply and returnError.
+  std::map<std::string, std::shared_ptr<CancellationToken>> pendingRequests;
+  // Requests we sent to the client, keyed by their dumped id.
+  std::map<std::string, std::function<void(const nlohmann::json &)>>
+      pendingResponses;
+  std::atomic<int64_t> nextRequestId = 0;
+  // Messages are framed directly out of this buffer, [bufferStart, bufferEnd)
+  // is the part that was read, but not consumed yet.
+  std::vector<char> buffer = std::vector<char>(INITIAL_READ_BUFFER_SIZE);
+  size_t bufferStart = 0;
+  size_t bufferEnd = 0;
+  bool fillBuffer();
+  bool readBody(size_t contentLength);
   void evaluateData(const std::shared_ptr<jsonrpc::JsonRpcHandler> &handler,
-                    nlohmann::json data);
+                    nlohmann::json data,
+                    std::shared_ptr<ParamsReader> paramsReader);
+  OutgoingMessage frame(const nlohmann::json &data);
   void sendToClient(const nlohmann::json &data);
+  void sendToClient(const nlohmann::json &data,
+                    const std::string &supersedeKey);
+  void cancelRequest(const nlohmann::json &params);
+  void handleResponse(const nlohmann::json &data);
+  // Forgets the cancellation token of an answered request
+  void answered(const nlohmann::json &callId);
   bool shouldExit = false;
+  MessageWriter writer;
+  // Declared last, so the workers are joined before anything they might
+  // still use is destroyed.
+  WorkerPool pool;
 
 public:
-  JsonRpcServer() : input(std::cin), output(std::cout) {}
+  explicit JsonRpcServer(size_t numWorkers = defaultNumWorkers(),
+                         size_t queueCapacity = DEFAULT_QUEUE_CAPACITY,
+                         size_t reservedWorkers = DEFAULT_RESERVED_WORKERS)
+      : input(std::cin), output(std::cout), writer(output),
+        pool(numWorkers, queueCapacity, reservedWorkers) {}
 
-  JsonRpcServer(std::istringstream &input, std::ostringstream &output)
-      : input(input), output(output) {}
+  JsonRpcServer(std::istream &input, std::ostream &output,
+                size_t numWorkers = defaultNumWorkers(),
+                size_t queueCapacity = DEFAULT_QUEUE_CAPACITY,
+                size_t reservedWorkers = DEFAULT_RESERVED_WORKERS)
+      : input(input), output(output), writer(output),
+        pool(numWorkers, queueCapacity, reservedWorkers) {}
 
   void loop(const std::shared_ptr<JsonRpcHandler> &handler);
+  // Runs work of the handler, that was not triggered by a message, on the
+  // workers.
+  void schedule(Lane lane, std::function<void()> job);
+  [[nodiscard]] LaneStats laneStats(Lane lane) const {
+    return this->pool.laneStats(lane);
+  }
   void reply(nlohmann::json callId, nlohmann::json result);
+  // For large results: `writeResult` appends the serialized result directly
+  // to the outgoing message, instead of building a nlohmann::json first.
+  void reply(const nlohmann::json &callId,
+             const std::function<void(std::string &)> &writeResult);
   void notification(const std::string &method, nlohmann::json params);
+  // Like `notification`, but a notification of this method with the same
+  // key, that was not written yet, is dropped in favor of this one.
+  void notification(const std::string &method, nlohmann::json params,
+                    const std::string &supersedeKey);
   void returnError(nlohmann::json callId, JsonrpcError error,
                    const std::string &message);
+  // Sends a request to the client. `onResult` is called with the result,
+  // once the client answered successfully. It runs on the thread reading
+  // the messages, so it must not block.
+  void request(const std::string &method, nlohmann::json params,
+               std::function<void(const nlohmann::json &)> onResult = nullptr);
   void exit();
   void wait();
 };
@@ -59,6 +124,19 @@ public:
   virtual void handleNotification(std::string method,
                                   nlohmann::json params) = 0;
   virtual void handleRequest(std::string method, nlohmann::json callId,
-                             nlohmann::json params) = 0;
+                             nlohmann::json params,
+                             std::shared_ptr<CancellationToken> token) = 0;
+  // If this returns a reader for a notification, it gets the params
+  // instead of `handleNotification`.
+  virtual std::unique_ptr<ParamsReader>
+  paramsReader(const std::string & /*method*/) {
+    return nullptr;
+  }
+  // The lane a message is scheduled on. `params` is null, if they were
+  // given to a ParamsReader.
+  virtual Lane lane(const std::string & /*method*/,
+                    const nlohmann::json & /*params*/) {
+    return Lane::EDIT;
+  }
 };
 }; // namespace jsonrpc
@@ -0,0 +1,174 @@
+#include "messageparser.hpp"
+
+#include "jsonrpc.hpp"
+
+#include <cstddef>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <utility>
+
+bool jsonrpc::MessageParser::null() {
+  if (this->forwarding) {
+    const auto ret = this->paramsReader->null();
+    this->forwarded(false, false);
+    return ret;
+  }
+  this->handleValue(nullptr);
+  return true;
+}
+
+bool jsonrpc::MessageParser::boolean(bool val) {
+  if (this->forwarding) {
+    const auto ret = this->paramsReader->boolean(val);
+    this->forwarded(false, false);
+    return ret;
+  }
+  this->handleValue(val);
+  return true;
+}
+
+bool jsonrpc::MessageParser::number_integer(number_integer_t val) {
+  if (this->forwarding) {
+    const auto ret = this->paramsReader->number_integer(val);
+    this->forwarded(false, false);
+    return ret;
+  }
+  this->handleValue(val);
+  return true;
+}
+
+bool jsonrpc::MessageParser::number_unsigned(number_unsigned_t val) {
+  if (this->forwarding) {
+    const auto ret = this->paramsReader->number_unsigned(val);
+    this->forwarded(false, false);
+    return ret;
+  }
+  this->handleValue(val);
+  return true;
+}
+
+bool jsonrpc::MessageParser::number_float(number_float_t val,
+                                          const string_t &str) {
+  if (this->forwarding) {
+    const auto ret = this->paramsReader->number_float(val, str);
+    this->forwarded(false, false);
+    return ret;
+  }
+  this->handleValue(val);
+  return true;
+}
+
+bool jsonrpc::MessageParser::string(string_t &val) {
+  if (this->forwarding) {
+    const auto ret = this->paramsReader->string(val);
+    this->forwarded(false, false);
+    return ret;
+  }
+  if (this->nextIsMethod) {
+    this->method = val;
+  }
+  this->handleValue(std::move(val));
+  return true;
+}
+
+bool jsonrpc::MessageParser::binary(binary_t &val) {
+  if (this->forwarding) {
+    const auto ret = this->paramsReader->binary(val);
+    this->forwarded(false, false);
+    return ret;
+  }
+  this->handleValue(nlohmann::json::binary(std::move(val)));
+  return true;
+}
+
+bool jsonrpc::MessageParser::start_object(std::size_t elements) {
+  if (this->forwarding) {
+    const auto ret = this->paramsReader->start_object(elements);
+    this->forwarded(true, false);
+    return ret;
+  }
+  this->stack.push_back(this->handleValue(nlohmann::json::object()));
+  return true;
+}
+
+bool jsonrpc::MessageParser::key(string_t &val) {
+  if (this->forwarding) {
+    return this->paramsReader->key(val);
+  }
+  if (this->stack.size() == 1) {
+    this->nextIsMethod = val == "method";
+    // Only possible if the method came first, which is what clients do
+    if (val == "params" && !this->method.empty()) {
+      this->paramsReader = this->handler.paramsReader(this->method);
+      if (this->paramsReader) {
+        this->forwarding = true;
+        return true;
+      }
+    }
+  }
+  this->objectElement = &(*this->stack.back())[std::move(val)];
+  return true;
+}
+
+bool jsonrpc::MessageParser::end_object() {
+  if (this->forwarding) {
+    const auto ret = this->paramsReader->end_object();
+    this->forwarded(false, true);
+    return ret;
+  }
+  this->stack.pop_back();
+  return true;
+}
+
+bool jsonrpc::MessageParser::start_array(std::size_t elements) {
+  if (this->forwarding) {
+    const auto ret = this->paramsReader->start_array(elements);
+    this->forwarded(true, false);
+    return ret;
+  }
+  this->stack.push_back(this->handleValue(nlohmann::json::array()));
+  return true;
+}
+
+bool jsonrpc::MessageParser::end_array() {
+  if (this->forwarding) {
+    const auto ret = this->paramsReader->end_array();
+    this->forwarded(false, true);
+    return ret;
+  }
+  this->stack.pop_back();
+  return true;
+}
+
+bool jsonrpc::MessageParser::parse_error(
+    std::size_t /*position*/, const std::string & /*lastToken*/,
+    const nlohmann::detail::exception &ex) {
+  this->error = ex.what();
+  return false;
+}
+
+nlohmann::json *jsonrpc::MessageParser::handleValue(nlohmann::json &&val) {
+  this->nextIsMethod = false;
+  if (this->stack.empty()) {
+    this->message = std::move(val);
+    return &this->message;
+  }
+  auto *parent = this->stack.back();
+  if (parent->is_array()) {
+    parent->push_back(std::move(val));
+    return &parent->back();
+  }
+  *this->objectElement = std::move(val);
+  return this->objectElement;
+}
+
+void jsonrpc::MessageParser::forwarded(bool opens, bool closes) {
+  if (opens) {
+    this->forwardDepth++;
+  } else if (closes) {
+    this->forwardDepth--;
+  }
+  if (this->forwardDepth == 0) {
+    this->forwarding = false;
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+namespace jsonrpc {
+
+class JsonRpcHandler;
+
+// Receives the params of a notification as SAX events while the message is
+// parsed, so they can be read into their final structure without building
+// a nlohmann::json first.
+class ParamsReader : public nlohmann::json_sax<nlohmann::json> {
+public:
+  // Called on a worker, once the whole message was parsed.
+  virtual void finish() = 0;
+};
+
+// Builds the nlohmann::json of a message from SAX events. Strings are moved
+// out of the lexer instead of being copied. If the handler has a
+// ParamsReader for the method, the params are handed to it instead.
+class MessageParser : public nlohmann::json_sax<nlohmann::json> {
+public:
+  nlohmann::json message;
+  std::unique_ptr<ParamsReader> paramsReader;
+  std::string error;
+
+  explicit MessageParser(JsonRpcHandler &handler) : handler(handler) {}
+
+  bool null() override;
+  bool boolean(bool val) override;
+  bool number_integer(number_integer_t val) override;
+  bool number_unsigned(number_unsigned_t val) override;
+  bool number_float(number_float_t val, const string_t &str) override;
+  bool string(string_t &val) override;
+  bool binary(binary_t &val) override;
+  bool start_object(std::size_t elements) override;
+  bool key(string_t &val) override;
+  bool end_object() override;
+  bool start_array(std::size_t elements) override;
+  bool end_array() override;
+  bool parse_error(std::size_t position, const std::string &lastToken,
+                   const nlohmann::detail::exception &ex) override;
+
+private:
+  JsonRpcHandler &handler;
+  std::vector<nlohmann::json *> stack;
+  nlohmann::json *objectElement = nullptr;
+  std::string method;
+  bool nextIsMethod = false;
+  bool forwarding = false;
+  size_t forwardDepth = 0;
+
+  nlohmann::json *handleValue(nlohmann::json &&val);
+  void forwarded(bool opens, bool closes);
+};
+}; // namespace jsonrpc
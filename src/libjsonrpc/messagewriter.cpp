@@ -0,0 +1,128 @@
+#include "messagewriter.hpp"
+
+#include "polyfill.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+jsonrpc::OutgoingMessage::OutgoingMessage(std::string buffer)
+    : buffer(std::move(buffer)) {
+  this->buffer.assign(MAX_HEADER_SIZE, ' ');
+}
+
+void jsonrpc::OutgoingMessage::finish() {
+  const auto &header = std::format("Content-Length: {}\r\n\r\n",
+                                   this->buffer.size() - MAX_HEADER_SIZE);
+  this->start = MAX_HEADER_SIZE - header.size();
+  std::memcpy(this->buffer.data() + this->start, header.data(), header.size());
+}
+
+jsonrpc::MessageWriter::MessageWriter(std::ostream &output, size_t capacity)
+    : output(output), capacity(std::max(capacity, (size_t)1)) {
+  this->thread = std::thread(&MessageWriter::work, this);
+}
+
+jsonrpc::MessageWriter::~MessageWriter() {
+  {
+    std::scoped_lock const lock(this->mtx);
+    this->stopping = true;
+  }
+  this->messageAvailable.notify_all();
+  this->spaceAvailable.notify_all();
+  this->thread.join();
+}
+
+jsonrpc::OutgoingMessage jsonrpc::MessageWriter::newMessage() {
+  std::scoped_lock const lock(this->mtx);
+  if (this->spareBuffers.empty()) {
+    return OutgoingMessage();
+  }
+  auto buffer = std::move(this->spareBuffers.back());
+  this->spareBuffers.pop_back();
+  return OutgoingMessage(std::move(buffer));
+}
+
+void jsonrpc::MessageWriter::send(OutgoingMessage message) {
+  this->enqueue(std::move(message), nullptr);
+}
+
+void jsonrpc::MessageWriter::send(OutgoingMessage message,
+                                  const std::string &supersedeKey) {
+  this->enqueue(std::move(message), &supersedeKey);
+}
+
+void jsonrpc::MessageWriter::enqueue(OutgoingMessage message,
+                                     const std::string *supersedeKey) {
+  std::unique_lock lock(this->mtx);
+  if (supersedeKey) {
+    const auto &iter = this->queuedKeys.find(*supersedeKey);
+    if (iter != this->queuedKeys.end()) {
+      // Takes the place of the old one, so nothing new has to fit in
+      this->queue[iter->second] = std::move(message);
+      return;
+    }
+  }
+  this->spaceAvailable.wait(lock, [this] {
+    return this->stopping || this->queue.size() < this->capacity;
+  });
+  if (supersedeKey) {
+    this->queuedKeys[*supersedeKey] = this->queue.size();
+  }
+  this->queue.emplace_back(std::move(message));
+  lock.unlock();
+  this->messageAvailable.notify_one();
+}
+
+void jsonrpc::MessageWriter::flush() {
+  std::unique_lock lock(this->mtx);
+  this->written.wait(
+      lock, [this] { return this->queue.empty() && !this->writing; });
+}
+
+void jsonrpc::MessageWriter::work() {
+  std::vector<OutgoingMessage> batch;
+  while (true) {
+    {
+      std::unique_lock lock(this->mtx);
+      this->messageAvailable.wait(
+          lock, [this] { return this->stopping || !this->queue.empty(); });
+      if (this->queue.empty()) {
+        return;
+      }
+      batch.swap(this->queue);
+      this->queuedKeys.clear();
+      this->writing = true;
+    }
+    this->spaceAvailable.notify_all();
+    size_t batchBytes = 0;
+    for (const auto &message : batch) {
+      const auto &frame = message.frame();
+      this->output.write(frame.data(), (std::streamsize)frame.size());
+      batchBytes += frame.size();
+    }
+    this->output.flush();
+    globalStats().bytesWritten.fetch_add(batchBytes,
+                                         std::memory_order_relaxed);
+    {
+      std::scoped_lock const lock(this->mtx);
+      for (auto &message : batch) {
+        if (this->spareBuffers.size() == MAX_SPARE_BUFFERS) {
+          break;
+        }
+        this->spareBuffers.emplace_back(std::move(message.buffer));
+      }
+      this->writing = false;
+      if (this->queue.empty()) {
+        this->written.notify_all();
+      }
+    }
+    batch.clear();
+  }
+}
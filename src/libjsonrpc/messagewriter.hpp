@@ -0,0 +1,78 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace jsonrpc {
+
+constexpr size_t DEFAULT_OUTBOUND_CAPACITY = 1024;
+// "Content-Length: " + up to 20 digits + "\r\n\r\n"
+constexpr size_t MAX_HEADER_SIZE = 40;
+constexpr size_t MAX_SPARE_BUFFERS = 16;
+
+// A message as written to the client. The payload is appended to `buffer`
+// behind room reserved for the header, which is only filled in by `finish`,
+// once the length is known. So the payload never has to be copied into a
+// separately framed string.
+class OutgoingMessage {
+public:
+  std::string buffer;
+
+  explicit OutgoingMessage(std::string buffer = {});
+
+  void finish();
+  [[nodiscard]] std::string_view frame() const {
+    return std::string_view{this->buffer}.substr(this->start);
+  }
+
+private:
+  size_t start = 0;
+};
+
+// Writes framed messages to the client on a thread of its own. Everything
+// queued since the last wakeup is written with a single flush. If the client
+// does not keep up and `capacity` messages are waiting, `send` blocks.
+class MessageWriter {
+public:
+  explicit MessageWriter(std::ostream &output,
+                         size_t capacity = DEFAULT_OUTBOUND_CAPACITY);
+  ~MessageWriter();
+
+  MessageWriter(const MessageWriter &) = delete;
+  MessageWriter &operator=(const MessageWriter &) = delete;
+
+  // A message, whose buffer is recycled from already written ones.
+  OutgoingMessage newMessage();
+  void send(OutgoingMessage message);
+  // If a message with the same key is still queued, it is replaced
+  // instead of sending both.
+  void send(OutgoingMessage message, const std::string &supersedeKey);
+  // Blocks until everything queued so far was written.
+  void flush();
+
+private:
+  std::ostream &output;
+  std::mutex mtx;
+  std::condition_variable messageAvailable;
+  std::condition_variable spaceAvailable;
+  std::condition_variable written;
+  std::vector<OutgoingMessage> queue;
+  std::vector<std::string> spareBuffers;
+  // Index into `queue` of the queued message for each key
+  std::map<std::string, size_t> queuedKeys;
+  size_t capacity;
+  bool writing = false;
+  bool stopping = false;
+  std::thread thread;
+
+  void enqueue(OutgoingMessage message, const std::string *supersedeKey);
+  void work();
+};
+}; // namespace jsonrpc
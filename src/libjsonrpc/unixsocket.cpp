@@ -0,0 +1,315 @@
+#include "unixsocket.hpp"
+
+#include "polyfill.hpp"
+
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <istream>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static std::runtime_error socketError(const std::string &what) {
+  return std::runtime_error(std::format("{}: {}", what, std::strerror(errno)));
+}
+
+static bool writeFully(int fd, const char *data, size_t count) {
+  while (count != 0) {
+    // A client that went away must not take down the whole daemon with
+    // a SIGPIPE.
+    auto written = ::send(fd, data, count, MSG_NOSIGNAL);
+    if (written == -1 && errno == ENOTSOCK) {
+      written = ::write(fd, data, count);
+    }
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    count -= (size_t)written;
+  }
+  return true;
+}
+
+static ssize_t readSome(int fd, char *data, size_t count) {
+  while (true) {
+    const auto got = ::read(fd, data, count);
+    if (got != -1 || errno != EINTR) {
+      return got;
+    }
+  }
+}
+
+jsonrpc::FdStreamBuf::FdStreamBuf(int fd, size_t bufferSize)
+    : fd(fd), readBuffer(bufferSize) {}
+
+jsonrpc::FdStreamBuf::int_type jsonrpc::FdStreamBuf::underflow() {
+  if (this->gptr() < this->egptr()) {
+    return traits_type::to_int_type(*this->gptr());
+  }
+  const auto got =
+      readSome(this->fd, this->readBuffer.data(), this->readBuffer.size());
+  if (got <= 0) {
+    return traits_type::eof();
+  }
+  this->setg(this->readBuffer.data(), this->readBuffer.data(),
+             this->readBuffer.data() + got);
+  return traits_type::to_int_type(*this->gptr());
+}
+
+jsonrpc::FdStreamBuf::int_type jsonrpc::FdStreamBuf::overflow(int_type chr) {
+  if (traits_type::eq_int_type(chr, traits_type::eof())) {
+    return traits_type::not_eof(chr);
+  }
+  const auto asChar = traits_type::to_char_type(chr);
+  return writeFully(this->fd, &asChar, 1) ? chr : traits_type::eof();
+}
+
+std::streamsize jsonrpc::FdStreamBuf::xsputn(const char *data,
+                                             std::streamsize count) {
+  return writeFully(this->fd, data, (size_t)count) ? count : 0;
+}
+
+static sockaddr_un makeAddress(const std::filesystem::path &path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  const auto &asString = path.string();
+  if (asString.size() >= sizeof(addr.sun_path)) {
+    throw std::runtime_error(
+        std::format("Socket path is too long: {}", asString));
+  }
+  std::memcpy(addr.sun_path, asString.c_str(), asString.size() + 1);
+  return addr;
+}
+
+// Creates `dir` if it is missing and makes sure no other user can create,
+// replace or remove files in it.
+static void checkSocketDirectory(const std::filesystem::path &dir) {
+  if (!std::filesystem::exists(dir)) {
+    std::filesystem::create_directories(dir.parent_path());
+    if (::mkdir(dir.c_str(), 0700) == -1 && errno != EEXIST) {
+      throw socketError(
+          std::format("Failed to create {}", dir.generic_string()));
+    }
+  }
+  struct stat info {};
+  if (::lstat(dir.c_str(), &info) == -1) {
+    throw socketError(std::format("Failed to stat {}", dir.generic_string()));
+  }
+  if (!S_ISDIR(info.st_mode)) {
+    throw std::runtime_error(
+        std::format("{} is not a directory", dir.generic_string()));
+  }
+  // Directories like /tmp are writable for everyone, but the sticky bit
+  // keeps others from replacing files they don't own.
+  const auto foreignOwner = info.st_uid != ::getuid() && info.st_uid != 0;
+  const auto sticky = (info.st_mode & S_ISVTX) != 0;
+  const auto writableByOthers =
+      (info.st_mode & (S_IWGRP | S_IWOTH)) != 0 && !sticky;
+  if (foreignOwner || writableByOthers) {
+    throw std::runtime_error(std::format(
+        "Refusing to use {}, as other users could modify it",
+        dir.generic_string()));
+  }
+}
+
+int jsonrpc::listenUnix(const std::filesystem::path &path) {
+  const auto addr = makeAddress(path);
+  checkSocketDirectory(std::filesystem::absolute(path).parent_path());
+  struct stat info {};
+  if (::lstat(path.c_str(), &info) == 0) {
+    if (!S_ISSOCK(info.st_mode) || info.st_uid != ::getuid()) {
+      throw std::runtime_error(std::format(
+          "Refusing to replace {}, it is not a socket of the current user",
+          path.generic_string()));
+    }
+    const auto probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const auto alive =
+        probe != -1 &&
+        ::connect(probe, (const sockaddr *)&addr, sizeof(addr)) == 0;
+    if (probe != -1) {
+      ::close(probe);
+    }
+    if (alive) {
+      throw std::runtime_error(
+          std::format("A daemon is already listening on {}",
+                      path.generic_string()));
+    }
+    std::filesystem::remove(path);
+  }
+  const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    throw socketError("Failed to create socket");
+  }
+  // The socket file is created without any permissions for other users, so
+  // there is no moment in which they could connect.
+  const auto oldMask = ::umask(077);
+  const auto bound = ::bind(fd, (const sockaddr *)&addr, sizeof(addr));
+  ::umask(oldMask);
+  if (bound == -1) {
+    const auto error = socketError("Failed to bind socket");
+    ::close(fd);
+    throw error;
+  }
+  if (::listen(fd, SOMAXCONN) == -1) {
+    const auto error = socketError("Failed to listen on socket");
+    ::close(fd);
+    throw error;
+  }
+  return fd;
+}
+
+int jsonrpc::connectUnix(const std::filesystem::path &path) {
+  const auto addr = makeAddress(path);
+  const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    throw socketError("Failed to create socket");
+  }
+  if (::connect(fd, (const sockaddr *)&addr, sizeof(addr)) == -1) {
+    const auto error = socketError(
+        std::format("Failed to connect to {}", path.generic_string()));
+    ::close(fd);
+    throw error;
+  }
+  // Otherwise another user could bind the path first and receive all
+  // buffers of this one.
+  if (!peerIsCurrentUser(fd)) {
+    ::close(fd);
+    throw std::runtime_error(
+        std::format("The daemon on {} runs as another user",
+                    path.generic_string()));
+  }
+  return fd;
+}
+
+bool jsonrpc::peerIsCurrentUser(int fd) {
+#ifdef SO_PEERCRED
+  ucred cred{};
+  socklen_t length = sizeof(cred);
+  if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == -1) {
+    return false;
+  }
+  return cred.uid == ::getuid();
+#else
+  uid_t uid = 0;
+  gid_t gid = 0;
+  if (::getpeereid(fd, &uid, &gid) == -1) {
+    return false;
+  }
+  return uid == ::getuid();
+#endif
+}
+
+std::filesystem::path jsonrpc::defaultSocketPath() {
+  const auto *runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+  if (runtimeDir != nullptr && *runtimeDir != '\0') {
+    return std::filesystem::path(runtimeDir) / "mesonlsp.sock";
+  }
+  return std::filesystem::temp_directory_path() /
+         std::format("mesonlsp-{}", ::getuid()) / "mesonlsp.sock";
+}
+
+void jsonrpc::proxy(int inFd, int outFd, int socketFd) {
+  std::array<pollfd, 2> fds{};
+  fds[0].fd = inFd;
+  fds[0].events = POLLIN;
+  fds[1].fd = socketFd;
+  fds[1].events = POLLIN;
+  std::vector<char> buffer(FD_BUFFER_SIZE);
+  while (true) {
+    if (::poll(fds.data(), fds.size(), -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    if (fds[1].revents != 0) {
+      const auto got = readSome(socketFd, buffer.data(), buffer.size());
+      if (got <= 0 || !writeFully(outFd, buffer.data(), (size_t)got)) {
+        return;
+      }
+    }
+    if (fds[0].revents != 0) {
+      const auto got = readSome(inFd, buffer.data(), buffer.size());
+      if (got <= 0) {
+        // The client is done, but replies may still be on their way
+        ::shutdown(socketFd, SHUT_WR);
+        fds[0].fd = -1;
+      } else if (!writeFully(socketFd, buffer.data(), (size_t)got)) {
+        return;
+      }
+    }
+  }
+}
+
+static bool readMessage(std::istream &input, std::string &body) {
+  constexpr std::string_view PREFIX = "Content-Length:";
+  size_t contentLength = 0;
+  std::string line;
+  while (std::getline(input, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      body.resize(contentLength);
+      input.read(body.data(), (std::streamsize)contentLength);
+      return (size_t)input.gcount() == contentLength;
+    }
+    std::string_view view = line;
+    if (view.starts_with(PREFIX)) {
+      view.remove_prefix(PREFIX.size());
+      while (!view.empty() && view.front() == ' ') {
+        view.remove_prefix(1);
+      }
+      std::from_chars(view.data(), view.data() + view.size(), contentLength);
+    }
+  }
+  return false;
+}
+
+nlohmann::json jsonrpc::request(int fd, const std::string &method,
+                                const nlohmann::json &params) {
+  nlohmann::json data;
+  data["jsonrpc"] = "2.0";
+  data["id"] = 1;
+  data["method"] = method;
+  data["params"] = params;
+  const auto &payload = data.dump();
+  const auto &message =
+      std::format("Content-Length: {}\r\n\r\n{}", payload.size(), payload);
+  if (!writeFully(fd, message.data(), message.size())) {
+    throw socketError("Failed to send request");
+  }
+  FdStreamBuf buffer(fd);
+  std::istream input(&buffer);
+  std::string body;
+  while (readMessage(input, body)) {
+    auto reply = nlohmann::json::parse(body);
+    if (!reply.contains("id") || reply["id"] != 1) {
+      continue;
+    }
+    if (reply.contains("error")) {
+      throw std::runtime_error(
+          reply["error"].value("message", std::string("Unknown error")));
+    }
+    return std::move(reply["result"]);
+  }
+  throw std::runtime_error("Connection closed before the reply arrived");
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <nlohmann/json.hpp>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace jsonrpc {
+
+constexpr size_t FD_BUFFER_SIZE = 64 * 1024;
+
+// A streambuf reading from and writing to a file descriptor, so a
+// JsonRpcServer can talk over a socket. Reads are buffered, writes go to
+// the descriptor directly, as the MessageWriter already batches them.
+// Does not close the descriptor.
+class FdStreamBuf : public std::streambuf {
+public:
+  explicit FdStreamBuf(int fd, size_t bufferSize = FD_BUFFER_SIZE);
+
+protected:
+  int_type underflow() override;
+  int_type overflow(int_type chr) override;
+  std::streamsize xsputn(const char *data, std::streamsize count) override;
+
+private:
+  int fd;
+  std::vector<char> readBuffer;
+};
+
+// Returns a socket listening on `path`, that only the current user can
+// connect to. A missing parent directory is created, accessible only by the
+// current user. A stale socket file left behind by a crashed daemon is
+// replaced, but only if it belongs to the current user.
+int listenUnix(const std::filesystem::path &path);
+// Throws if the socket on `path` belongs to a process of another user.
+int connectUnix(const std::filesystem::path &path);
+// Whether the process on the other end of the socket `fd` runs as the
+// current user.
+bool peerIsCurrentUser(int fd);
+// In $XDG_RUNTIME_DIR, or else in a directory of its own in the temporary
+// directory, as that one is writable for everyone.
+std::filesystem::path defaultSocketPath();
+
+// Copies everything between the client (`inFd`/`outFd`) and `socketFd`,
+// until either side closed its end.
+void proxy(int inFd, int outFd, int socketFd);
+
+// Sends a single request over `fd` and waits for its result. Notifications
+// received in the meantime are skipped.
+nlohmann::json request(int fd, const std::string &method,
+                       const nlohmann::json &params);
+}; // namespace jsonrpc
@@ -0,0 +1,142 @@
+#include "workerpool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+size_t jsonrpc::defaultNumWorkers() {
+  return std::max((size_t)std::thread::hardware_concurrency(), MIN_WORKERS);
+}
+
+static void runJob(const std::function<void()> &job) {
+  try {
+    job();
+  } catch (...) {
+    // The handlers report their errors to the client on their own,
+    // whatever still escapes must not take down the worker.
+  }
+}
+
+jsonrpc::WorkerPool::WorkerPool(size_t numWorkers, size_t queueCapacity,
+                                size_t reservedWorkers)
+    : queueCapacity(std::max(queueCapacity, (size_t)1)) {
+  numWorkers = std::max(numWorkers, (size_t)1);
+  // At least one worker has to be left for the other lanes
+  this->reservedWorkers = std::min(reservedWorkers, numWorkers - 1);
+  this->workers.reserve(numWorkers);
+  for (size_t i = 0; i < numWorkers; i++) {
+    this->workers.emplace_back(&WorkerPool::work, this,
+                               i < this->reservedWorkers);
+  }
+}
+
+jsonrpc::WorkerPool::~WorkerPool() {
+  {
+    std::scoped_lock const lock(this->mtx);
+    this->stopping = true;
+  }
+  this->jobAvailable.notify_all();
+  this->spaceAvailable.notify_all();
+  for (auto &worker : this->workers) {
+    worker.join();
+  }
+}
+
+void jsonrpc::WorkerPool::submit(std::function<void()> job, Lane lane) {
+  if (lane == Lane::INLINE) {
+    runJob(job);
+    return;
+  }
+  auto &queue = this->queues[(size_t)lane];
+  std::unique_lock lock(this->mtx);
+  this->spaceAvailable.wait(lock, [this, &queue] {
+    return this->stopping || queue.size() < this->queueCapacity;
+  });
+  if (this->stopping) {
+    return;
+  }
+  queue.push_back({std::move(job), std::chrono::steady_clock::now()});
+  lock.unlock();
+  // The woken worker might be a reserved one, that can't take this job
+  this->jobAvailable.notify_all();
+}
+
+void jsonrpc::WorkerPool::waitIdle() {
+  std::unique_lock lock(this->mtx);
+  this->idle.wait(lock, [this] {
+    return this->allQueuesEmpty() && this->running == 0;
+  });
+}
+
+jsonrpc::LaneStats jsonrpc::WorkerPool::laneStats(Lane lane) const {
+  const auto &stats = this->stats[(size_t)lane];
+  LaneStats ret;
+  ret.jobs = stats.jobs.load(std::memory_order_relaxed);
+  ret.totalWait = std::chrono::nanoseconds(
+      stats.totalWaitNanos.load(std::memory_order_relaxed));
+  ret.maxWait = std::chrono::nanoseconds(
+      stats.maxWaitNanos.load(std::memory_order_relaxed));
+  return ret;
+}
+
+bool jsonrpc::WorkerPool::allQueuesEmpty() const {
+  return std::ranges::all_of(this->queues,
+                             [](const auto &queue) { return queue.empty(); });
+}
+
+size_t jsonrpc::WorkerPool::nextLane(bool interactiveOnly) const {
+  const auto lanes = interactiveOnly ? (size_t)1 : NUM_LANES;
+  for (size_t lane = 0; lane < lanes; lane++) {
+    if (!this->queues[lane].empty()) {
+      return lane;
+    }
+  }
+  return NUM_LANES;
+}
+
+void jsonrpc::WorkerPool::recordWait(size_t lane,
+                                     std::chrono::nanoseconds wait) {
+  auto &stats = this->stats[lane];
+  const auto nanos = (int64_t)wait.count();
+  stats.jobs.fetch_add(1, std::memory_order_relaxed);
+  stats.totalWaitNanos.fetch_add(nanos, std::memory_order_relaxed);
+  auto max = stats.maxWaitNanos.load(std::memory_order_relaxed);
+  while (max < nanos && !stats.maxWaitNanos.compare_exchange_weak(
+                            max, nanos, std::memory_order_relaxed)) {
+  }
+}
+
+void jsonrpc::WorkerPool::work(bool interactiveOnly) {
+  while (true) {
+    QueuedJob job;
+    size_t lane = NUM_LANES;
+    {
+      std::unique_lock lock(this->mtx);
+      this->jobAvailable.wait(lock, [this, interactiveOnly, &lane] {
+        lane = this->nextLane(interactiveOnly);
+        return this->stopping || lane != NUM_LANES;
+      });
+      if (lane == NUM_LANES) {
+        return;
+      }
+      job = std::move(this->queues[lane].front());
+      this->queues[lane].pop_front();
+      this->running++;
+    }
+    this->spaceAvailable.notify_all();
+    this->recordWait(lane, std::chrono::steady_clock::now() - job.queuedAt);
+    runJob(job.job);
+    {
+      std::scoped_lock const lock(this->mtx);
+      this->running--;
+      if (this->running == 0 && this->allQueuesEmpty()) {
+        this->idle.notify_all();
+      }
+    }
+  }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jsonrpc {
+
+constexpr size_t DEFAULT_QUEUE_CAPACITY = 1024;
+constexpr size_t MIN_WORKERS = 4;
+constexpr size_t DEFAULT_RESERVED_WORKERS = 0;
+
+size_t defaultNumWorkers();
+
+// The lanes jobs are scheduled on, in the order of their priority.
+enum class Lane {
+  // Requests the user is waiting for, e.g. completion or hover
+  INTERACTIVE = 0,
+  // Changes to documents
+  EDIT = 1,
+  // Anything that may take long, e.g. reparsing a whole workspace
+  BACKGROUND = 2,
+  // Never queued, runs directly on the thread that received the message
+  INLINE = 3,
+};
+
+constexpr size_t NUM_LANES = 3;
+
+struct LaneStats {
+  uint64_t jobs = 0;
+  std::chrono::nanoseconds totalWait{0};
+  std::chrono::nanoseconds maxWait{0};
+};
+
+// A fixed set of threads that executes jobs. Each lane is a queue, that is
+// executed in the order jobs were submitted. A free worker always takes the
+// job of the most important lane first. The first `reservedWorkers` workers
+// only ever take interactive jobs, so these never wait behind a long
+// running background job.
+// The queues are bounded, if the queue of a lane is full, `submit` blocks
+// until a worker took a job from it.
+class WorkerPool {
+public:
+  explicit WorkerPool(size_t numWorkers = defaultNumWorkers(),
+                      size_t queueCapacity = DEFAULT_QUEUE_CAPACITY,
+                      size_t reservedWorkers = DEFAULT_RESERVED_WORKERS);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  // Jobs on the inline lane are executed right away by the caller.
+  void submit(std::function<void()> job, Lane lane = Lane::EDIT);
+  // Blocks until all queues are empty and no job is running anymore.
+  void waitIdle();
+  // How long the jobs of this lane waited in the queue before a worker
+  // started them.
+  [[nodiscard]] LaneStats laneStats(Lane lane) const;
+
+  [[nodiscard]] size_t numWorkers() const { return this->workers.size(); }
+
+private:
+  struct QueuedJob {
+    std::function<void()> job;
+    std::chrono::steady_clock::time_point queuedAt;
+  };
+
+  struct AtomicLaneStats {
+    std::atomic<uint64_t> jobs = 0;
+    std::atomic<int64_t> totalWaitNanos = 0;
+    std::atomic<int64_t> maxWaitNanos = 0;
+  };
+
+  std::mutex mtx;
+  std::condition_variable jobAvailable;
+  std::condition_variable spaceAvailable;
+  std::condition_variable idle;
+  std::array<std::deque<QueuedJob>, NUM_LANES> queues;
+  std::array<AtomicLaneStats, NUM_LANES> stats;
+  size_t queueCapacity;
+  size_t reservedWorkers;
+  size_t running = 0;
+  bool stopping = false;
+  std::vector<std::thread> workers;
+
+  void work(bool interactiveOnly);
+  [[nodiscard]] bool allQueuesEmpty() const;
+  // Returns the lane a worker should take its next job from, NUM_LANES
+  // if there is nothing for it.
+  [[nodiscard]] size_t nextLane(bool interactiveOnly) const;
+  void recordWait(size_t lane, std::chrono::nanoseconds wait);
+};
+}; // namespace jsonrpc
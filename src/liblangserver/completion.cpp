@@ -1,6 +1,7 @@
 #include "completion.hpp"
 
 #include "argument.hpp"
+#include "cancellation.hpp"
 #include "function.hpp"
 #include "langserverutils.hpp"
 #include "log.hpp"
@@ -46,7 +47,8 @@ static void inCallCompletion(const ArgumentList *al,
                              const LSPPosition &position);
 static void afterDotCompletion(std::vector<CompletionItem> &ret,
                                const std::filesystem::path &path,
-                               MesonTree *tree, const LSPPosition &position,
+                               const MesonTree *tree,
+                               const LSPPosition &position,
                                const std::string &prev);
 static void idExpressionCompletion(const IdExpression *idExpr,
                                    const MesonTree *tree,
@@ -75,10 +77,11 @@ specialStringLiteralAutoCompletion(const StringLiteral *literal,
                                    std::vector<CompletionItem> &ret);
 
 std::vector<CompletionItem> complete(const std::filesystem::path &path,
-                                     MesonTree *tree,
+                                     const MesonTree *tree,
                                      const std::shared_ptr<Node> &ast,
                                      const LSPPosition &position,
-                                     const std::set<std::string> &pkgNames) {
+                                     const std::set<std::string> &pkgNames,
+                                     const CancellationToken *token) {
   auto lines = split(ast->file->contents(), "\n");
   lines.emplace_back("\n");
   std::vector<CompletionItem> ret;
@@ -94,7 +97,8 @@ std::vector<CompletionItem> complete(const std::filesystem::path &path,
   if (!prev.empty()) {
     afterDotCompletion(ret, path, tree, position, prev);
   }
-  const auto idExprAtPos = tree->metadata.findIdExpressionAt(
+  CancellationToken::check(token);
+  const auto idExprAtPos = tree->metadata->findIdExpressionAt(
       path, position.line, position.character);
   if (idExprAtPos.has_value()) {
     const auto *idExpr = idExprAtPos.value();
@@ -107,10 +111,12 @@ std::vector<CompletionItem> complete(const std::filesystem::path &path,
   trim(following);
   const auto inCall = trimmedPrev.empty() || trimmedPrev == ")" ||
                       following.starts_with(",") || following.starts_with(")");
+  CancellationToken::check(token);
   if (inCall) {
     inCallCompletion(tree, path, position, idExprAtPos, ret);
   }
-  const auto slAtPos = tree->metadata.findStringLiteralAt(path, position.line,
+  CancellationToken::check(token);
+  const auto slAtPos = tree->metadata->findStringLiteralAt(path, position.line,
                                                           position.character);
   if (slAtPos.has_value()) {
     LOG.info("Found string literal");
@@ -130,7 +136,7 @@ static void inCallCompletionFunction(const MesonTree *tree,
                                      const LSPPosition &position,
                                      const std::optional<IdExpression *> idExpr,
                                      std::vector<CompletionItem> &ret) {
-  const auto &callOpt = tree->metadata.findFullFunctionExpressionAt(
+  const auto &callOpt = tree->metadata->findFullFunctionExpressionAt(
       path, position.line, position.character);
   if (!callOpt.has_value()) {
     return;
@@ -148,7 +154,7 @@ static void inCallCompletion(const MesonTree *tree,
                              const LSPPosition &position,
                              const std::optional<IdExpression *> idExpr,
                              std::vector<CompletionItem> &ret) {
-  auto callOpt = tree->metadata.findFullMethodExpressionAt(path, position.line,
+  auto callOpt = tree->metadata->findFullMethodExpressionAt(path, position.line,
                                                            position.character);
   if (!callOpt.has_value()) {
     inCallCompletionFunction(tree, path, position, idExpr, ret);
@@ -178,7 +184,7 @@ static void emptyLineCompletion(const MesonTree *tree,
                      TextEdit(LSPRange(position, position), builtin));
   }
   std::set<std::string> inserted;
-  for (const auto &identifier : tree->metadata.encounteredIds) {
+  for (const auto &identifier : tree->metadata->encounteredIds) {
     if (identifier->file->file == path &&
         identifier->location.startLine > position.line) {
       break;
@@ -211,7 +217,7 @@ static void idExpressionCompletion(const IdExpression *idExpr,
       (dynamic_cast<const AssignmentStatement *>(parent) != nullptr);
   const auto &loweredId = lowercase(idExpr->id);
   std::set<std::string> toInsert;
-  for (const auto &identifier : tree->metadata.encounteredIds) {
+  for (const auto &identifier : tree->metadata->encounteredIds) {
     if (identifier->file->file == path &&
         identifier->location.startLine > position.line) {
       break;
@@ -273,7 +279,8 @@ insertFns:
 
 static void afterDotCompletion(std::vector<CompletionItem> &ret,
                                const std::filesystem::path &path,
-                               MesonTree *tree, const LSPPosition &position,
+                               const MesonTree *tree,
+                               const LSPPosition &position,
                                const std::string &prev) {
   auto lastCharSeen = prev.back();
   if (lastCharSeen != '.' && lastCharSeen != ')') {
@@ -297,10 +304,12 @@ static void afterDotCompletion(std::vector<CompletionItem> &ret,
     }
     LOG.info(std::format("ErrorID: '{}'", errorId.value()));
     std::vector<std::shared_ptr<Type>> errorTypes;
-    for (auto *const identifier :
-         tree->metadata.fileMetadata[path].identifiers) {
-      errorTypes.insert(errorTypes.end(), identifier->types.begin(),
-                        identifier->types.end());
+    const auto &fileMetadata = tree->metadata->fileMetadata;
+    if (fileMetadata.contains(path)) {
+      for (auto *const identifier : fileMetadata.at(path).identifiers) {
+        errorTypes.insert(errorTypes.end(), identifier->types.begin(),
+                          identifier->types.end());
+      }
     }
     const auto *toAdd = lastCharSeen == '.' ? "" : ".";
     for (const auto &method : fillTypes(tree, errorTypes)) {
@@ -314,33 +323,33 @@ static void afterDotCompletion(std::vector<CompletionItem> &ret,
 static std::optional<std::vector<std::shared_ptr<Type>>>
 afterDotCompletion(const MesonTree *tree, const std::filesystem::path &path,
                    uint64_t line, uint64_t character, bool recurse) {
-  auto idExprOpt = tree->metadata.findIdExpressionAt(path, line, character);
+  auto idExprOpt = tree->metadata->findIdExpressionAt(path, line, character);
   if (idExprOpt.has_value()) {
     LOG.info(std::format("Found identifier {}", idExprOpt.value()->id));
     return idExprOpt.value()->types;
   }
   auto fExprOpt =
-      tree->metadata.findFullFunctionExpressionAt(path, line, character - 1);
+      tree->metadata->findFullFunctionExpressionAt(path, line, character - 1);
   if (fExprOpt.has_value() && fExprOpt.value()->function) {
     LOG.info(
         std::format("Found func call {}", fExprOpt.value()->function->id()));
     return fExprOpt.value()->types;
   }
   auto mExprOpt =
-      tree->metadata.findFullMethodExpressionAt(path, line, character - 1);
+      tree->metadata->findFullMethodExpressionAt(path, line, character - 1);
   if (mExprOpt.has_value() && mExprOpt.value()->method) {
     LOG.info(
         std::format("Found method call {}", mExprOpt.value()->method->id()));
     return mExprOpt.value()->types;
   }
   auto sseOpt =
-      tree->metadata.findSubscriptExpressionAt(path, line, character - 1);
+      tree->metadata->findSubscriptExpressionAt(path, line, character - 1);
   if (sseOpt.has_value()) {
     LOG.info(std::format("Found subscript expression {}",
                          sseOpt.value()->location.format()));
     return sseOpt.value()->types;
   }
-  auto stringLit = tree->metadata.findStringLiteralAt(path, line, character);
+  auto stringLit = tree->metadata->findStringLiteralAt(path, line, character);
   if (stringLit.has_value()) {
     LOG.info(std::format("Found string literal {}",
                          stringLit.value()->location.format()));
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "cancellation.hpp"
 #include "lsptypes.hpp"
 #include "mesontree.hpp"
 #include "node.hpp"
@@ -9,7 +10,8 @@
 #include <vector>
 
 std::vector<CompletionItem> complete(const std::filesystem::path &path,
-                                     MesonTree *tree,
+                                     const MesonTree *tree,
                                      const std::shared_ptr<Node> &ast,
                                      const LSPPosition &position,
-                                     const std::set<std::string> &pkgNames);
+                                     const std::set<std::string> &pkgNames,
+                                     const CancellationToken *token = nullptr);
@@ -0,0 +1,78 @@
+#include "daemon.hpp"
+
+#include "jsonrpc.hpp"
+#include "langserver.hpp"
+#include "log.hpp"
+#include "polyfill.hpp"
+#include "statslogger.hpp"
+#include "unixsocket.hpp"
+#include "utils.hpp"
+#include "workerpool.hpp"
+
+#include <cerrno>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <utility>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+const static Logger LOG("Daemon"); // NOLINT
+
+// The exit notification only ends the session, not the whole process.
+class DaemonSession : public LanguageServer {
+public:
+  DaemonSession(std::shared_ptr<SharedState> shared, int fd)
+      : LanguageServer(std::move(shared)), fd(fd) {}
+
+  void onExit() override { ::shutdown(this->fd, SHUT_RD); }
+
+private:
+  int fd;
+};
+
+void Daemon::serve(int fd) {
+  LOG.info(std::format("Starting session on fd {}", fd));
+  {
+    jsonrpc::FdStreamBuf buffer(fd);
+    std::istream input(&buffer);
+    std::ostream output(&buffer);
+    auto handler = std::make_shared<DaemonSession>(this->shared, fd);
+    auto server = std::make_shared<jsonrpc::JsonRpcServer>(
+        input, output, jsonrpc::defaultNumWorkers(),
+        jsonrpc::DEFAULT_QUEUE_CAPACITY, this->interactiveWorkers);
+    handler->server = server;
+    server->loop(handler);
+    server->wait();
+    handler->server = nullptr;
+  }
+  ::close(fd);
+  LOG.info(std::format("Session on fd {} ended", fd));
+}
+
+void Daemon::run(int listenFd) {
+  // Scanning pkg-config takes a while, so do it before the first client
+  // is waiting for it.
+  this->shared->packages({});
+  const StatsLogger statsLogger;
+  while (true) {
+    const auto fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      LOG.error(std::format("Failed to accept(): {}", errno2string()));
+      return;
+    }
+    // The socket is private already, but other users must never get to
+    // read files through this daemon.
+    if (!jsonrpc::peerIsCurrentUser(fd)) {
+      LOG.warn("Rejected a connection from another user");
+      ::close(fd);
+      continue;
+    }
+    std::thread(&Daemon::serve, this, fd).detach();
+  }
+}
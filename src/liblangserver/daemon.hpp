@@ -0,0 +1,28 @@
+#pragma once
+
+#include "sharedstate.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Serves any number of LSP sessions from one process. All sessions share
+// one SharedState, so only the first one has to pay for building it.
+class Daemon {
+public:
+  explicit Daemon(
+      std::shared_ptr<SharedState> shared = std::make_shared<SharedState>(),
+      size_t interactiveWorkers = 0)
+      : shared(std::move(shared)), interactiveWorkers(interactiveWorkers) {}
+
+  // Runs one session on the connected socket `fd` until the client exits
+  // or disconnects. Closes `fd` afterwards.
+  void serve(int fd);
+  // Accepts connections on `listenFd` and serves each one on its own
+  // thread. Only returns if accepting fails.
+  void run(int listenFd);
+
+private:
+  std::shared_ptr<SharedState> shared;
+  size_t interactiveWorkers;
+};
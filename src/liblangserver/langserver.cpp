@@ -2,28 +2,33 @@
 
 #include "formatting.hpp"
 #include "langserverutils.hpp"
-#include "libpkgconf/iter.h"
 #include "log.hpp"
 #include "lsptypes.hpp"
 #include "polyfill.hpp"
 #include "utils.hpp"
 #include "workspace.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cerrno>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <exception>
 #include <filesystem>
 #include <format>
 #include <fstream>
 #include <functional>
 #include <future>
-#include <libpkgconf/libpkgconf.h>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <ostream>
 #include <string>
+#include <thread>
+#include <utility>
 #ifdef HAS_INOTIFY
 #include <poll.h>
 #include <sys/inotify.h>
@@ -122,106 +127,45 @@ std::filesystem::path writeMuonConfigFile(FormattingOptions options) {
   return fullPath;
 }
 
-extern "C" {
-static bool pkgconfLogHandler(const char *msg, const pkgconf_client_t *client,
-                              const void *data) {
-  (void)client;
-  (void)data;
-  (void)msg;
-  return true;
-}
-}
-
-void LanguageServer::initPkgNames() {
-  this->pkgNames.clear();
-  auto soutOpt = captureProcessOutput("pkg-config", {"--list-all"});
-  if (soutOpt.has_value()) {
-    const auto &sout = soutOpt.value();
-    std::string pkgName;
-    std::string pkgDescription;
-    auto state = 0;
-    for (const auto chr : sout) {
-      if (chr == '\n') {
-        this->descriptions[pkgName] = pkgDescription;
-        pkgNames.insert(pkgName);
-        pkgName = "";
-        pkgDescription = "";
-        state = 0;
-        continue;
-      }
-      if (state == 0) {
-        if (chr == ' ') {
-          state = 1;
-        } else {
-          pkgName.push_back(chr);
-        }
-        continue;
-      }
-      if (state == 1) {
-        if (chr != ' ') {
-          pkgDescription.push_back(chr);
-          state = 2;
-        }
-        continue;
-      }
-      if (state == 2 && chr != '\r') {
-        pkgDescription.push_back(chr);
-      }
-    }
-    LOG.info(std::format("Found {} packages",
-                         this->pkgNames.size()));
-    return;
-  }
-  auto *personality = pkgconf_cross_personality_default();
-  pkgconf_list_t dirList = PKGCONF_LIST_INITIALIZER;
-  pkgconf_path_copy_list(&personality->dir_list, &dirList);
-  pkgconf_path_free(&dirList);
-  pkgconf_client_t pkgClient;
-  memset(&pkgClient, 0, sizeof(pkgClient));
-  pkgconf_client_set_trace_handler(&pkgClient, nullptr, nullptr);
-  pkgconf_client_set_sysroot_dir(&pkgClient, nullptr);
-  pkgconf_client_init(&pkgClient,
-                      (pkgconf_error_handler_func_t)pkgconfLogHandler, nullptr,
-                      personality);
-  pkgconf_client_set_trace_handler(
-      &pkgClient, (pkgconf_error_handler_func_t)pkgconfLogHandler, nullptr);
-  pkgconf_client_set_flags(&pkgClient, PKGCONF_PKG_PKGF_NONE);
-  pkgconf_client_dir_list_build(&pkgClient, personality);
-  for (const auto &path : this->options.pkgConfigDirectories) {
-    // LEAK: It's better to leak memory than have e.g. double frees
-    pkgconf_path_add(strdup(path.c_str()), &pkgClient.dir_list, false);
-  }
-  pkgconf_scan_all(
-      &pkgClient, this, [](const pkgconf_pkg_t *entry, auto *data) {
-        if ((entry->flags & PKGCONF_PKG_PROPF_UNINSTALLED) != 0U) {
-          return false;
-        }
-        std::string const pkgName{entry->id};
-
-        ((LanguageServer *)data)->pkgNames.insert(pkgName);
-        if (entry->description) {
-          std::string const pkgDescription{entry->description};
-          ((LanguageServer *)data)->descriptions[pkgName] = pkgDescription;
-        }
-        return false;
-      });
-  pkgconf_cross_personality_deinit(personality);
-  pkgconf_client_deinit(&pkgClient);
-  LOG.info(std::format("Found {} packages",
-                         this->pkgNames.size()));
-}
-
 void LanguageServer::onDidChangeConfiguration(
     DidChangeConfigurationParams &params) {
+  const auto before = this->options;
   this->options.update(params.settings);
-  this->initPkgNames();
+  if (before.pkgConfigDirectories != this->options.pkgConfigDirectories) {
+    this->packages =
+        this->shared->packages(this->options.pkgConfigDirectories, true);
+  }
+  // Results computed with the old options must not be reused
+  this->nextGeneration();
+  const auto impact = LanguageServerOptions::impact(before, this->options);
+  LOG.info(std::format("Configuration changed, impact: {}", (int)impact));
+  if (impact == OptionsImpact::PRESENTATION) {
+    return;
+  }
   for (const auto &workspace : this->workspaces) {
-    const auto &oldDiags = workspace->clearDiagnostics();
     workspace->options = this->options;
-    this->publishDiagnostics(oldDiags);
-    const auto &diags = workspace->parse(this->ns);
-    this->publishDiagnostics(diags);
   }
+  if (impact == OptionsImpact::RECOLLECT) {
+    // The diagnostics of the current snapshots only have to be filtered anew
+    for (const auto &workspace : this->workspaces) {
+      auto diags = workspace->clearDiagnostics();
+      for (auto &[path, fileDiags] : workspace->diagnostics()) {
+        diags[path] = std::move(fileDiags);
+      }
+      this->publishDiagnostics(diags);
+    }
+    return;
+  }
+  this->forEachWorkspace([this, impact](
+                             const std::shared_ptr<Workspace> &workspace) {
+    auto diags = workspace->clearDiagnostics();
+    for (auto &[path, fileDiags] : impact == OptionsImpact::LINTS
+                                       ? workspace->reanalyze()
+                                       : workspace->parse(this->shared->ns)) {
+      diags[path] = std::move(fileDiags);
+    }
+    this->publishDiagnostics(diags);
+  });
 }
 
 InitializeResult LanguageServer::initialize(InitializeParams &params) {
@@ -229,38 +173,52 @@ InitializeResult LanguageServer::initialize(InitializeParams &params) {
   log_set_lvl(log_info);
 
   this->options.update(params.initializationOptions);
-  this->initPkgNames();
+  this->packages = this->shared->packages(this->options.pkgConfigDirectories);
 
   for (const auto &wspf : params.workspaceFolders) {
     auto workspace = std::make_shared<Workspace>(wspf, this->options);
-    const auto &diags = workspace->parse(this->ns);
-    this->diagnosticsFromInitialisation.emplace_back(diags);
+    workspace->parseCache = this->shared->parseCache;
     this->workspaces.push_back(workspace);
-  }
+    workspace->onPublish = [this]() { this->reindex(); };
+  }
+  this->pullDiagnostics = params.capabilities.pullDiagnostics;
+  this->diagnosticRefresh = params.capabilities.diagnosticRefresh;
+  if (params.capabilities.workDoneProgress) {
+    this->initialProgress = std::make_shared<WorkDoneProgress>(
+        "mesonlsp/initialize", "Analyzing workspaces");
+  }
+  // Parsing may take seconds for large projects with many subprojects, so
+  // it must not block the client. Not on a worker, as it would take one for
+  // as long as it runs.
+  this->initialAnalysis =
+      std::async(std::launch::async, [this]() { this->analyzeWorkspaces(); });
 #ifdef HAS_INOTIFY
   this->setupInotify();
 #endif
-  return InitializeResult{
-      ServerCapabilities(
-          TextDocumentSyncOptions(true, TextDocumentSyncKind::FULL), true, true,
-          true, true, true, true, true, true, true, true,
-          CompletionOptions(false, {".", "_", ")"}),
-          SemanticTokensOptions(
-              true, SemanticTokensLegend({"substitute", "substitute_bounds",
-                                          "variable", "function", "method",
-                                          "keyword", "string", "number"},
-                                         {"readonly", "defaultLibrary"})),
-          WorkspaceCapabilities()),
-      ServerInfo("c++-mesonlsp", VERSION)};
+  auto capabilities = ServerCapabilities(
+      TextDocumentSyncOptions(true, TextDocumentSyncKind::INCREMENTAL), true,
+      true, true, true, true, true, true, true, true, true,
+      CompletionOptions(false, {".", "_", ")"}),
+      SemanticTokensOptions(
+          true, SemanticTokensLegend({"substitute", "substitute_bounds",
+                                      "variable", "function", "method",
+                                      "keyword", "string", "number"},
+                                     {"readonly", "defaultLibrary"})),
+      WorkspaceCapabilities());
+  if (this->pullDiagnostics) {
+    // A file may get diagnostics because of changes in another one, e.g. a
+    // variable in a subdir
+    capabilities.diagnosticProvider = DiagnosticOptions(true, true);
+  }
+  return InitializeResult{capabilities, ServerInfo("c++-mesonlsp", VERSION)};
 }
 
 #ifdef HAS_INOTIFY
 void LanguageServer::setupInotify() {
-  this->smph.acquire();
+  std::scoped_lock const lock(this->reparseMtx);
   this->inotifyFd = inotify_init1(IN_NONBLOCK);
   if (this->inotifyFd == -1) {
     LOG.error(std::format("Failed inotify_init1: {}", errno2string()));
-    this->smph.release();
     return;
   }
   std::map<std::filesystem::path, int> fds;
@@ -282,7 +240,6 @@ void LanguageServer::setupInotify() {
   }
   this->inotifyFuture =
       std::async(std::launch::async, &LanguageServer::watch, this, fds);
-  this->smph.release();
 }
 
 void LanguageServer::watch(
@@ -343,7 +300,9 @@ void LanguageServer::watch(
                                path.generic_string(), name));
           const std::string asString = name;
           if (asString.ends_with(".wrap")) {
-            this->fullReparse(path);
+            // Must not hold up the requests of the user
+            this->server->schedule(jsonrpc::Lane::BACKGROUND,
+                                   [this, path]() { this->fullReparse(path); });
           }
         }
       }
@@ -355,18 +314,34 @@ void LanguageServer::watch(
 #endif
 
 void LanguageServer::fullReparse(const std::filesystem::path &path) {
-  this->smph.acquire();
+  std::scoped_lock const lock(this->reparseMtx);
   for (const auto &workspace : this->workspaces) {
     if (path != workspace->root) {
       continue;
     }
-    const auto oldDiags = workspace->clearDiagnostics();
-    const auto &diags = workspace->fullReparse(this->ns);
-    this->publishDiagnostics(oldDiags);
+    auto diags = workspace->clearDiagnostics();
+    for (auto &[diagPath, fileDiags] :
+         workspace->fullReparse(this->shared->ns)) {
+      diags[diagPath] = std::move(fileDiags);
+    }
     this->publishDiagnostics(diags);
     break;
   }
-  this->smph.release();
+}
+
+std::vector<PublishDiagnosticsParams>
+LanguageServer::projectDiagnostics(const std::string &rootUri) {
+  const auto &root = extractPathFromUrl(rootUri);
+  // A workspace of its own, so the result doesn't depend on what the
+  // client changed without saving.
+  Workspace workspace(WorkspaceFolder(rootUri, root.filename().string()),
+                      this->options);
+  workspace.parseCache = this->shared->parseCache;
+  std::vector<PublishDiagnosticsParams> ret;
+  for (const auto &[path, diags] : workspace.parse(this->shared->ns)) {
+    ret.emplace_back(pathToUrl(path), diags);
+  }
+  return ret;
 }
 
 void LanguageServer::shutdown() {
@@ -376,10 +351,107 @@ void LanguageServer::shutdown() {
 }
 
 void LanguageServer::onInitialized(InitializedParams & /*params*/) {
-  for (const auto &map : this->diagnosticsFromInitialisation) {
-    this->publishDiagnostics(map);
+  {
+    std::scoped_lock const lock(this->initializedMtx);
+    this->initialized = true;
+  }
+  this->initializedChanged.notify_all();
+  if (this->initialProgress) {
+    this->initialProgress->start(this->server);
+  }
+}
+
+bool LanguageServer::waitUntilInitialized() {
+  std::unique_lock lock(this->initializedMtx);
+  this->initializedChanged.wait(
+      lock, [this]() { return this->initialized || this->stopping; });
+  return this->initialized;
+}
+
+void LanguageServer::analyzeWorkspaces() {
+  const auto total = this->workspaces.size();
+  // Everything the callbacks use is captured by value, so they stay valid,
+  // even if a tree holds on to them.
+  const auto finished = std::make_shared<std::atomic<size_t>>(0);
+  const auto report = [this, finished, total](std::string message) {
+    if (this->initialProgress) {
+      this->initialProgress->report(std::move(message),
+                                    (uint32_t)(*finished * 100 / total));
+    }
+  };
+  this->forEachWorkspace([this, finished, report](
+                             const std::shared_ptr<Workspace> &workspace) {
+    report(workspace->name);
+    workspace->onSubproject = [report, workspaceName = workspace->name](
+                                  const std::string &name) {
+      report(std::format("{}: Subproject {}", workspaceName, name));
+    };
+    const auto &diags = workspace->parse(this->shared->ns);
+    workspace->onSubproject = nullptr;
+    (*finished)++;
+    report(std::format("Analyzed {}", workspace->name));
+    if (this->waitUntilInitialized()) {
+      this->publishDiagnostics(diags);
+    }
+  });
+  if (this->initialProgress) {
+    this->initialProgress->end(std::format("Analyzed {} workspace(s)", total));
+  }
+}
+
+void LanguageServer::forEachWorkspace(
+    const std::function<void(const std::shared_ptr<Workspace> &)> &func) {
+  const auto numThreads =
+      std::min(this->workspaces.size(),
+               (size_t)std::max(std::thread::hardware_concurrency(), 1U));
+  std::mutex claimedMtx;
+  std::vector<bool> claimed(this->workspaces.size(), false);
+  // Workspaces with documents open in the editor first, as the user is
+  // waiting for these. Checked anew every time, as documents may be opened
+  // while the others are analyzed.
+  const auto claimNext = [this, &claimedMtx,
+                          &claimed]() -> std::shared_ptr<Workspace> {
+    const auto &open = this->openDocuments();
+    std::scoped_lock const lock(claimedMtx);
+    std::optional<size_t> ret;
+    for (size_t i = 0; i < this->workspaces.size(); i++) {
+      if (claimed[i]) {
+        continue;
+      }
+      const auto &root = this->workspaces[i]->root;
+      if (std::ranges::any_of(open, [&root](const auto &path) {
+            return isWithin(path, root);
+          })) {
+        ret = i;
+        break;
+      }
+      if (!ret.has_value()) {
+        ret = i;
+      }
+    }
+    if (!ret.has_value()) {
+      return nullptr;
+    }
+    claimed[*ret] = true;
+    return this->workspaces[*ret];
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads);
+  for (size_t i = 0; i < numThreads; i++) {
+    threads.emplace_back([&func, &claimNext]() {
+      for (auto workspace = claimNext(); workspace; workspace = claimNext()) {
+        try {
+          func(workspace);
+        } catch (const std::exception &exc) {
+          LOG.error(std::format("Failed to analyze {}: {}", workspace->name,
+                                exc.what()));
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
   }
-  this->diagnosticsFromInitialisation.clear();
 }
 
 void LanguageServer::onExit() {
@@ -392,29 +464,216 @@ void LanguageServer::onExit() {
 #endif
 }
 
-void LanguageServer::onDidOpenTextDocument(
-    DidOpenTextDocumentParams & /*params*/) {}
+void LanguageServer::reindex() {
+  // Serialized, so an index built from older snapshots never replaces a
+  // newer one.
+  std::scoped_lock const lock(this->ownersMtx);
+  auto next = std::make_shared<OwnerIndex>();
+  for (const auto &workspace : this->workspaces) {
+    for (const auto &[key, _] : workspace->snapshot()->owners) {
+      next->emplace(key, workspace);
+    }
+  }
+  this->owners.store(std::move(next));
+  this->nextGeneration();
+}
+
+void LanguageServer::nextGeneration() {
+  const auto generation = ++this->generation;
+  this->semanticTokenResults.advance(generation);
+  this->documentSymbolResults.advance(generation);
+  this->foldingRangeResults.advance(generation);
+  this->inlayHintResults.advance(generation);
+}
+
+std::shared_ptr<Workspace>
+LanguageServer::findWorkspace(const std::filesystem::path &path) {
+  const auto index = this->owners.load();
+  const auto &iter = index->find(fileKey(path));
+  return iter == index->end() ? nullptr : iter->second;
+}
+
+void LanguageServer::handleRequest(std::string method, nlohmann::json callId,
+                                   nlohmann::json params,
+                                   std::shared_ptr<CancellationToken> token) {
+  std::optional<std::filesystem::path> path;
+  if (params.contains("textDocument") &&
+      params["textDocument"].contains("uri") &&
+      params["textDocument"]["uri"].is_string()) {
+    const auto &uri = params["textDocument"]["uri"].get<std::string>();
+    if (uri.starts_with("file")) {
+      path = extractPathFromUrl(uri);
+    }
+  }
+  for (const auto &workspace : this->workspaces) {
+    if (!path.has_value() || !isWithin(*path, workspace->root)) {
+      continue;
+    }
+    const auto lane = this->lane(method, params);
+    // Scheduled again, as the parsing thread must not answer it. A request
+    // stays pending until it is answered, so it can still be cancelled
+    // while it is parked.
+    auto resume = [this, lane, method, callId, params, token]() {
+      this->server->schedule(lane, [this, method, callId, params, token]() {
+        if (token->isCancelled()) {
+          this->server->returnError(callId,
+                                    jsonrpc::JsonrpcError::REQUEST_CANCELLED,
+                                    "Request was cancelled");
+          return;
+        }
+        // Another workspace containing the file may still be parsing
+        this->handleRequest(method, callId, params, token);
+      });
+    };
+    if (workspace->afterParsed(std::move(resume))) {
+      LOG.info(std::format("Parked {} until {} is analyzed", method,
+                           workspace->name));
+      return;
+    }
+  }
+  AbstractLanguageServer::handleRequest(std::move(method), std::move(callId),
+                                        std::move(params), std::move(token));
+}
+
+void LanguageServer::setVersion(const std::filesystem::path &path,
+                                int64_t version) {
+  std::scoped_lock const lock(this->versionsMtx);
+  this->versions[path] = version;
+}
+
+bool LanguageServer::isNewerVersion(const std::filesystem::path &path,
+                                    int64_t version) {
+  std::scoped_lock const lock(this->versionsMtx);
+  const auto &iter = this->versions.find(path);
+  return iter != this->versions.end() && version > iter->second;
+}
+
+std::vector<std::filesystem::path> LanguageServer::openDocuments() {
+  std::scoped_lock const lock(this->versionsMtx);
+  std::vector<std::filesystem::path> ret;
+  ret.reserve(this->versions.size());
+  for (const auto &[path, _] : this->versions) {
+    ret.push_back(path);
+  }
+  return ret;
+}
+
+std::string LanguageServer::requestKey(const std::filesystem::path &path) {
+  std::scoped_lock const lock(this->versionsMtx);
+  const auto &iter = this->versions.find(path);
+  const auto version = iter == this->versions.end() ? -1 : iter->second;
+  return std::format("{}@{}#{}", path.generic_string(), version,
+                     this->generation.load());
+}
+
+void LanguageServer::onDidOpenTextDocument(DidOpenTextDocumentParams &params) {
+  const auto &path = extractPathFromUrl(params.textDocument.uri);
+  this->setVersion(path, params.textDocument.version);
+  {
+    std::scoped_lock const lock(this->contentsMtx);
+    this->cachedContents.insert_or_assign(
+        path, PieceTable(std::move(params.textDocument.text)));
+  }
+  this->server->schedule(jsonrpc::Lane::BACKGROUND,
+                         [this, path]() { this->precompute(path); });
+}
+
+void LanguageServer::precompute(const std::filesystem::path &path) {
+  try {
+    // Taken before the results are computed, so they never end up under a
+    // key newer than the snapshot they were computed from.
+    const auto generation = this->generation.load();
+    const auto &key = this->requestKey(path);
+    const auto &document = path.generic_string();
+    const auto workspace = this->findWorkspace(path);
+    if (!workspace) {
+      return;
+    }
+    // Run through the InFlight ones, so requests arriving meanwhile join
+    // instead of computing the same again.
+    this->semanticTokenResults.put(
+        document, key, generation,
+        this->semanticTokenRequests.run(
+            key, [&]() { return workspace->semanticTokens(path); }));
+    this->documentSymbolResults.put(
+        document, key, generation,
+        this->documentSymbolRequests.run(
+            key, [&]() { return workspace->documentSymbols(path); }));
+    this->foldingRangeResults.put(
+        document, key, generation,
+        this->foldingRangeRequests.run(
+            key, [&]() { return workspace->foldingRanges(path); }));
+    if (!this->options.disableInlayHints) {
+      this->inlayHintResults.put(
+          document, key, generation,
+          this->inlayHintRequests.run(
+              key, [&]() { return workspace->inlayHints(path); }));
+    }
+  } catch (const std::exception &exc) {
+    LOG.error(std::format("Failed to precompute results for {}: {}",
+                          path.generic_string(), exc.what()));
+  }
+}
 
 void LanguageServer::onDidChangeTextDocument(
     DidChangeTextDocumentParams &params) {
-  this->smph.acquire();
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  this->cachedContents[path] = params.contentChanges[0].text;
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      LOG.info(std::format("Patching file {} for workspace {}",
-                           path.generic_string(), workspace->name));
-      workspace->patchFile<std::function<void(
-          std::map<std::filesystem::path, std::vector<LSPDiagnostic>>)>>(
-          path, params.contentChanges[0].text,
-          [this](
-              const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
-                  &changes) { this->publishDiagnostics(changes); });
-      this->smph.release();
-      return;
+  const auto version = params.textDocument.version;
+  std::optional<PieceTable> contents;
+  {
+    std::scoped_lock const lock(this->contentsMtx);
+    // Ranged changes only apply to the text of the previous version. Without
+    // it, e.g. if the document was never opened or the change is older than
+    // the text, only a change replacing the whole text gets it back in sync.
+    const auto &iter = this->cachedContents.find(path);
+    if (iter != this->cachedContents.end() &&
+        this->isNewerVersion(path, version)) {
+      contents = iter->second;
     }
+    for (auto &change : params.contentChanges) {
+      if (!change.range.has_value()) {
+        contents = PieceTable(std::move(change.text));
+        continue;
+      }
+      if (!contents.has_value()) {
+        break;
+      }
+      const auto &range = *change.range;
+      contents = contents->replace(
+          contents->offsetOf(range.start.line, range.start.character),
+          contents->offsetOf(range.end.line, range.end.character),
+          std::move(change.text));
+    }
+    if (contents.has_value()) {
+      this->cachedContents.insert_or_assign(path, *contents);
+    } else {
+      this->cachedContents.erase(path);
+    }
+  }
+  const auto workspace = this->findWorkspace(path);
+  if (!contents.has_value()) {
+    LOG.warn(std::format("Lost sync of {} at version {}, using the file on "
+                         "disk until the whole text is sent",
+                         path.generic_string(), version));
+    {
+      std::scoped_lock const lock(this->versionsMtx);
+      this->versions.erase(path);
+    }
+    if (workspace) {
+      workspace->dropCache(path);
+    }
+    return;
+  }
+  this->setVersion(path, version);
+  if (workspace) {
+    LOG.info(std::format("Queueing edit of {} for workspace {}",
+                         path.generic_string(), workspace->name));
+    workspace->edit(
+        path, *contents,
+        [this](
+            const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+                &changes) { this->publishDiagnostics(changes); });
   }
-  this->smph.release();
 }
 
 std::vector<InlayHint> LanguageServer::inlayHints(InlayHintParams &params) {
@@ -422,36 +681,48 @@ std::vector<InlayHint> LanguageServer::inlayHints(InlayHintParams &params) {
     return {};
   }
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      return workspace->inlayHints(path);
+  const auto &key = this->requestKey(path);
+  if (auto ret = this->inlayHintResults.get(path.generic_string(), key)) {
+    return std::move(ret.value());
+  }
+  return this->inlayHintRequests.run(key, [this, &path]() {
+    const auto workspace = this->findWorkspace(path);
+    if (!workspace) {
+      return std::vector<InlayHint>{};
     }
-  }
-  return {};
+    return workspace->inlayHints(path);
+  });
 }
 
 std::vector<SymbolInformation>
 LanguageServer::documentSymbols(DocumentSymbolParams &params) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      return workspace->documentSymbols(path);
+  const auto &key = this->requestKey(path);
+  if (auto ret = this->documentSymbolResults.get(path.generic_string(), key)) {
+    return std::move(ret.value());
+  }
+  return this->documentSymbolRequests.run(key, [this, &path]() {
+    const auto workspace = this->findWorkspace(path);
+    if (!workspace) {
+      return std::vector<SymbolInformation>{};
     }
-  }
-  return {};
+    return workspace->documentSymbols(path);
+  });
 }
 
 TextEdit LanguageServer::formatting(DocumentFormattingParams &params) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  const auto toFormat = this->cachedContents.contains(path)
-                            ? this->cachedContents[path]
-                            : readFile(path);
+  std::string toFormat;
+  {
+    std::scoped_lock const lock(this->contentsMtx);
+    const auto &iter = this->cachedContents.find(path);
+    toFormat = iter != this->cachedContents.end() ? iter->second.str()
+                                                  : readFile(path);
+  }
   std::filesystem::path configFile;
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      if (auto file = workspace->muonConfigFile(path)) {
-        configFile = file.value();
-      }
+  if (const auto workspace = this->findWorkspace(path)) {
+    if (auto file = workspace->muonConfigFile(path)) {
+      configFile = file.value();
     }
   }
   if (configFile.empty() && this->options.defaultFormattingConfig.has_value()) {
@@ -474,128 +745,236 @@ TextEdit LanguageServer::formatting(DocumentFormattingParams &params) {
 std::vector<uint64_t>
 LanguageServer::semanticTokens(SemanticTokensParams &params) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      return workspace->semanticTokens(path);
+  const auto &key = this->requestKey(path);
+  if (auto ret = this->semanticTokenResults.get(path.generic_string(), key)) {
+    return std::move(ret.value());
+  }
+  return this->semanticTokenRequests.run(key, [this, &path]() {
+    const auto workspace = this->findWorkspace(path);
+    if (!workspace) {
+      return std::vector<uint64_t>{};
     }
-  }
-  return {};
+    return workspace->semanticTokens(path);
+  });
 }
 
 std::vector<DocumentHighlight>
 LanguageServer::highlight(DocumentHighlightParams &params) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      return workspace->highlight(path, params.position);
-    }
+  const auto workspace = this->findWorkspace(path);
+  if (!workspace) {
+    return {};
   }
-  return {};
+  return workspace->highlight(path, params.position);
 }
 
 std::optional<WorkspaceEdit> LanguageServer::rename(RenameParams &params) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      return workspace->rename(path, params);
-    }
+  const auto workspace = this->findWorkspace(path);
+  if (!workspace) {
+    return std::nullopt;
   }
-  return std::nullopt;
+  return workspace->rename(path, params);
 }
 
 std::vector<LSPLocation>
 LanguageServer::declaration(DeclarationParams &params) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      return workspace->jumpTo(path, params.position);
-    }
+  const auto workspace = this->findWorkspace(path);
+  if (!workspace) {
+    return {};
   }
-  return {};
+  return workspace->jumpTo(path, params.position);
 }
 
 std::vector<LSPLocation> LanguageServer::definition(DefinitionParams &params) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      return workspace->jumpTo(path, params.position);
-    }
+  const auto workspace = this->findWorkspace(path);
+  if (!workspace) {
+    return {};
   }
-  return {};
+  return workspace->jumpTo(path, params.position);
 }
 
 std::vector<CodeAction> LanguageServer::codeAction(CodeActionParams &params) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      return workspace->codeAction(path, params.range);
-    }
+  const auto workspace = this->findWorkspace(path);
+  if (!workspace) {
+    return {};
   }
-  return {};
+  return workspace->codeAction(path, params.range);
 }
 
 std::vector<FoldingRange>
 LanguageServer::foldingRanges(FoldingRangeParams &params) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      return workspace->foldingRanges(path);
+  const auto &key = this->requestKey(path);
+  if (auto ret = this->foldingRangeResults.get(path.generic_string(), key)) {
+    return std::move(ret.value());
+  }
+  return this->foldingRangeRequests.run(key, [this, &path]() {
+    const auto workspace = this->findWorkspace(path);
+    if (!workspace) {
+      return std::vector<FoldingRange>{};
     }
-  }
-  return {};
+    return workspace->foldingRanges(path);
+  });
 }
 
 std::optional<Hover> LanguageServer::hover(HoverParams &params) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      return workspace->hover(path, params.position, this->descriptions);
-    }
+  const auto workspace = this->findWorkspace(path);
+  if (!workspace) {
+    return std::nullopt;
   }
-  return std::nullopt;
+  return workspace->hover(path, params.position,
+                          this->packages.load()->descriptions);
 }
 
-void LanguageServer::onDidSaveTextDocument(
-    DidSaveTextDocumentParams & /*params*/) {}
+void LanguageServer::onDidSaveTextDocument(DidSaveTextDocumentParams &params) {
+  // Saving is a good sign, that the user wants to see the diagnostics now
+  const auto &path = extractPathFromUrl(params.textDocument.uri);
+  if (const auto workspace = this->findWorkspace(path)) {
+    workspace->flushEdits();
+  }
+}
 
 void LanguageServer::onDidCloseTextDocument(
     DidCloseTextDocumentParams &params) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  if (this->cachedContents.contains(path)) {
-    const auto &iter = this->cachedContents.find(path);
-    this->cachedContents.erase(iter);
-  }
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      workspace->dropCache(path);
-      return;
-    }
+  {
+    std::scoped_lock const lock(this->versionsMtx);
+    this->versions.erase(path);
+  }
+  const auto &document = path.generic_string();
+  this->semanticTokenResults.erase(document);
+  this->documentSymbolResults.erase(document);
+  this->foldingRangeResults.erase(document);
+  this->inlayHintResults.erase(document);
+  {
+    std::scoped_lock const lock(this->contentsMtx);
+    this->cachedContents.erase(path);
+  }
+  if (const auto workspace = this->findWorkspace(path)) {
+    workspace->dropCache(path);
   }
 }
 
 std::vector<CompletionItem>
-LanguageServer::completion(CompletionParams &params) {
+LanguageServer::completion(CompletionParams &params,
+                           const CancellationToken &token) {
   const auto &path = extractPathFromUrl(params.textDocument.uri);
-  for (const auto &workspace : this->workspaces) {
-    if (workspace->owns(path)) {
-      return workspace->completion(path, params.position, this->pkgNames);
-    }
+  const auto workspace = this->findWorkspace(path);
+  if (!workspace) {
+    return {};
   }
-  return {};
+  return workspace->completion(path, params.position,
+                               this->packages.load()->names, &token);
 }
 
 void LanguageServer::publishDiagnostics(
     const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
         &newDiags) {
-  for (const auto &[filePath, diags] : newDiags) {
-    const auto &asURI = pathToUrl(filePath);
-    const auto &clearingParams = PublishDiagnosticsParams(asURI, {});
-    this->server->notification("textDocument/publishDiagnostics",
-                               clearingParams.toJson());
-    const auto &newParams = PublishDiagnosticsParams(asURI, diags);
+  // Only files whose diagnostics changed since they were published last
+  std::scoped_lock const lock(this->publishMtx);
+  auto changed = this->publishedDiagnostics.changed(newDiags);
+  if (this->pullDiagnostics) {
+    // The client asks for them itself, at most it has to be told to do so
+    // again.
+    if (!changed.empty() && this->diagnosticRefresh) {
+      this->server->request("workspace/diagnostic/refresh", nullptr);
+    }
+    return;
+  }
+  // Documents open in the editor first, the client shows these right away
+  std::set<std::string> open;
+  for (const auto &path : this->openDocuments()) {
+    open.insert(pathToUrl(path));
+  }
+  std::ranges::stable_partition(changed, [&open](const auto &params) {
+    return open.contains(params.uri);
+  });
+  for (const auto &params : changed) {
+    // Only the latest publish for a file matters, so if the client is
+    // still busy with older ones, the outdated ones are never written.
     this->server->notification("textDocument/publishDiagnostics",
-                               newParams.toJson());
-    LOG.info(std::format("Publishing {} diagnostics for {}", diags.size(),
-                         filePath.generic_string()));
+                               params.toJson(), params.uri);
+    LOG.info(std::format("Publishing {} diagnostics for {}",
+                         params.diagnostics.size(), params.uri));
+  }
+}
+
+DocumentDiagnosticReport LanguageServer::diagnosticReport(
+    const std::string &uri, const std::vector<LSPDiagnostic> &diags,
+    const std::optional<std::string> &previousResultId, uint64_t generation) {
+  const auto hash = std::hash<std::string>{}(
+      PublishDiagnosticsParams(uri, diags).toJson().dump());
+  std::scoped_lock const lock(this->pulledMtx);
+  auto &entry = this->pulled[uri];
+  if (entry.resultId.empty() || entry.hash != hash) {
+    entry.hash = hash;
+    entry.resultId = std::format("{}-{:x}", generation, hash);
+  }
+  entry.generation = std::max(entry.generation, generation);
+  if (previousResultId == entry.resultId) {
+    return DocumentDiagnosticReport(entry.resultId);
+  }
+  return {entry.resultId, diags};
+}
+
+DocumentDiagnosticReport
+LanguageServer::diagnostic(DocumentDiagnosticParams &params) {
+  const auto &uri = params.textDocument.uri;
+  const auto generation = this->generation.load();
+  {
+    // Nothing was analyzed since the client got its result
+    std::scoped_lock const lock(this->pulledMtx);
+    const auto &iter = this->pulled.find(uri);
+    if (iter != this->pulled.end() && iter->second.generation == generation &&
+        params.previousResultId == iter->second.resultId) {
+      return DocumentDiagnosticReport(iter->second.resultId);
+    }
+  }
+  const auto &path = extractPathFromUrl(uri);
+  std::vector<LSPDiagnostic> diags;
+  if (const auto workspace = this->findWorkspace(path)) {
+    diags = workspace->diagnostics(path);
+  }
+  return this->diagnosticReport(uri, diags, params.previousResultId,
+                                generation);
+}
+
+WorkspaceDiagnosticReport
+LanguageServer::workspaceDiagnostic(WorkspaceDiagnosticParams &params) {
+  const auto generation = this->generation.load();
+  const auto previousResultId =
+      [&params](const std::string &uri) -> std::optional<std::string> {
+    const auto &iter = params.previousResultIds.find(uri);
+    if (iter == params.previousResultIds.end()) {
+      return std::nullopt;
+    }
+    return iter->second;
+  };
+  WorkspaceDiagnosticReport ret;
+  std::set<std::string> reported;
+  for (const auto &workspace : this->workspaces) {
+    for (const auto &[path, diags] : workspace->diagnostics()) {
+      auto uri = pathToUrl(path);
+      if (!reported.insert(uri).second) {
+        continue;
+      }
+      ret.items.emplace_back(uri, this->diagnosticReport(
+                                      uri, diags, previousResultId(uri),
+                                      generation));
+    }
+  }
+  // Files that lost all of their diagnostics
+  for (const auto &[uri, _] : params.previousResultIds) {
+    if (!reported.contains(uri)) {
+      ret.items.emplace_back(
+          uri, this->diagnosticReport(uri, {}, previousResultId(uri),
+                                      generation));
+    }
   }
+  return ret;
 }
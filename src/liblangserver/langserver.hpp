@@ -1,22 +1,34 @@
 #pragma once
 
+#include "cancellation.hpp"
+#include "inflight.hpp"
 #include "langserveroptions.hpp"
 #include "ls.hpp"
 #include "lsptypes.hpp"
-#include "typenamespace.hpp"
+#include "piecetable.hpp"
+#include "precomputed.hpp"
+#include "progress.hpp"
+#include "publisheddiagnostics.hpp"
+#include "sharedstate.hpp"
 #include "workspace.hpp"
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
 #include <ctime>
 #include <filesystem>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
-#include <semaphore>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 extern "C" {
 #include "arena.h"
@@ -31,9 +43,10 @@ void printGreeting();
 
 class LanguageServer : public AbstractLanguageServer {
 public:
-  LanguageServer() {
+  explicit LanguageServer(
+      std::shared_ptr<SharedState> shared = std::make_shared<SharedState>())
+      : shared(std::move(shared)) {
     srand(time(nullptr));
-    this->initPkgNames();
     printGreeting();
     struct ar_params arena_params = {.source_file = __FILE__,
                                      .source_line = __LINE__};
@@ -44,16 +57,21 @@ public:
     path_init(&wk);
   }
 
-  void initPkgNames();
   std::vector<std::shared_ptr<Workspace>> workspaces;
 #ifdef HAS_INOTIFY
   std::atomic<int> inotifyFd{-1};
   std::future<void> inotifyFuture;
 #endif
-  std::map<std::filesystem::path, std::string> cachedContents;
-  std::vector<std::map<std::filesystem::path, std::vector<LSPDiagnostic>>>
-      diagnosticsFromInitialisation;
+  // The documents open in the editor, as the client synchronizes them
+  // incrementally.
+  std::mutex contentsMtx;
+  std::map<std::filesystem::path, PieceTable> cachedContents;
 
+  // Requests for a file below a workspace, whose first analysis didn't
+  // finish yet, are parked until it did, instead of blocking a worker.
+  void handleRequest(std::string method, nlohmann::json callId,
+                     nlohmann::json params,
+                     std::shared_ptr<CancellationToken> token) override;
   InitializeResult initialize(InitializeParams &params) override;
   std::vector<InlayHint> inlayHints(InlayHintParams &params) override;
   std::vector<FoldingRange> foldingRanges(FoldingRangeParams &params) override;
@@ -68,8 +86,15 @@ public:
   std::vector<LSPLocation> declaration(DeclarationParams &params) override;
   std::vector<LSPLocation> definition(DefinitionParams &params) override;
   std::vector<CodeAction> codeAction(CodeActionParams &params) override;
-  std::vector<CompletionItem> completion(CompletionParams &params) override;
+  std::vector<CompletionItem>
+  completion(CompletionParams &params, const CancellationToken &token) override;
+  DocumentDiagnosticReport
+  diagnostic(DocumentDiagnosticParams &params) override;
+  WorkspaceDiagnosticReport
+  workspaceDiagnostic(WorkspaceDiagnosticParams &params) override;
   void shutdown() override;
+  std::vector<PublishDiagnosticsParams>
+  projectDiagnostics(const std::string &rootUri) override;
   void watch(std::map<std::filesystem::path, int> fds);
 
   void onInitialized(InitializedParams & /*params*/) override;
@@ -85,6 +110,14 @@ public:
                                          std::vector<LSPDiagnostic>> &newDiags);
 
   ~LanguageServer() override {
+    {
+      std::scoped_lock const lock(this->initializedMtx);
+      this->stopping = true;
+    }
+    this->initializedChanged.notify_all();
+    if (this->initialAnalysis.valid()) {
+      this->initialAnalysis.wait();
+    }
 #ifdef HAS_INOTIFY
     if (this->inotifyFd != -1) {
       this->inotifyFd = -1;
@@ -99,12 +132,102 @@ public:
 #endif
 
 private:
-  TypeNamespace ns;
-  std::set<std::string> pkgNames;
-  std::map<std::string, std::string> descriptions;
+  std::shared_ptr<SharedState> shared;
+  // Replaced as a whole on initialize and didChangeConfiguration, while
+  // requests may still read the old ones.
+  std::atomic<std::shared_ptr<const PkgConfigPackages>> packages =
+      std::make_shared<const PkgConfigPackages>();
   LanguageServerOptions options;
-  std::binary_semaphore smph{1};
+  // Serializes full reparses, and the setup of the watches triggering them
+  std::mutex reparseMtx;
+  // Editors tend to ask for all of these at once, e.g. after every change,
+  // and again when switching tabs, so identical requests often overlap.
+  InFlight<std::vector<InlayHint>> inlayHintRequests{"textDocument/inlayHint"};
+  InFlight<std::vector<FoldingRange>> foldingRangeRequests{
+      "textDocument/foldingRange"};
+  InFlight<std::vector<uint64_t>> semanticTokenRequests{
+      "textDocument/semanticTokens/full"};
+  InFlight<std::vector<SymbolInformation>> documentSymbolRequests{
+      "textDocument/documentSymbol"};
+  // The same four are computed right after didOpen, see precompute.
+  Precomputed<std::vector<InlayHint>> inlayHintResults{
+      "textDocument/inlayHint"};
+  Precomputed<std::vector<FoldingRange>> foldingRangeResults{
+      "textDocument/foldingRange"};
+  Precomputed<std::vector<uint64_t>> semanticTokenResults{
+      "textDocument/semanticTokens/full"};
+  Precomputed<std::vector<SymbolInformation>> documentSymbolResults{
+      "textDocument/documentSymbol"};
+  // Bumped whenever a workspace published a new snapshot
+  std::atomic<uint64_t> generation = 0;
+  std::mutex versionsMtx;
+  std::map<std::filesystem::path, int64_t> versions;
+  std::mutex publishMtx;
+  PublishedDiagnostics publishedDiagnostics;
+  // Set if the client pulls diagnostics, nothing is pushed then.
+  bool pullDiagnostics = false;
+  bool diagnosticRefresh = false;
+  // The latest result id of each file the client pulled diagnostics for,
+  // and the generation it was last checked in.
+  struct PulledDiagnostics {
+    uint64_t generation = 0;
+    size_t hash = 0;
+    std::string resultId;
+  };
+  std::mutex pulledMtx;
+  std::unordered_map<std::string, PulledDiagnostics> pulled;
+  // Every file (see fileKey) to the first workspace owning it. Rebuilt
+  // whenever a workspace published a new snapshot.
+  using OwnerIndex =
+      std::unordered_map<std::string, std::shared_ptr<Workspace>>;
+  std::mutex ownersMtx;
+  std::atomic<std::shared_ptr<const OwnerIndex>> owners =
+      std::make_shared<const OwnerIndex>();
+  // initialize answers right away, the workspaces are parsed by this
+  // afterwards. Nothing is sent to the client before it is initialized.
+  std::future<void> initialAnalysis;
+  std::shared_ptr<WorkDoneProgress> initialProgress;
+  std::mutex initializedMtx;
+  std::condition_variable initializedChanged;
+  bool initialized = false;
+  bool stopping = false;
   struct arena arena;
   struct arena a_scratch;
   struct workspace wk;
+
+  void setVersion(const std::filesystem::path &path, int64_t version);
+  // Whether `version` is newer than the one the open document has. Clients
+  // may skip versions, e.g. Neovim does, so it need not follow it directly.
+  bool isNewerVersion(const std::filesystem::path &path, int64_t version);
+  // The documents currently open in the editor
+  std::vector<std::filesystem::path> openDocuments();
+  void analyzeWorkspaces();
+  // Workspaces share nothing but the TypeNamespace, which is only read, so
+  // they are analyzed in parallel, on at most one thread per core.
+  // Exceptions thrown by `func` are logged.
+  void forEachWorkspace(
+      const std::function<void(const std::shared_ptr<Workspace> &)> &func);
+  // Returns false, if the server is destroyed before the client sent
+  // `initialized`.
+  bool waitUntilInitialized();
+  void reindex();
+  // Also drops the precomputed results of the previous generations.
+  void nextGeneration();
+  // Until the initial analysis of a workspace finished, it owns no files.
+  // Requests are parked until then, see handleRequest.
+  std::shared_ptr<Workspace> findWorkspace(const std::filesystem::path &path);
+  // Computes what editors ask for right after opening a file in the
+  // background, while they are still busy opening it.
+  void precompute(const std::filesystem::path &path);
+  // Identifies the document in the version it currently has, files that
+  // are not open in the editor have no version. Includes the generation,
+  // as the results for a file also depend on the other files.
+  std::string requestKey(const std::filesystem::path &path);
+  // The report for the diagnostics of `uri` as of `generation`. Unchanged,
+  // if the client has them already.
+  DocumentDiagnosticReport
+  diagnosticReport(const std::string &uri,
+                   const std::vector<LSPDiagnostic> &diags,
+                   const std::optional<std::string> &previousResultId,
+                   uint64_t generation);
 };
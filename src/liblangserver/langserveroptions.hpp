@@ -3,11 +3,27 @@
 #include "analysisoptions.hpp"
 #include "nlohmann/json.hpp"
 
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <optional>
 #include <string>
 #include <vector>
 
+constexpr auto DEFAULT_EDIT_DEBOUNCE = std::chrono::milliseconds(100);
+
+// What has to be redone after the options changed, ordered by cost.
+enum class OptionsImpact {
+  // Only read when answering requests, e.g. inlay hints or formatting
+  PRESENTATION = 0,
+  // Only change which of the existing diagnostics are published
+  RECOLLECT = 1,
+  // Change which diagnostics the analysis emits
+  LINTS = 2,
+  // Change how the files and subprojects are parsed
+  PARSING = 3,
+};
+
 class LanguageServerOptions {
 public:
   AnalysisOptions analysisOptions;
@@ -20,6 +36,8 @@ public:
   bool removeDefaultTypesInInlayHints = false;
   bool useCustomParser = true;
   bool disablePosargInlayHints = false;
+  // How long the user has to stop typing, before edits are analyzed
+  std::chrono::milliseconds editDebounce = DEFAULT_EDIT_DEBOUNCE;
 
   // No need for muon path anymore
 
@@ -40,6 +58,25 @@ public:
     }
   }
 
+  // pkgConfigDirectories are not considered here, they only affect the
+  // packages offered for completion.
+  static OptionsImpact impact(const LanguageServerOptions &before,
+                              const LanguageServerOptions &after) {
+    if (before.neverDownloadAutomatically !=
+            after.neverDownloadAutomatically ||
+        before.useCustomParser != after.useCustomParser) {
+      return OptionsImpact::PARSING;
+    }
+    if (before.analysisOptions != after.analysisOptions) {
+      return OptionsImpact::LINTS;
+    }
+    if (before.ignoreDiagnosticsFromSubprojects !=
+        after.ignoreDiagnosticsFromSubprojects) {
+      return OptionsImpact::RECOLLECT;
+    }
+    return OptionsImpact::PRESENTATION;
+  }
+
 private:
   void updateLinting(const nlohmann::json &linting) {
     if (linting.contains("disableNameLinting")) {
@@ -107,6 +144,13 @@ private:
       this->disablePosargInlayHints =
           others.value("disablePosargInlayHints", false);
     }
+    if (others.contains("editDebounceMs")) {
+      const auto &debounce = others["editDebounceMs"];
+      if (debounce.is_number_unsigned()) {
+        this->editDebounce =
+            std::chrono::milliseconds(debounce.get<uint64_t>());
+      }
+    }
     if (others.contains("defaultFormattingConfig")) {
       const auto &config = others["defaultFormattingConfig"];
       if (config.is_string()) {
@@ -32,6 +32,25 @@ inline std::filesystem::path extractPathFromUrl(const std::string &urlStr) {
   return {ret};
 }
 
+// Normalized, so different spellings of a path find the same entry in an
+// index of files.
+inline std::string fileKey(const std::filesystem::path &path) {
+  return path.lexically_normal().generic_string();
+}
+
+// Whether `path` is `root` or below it. Compares whole components, so
+// /ws/foobar is not below /ws/foo.
+inline bool isWithin(const std::filesystem::path &path,
+                     const std::filesystem::path &root) {
+  const auto &key = fileKey(path);
+  auto rootKey = fileKey(root);
+  if (rootKey.ends_with('/')) {
+    rootKey.pop_back();
+  }
+  return key.starts_with(rootKey) &&
+         (key.size() == rootKey.size() || key[rootKey.size()] == '/');
+}
+
 inline std::string pathToUrl(const std::filesystem::path &path) {
   auto ret = ada::href_from_file(path.generic_string());
   return ret;
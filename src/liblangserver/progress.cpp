@@ -0,0 +1,55 @@
+#include "progress.hpp"
+
+#include "jsonrpc.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <utility>
+
+void WorkDoneProgress::start(
+    const std::shared_ptr<jsonrpc::JsonRpcServer> &server) {
+  server->request(
+      "window/workDoneProgress/create", {{"token", this->token}},
+      [self = this->shared_from_this(),
+       server](const nlohmann::json & /*result*/) {
+        std::scoped_lock const lock(self->mtx);
+        if (self->ended) {
+          // Already done, nothing worth showing anymore
+          return;
+        }
+        self->server = server;
+        self->send({{"kind", "begin"},
+                    {"title", self->title},
+                    {"message", self->message},
+                    {"percentage", self->percentage},
+                    {"cancellable", false}});
+      });
+}
+
+void WorkDoneProgress::report(std::string message, uint32_t percentage) {
+  std::scoped_lock const lock(this->mtx);
+  this->message = std::move(message);
+  this->percentage = percentage;
+  if (this->server) {
+    this->send({{"kind", "report"},
+                {"message", this->message},
+                {"percentage", this->percentage}});
+  }
+}
+
+void WorkDoneProgress::end(std::string message) {
+  std::scoped_lock const lock(this->mtx);
+  this->ended = true;
+  if (this->server) {
+    this->send({{"kind", "end"}, {"message", std::move(message)}});
+    this->server = nullptr;
+  }
+}
+
+void WorkDoneProgress::send(nlohmann::json value) {
+  this->server->notification(
+      "$/progress", {{"token", this->token}, {"value", std::move(value)}});
+}
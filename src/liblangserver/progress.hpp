@@ -0,0 +1,37 @@
+#pragma once
+
+#include "jsonrpc.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <utility>
+
+// Reports a long running operation to the client as work done progress.
+// Reports may start before the client is ready for them, until `start`
+// created the token on the client, they are only remembered, so the
+// first message it sees is always the latest state. Must be owned by a
+// shared_ptr, as the answer of the client may arrive late.
+class WorkDoneProgress : public std::enable_shared_from_this<WorkDoneProgress> {
+public:
+  WorkDoneProgress(std::string token, std::string title)
+      : token(std::move(token)), title(std::move(title)) {}
+
+  void start(const std::shared_ptr<jsonrpc::JsonRpcServer> &server);
+  void report(std::string message, uint32_t percentage);
+  void end(std::string message);
+
+private:
+  std::mutex mtx;
+  std::string token;
+  std::string title;
+  std::string message;
+  uint32_t percentage = 0;
+  bool ended = false;
+  // Set once the client created the token
+  std::shared_ptr<jsonrpc::JsonRpcServer> server;
+
+  void send(nlohmann::json value);
+};
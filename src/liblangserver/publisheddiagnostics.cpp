@@ -0,0 +1,35 @@
+#include "publisheddiagnostics.hpp"
+
+#include "langserverutils.hpp"
+#include "lsptypes.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+std::vector<PublishDiagnosticsParams> PublishedDiagnostics::changed(
+    const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+        &diags) {
+  std::vector<PublishDiagnosticsParams> ret;
+  for (const auto &[path, fileDiags] : diags) {
+    auto uri = pathToUrl(path);
+    if (fileDiags.empty()) {
+      if (this->hashes.erase(uri) != 0) {
+        ret.emplace_back(std::move(uri), fileDiags);
+      }
+      continue;
+    }
+    PublishDiagnosticsParams params(uri, fileDiags);
+    const auto hash = std::hash<std::string>{}(params.toJson().dump());
+    const auto &iter = this->hashes.find(uri);
+    if (iter != this->hashes.end() && iter->second == hash) {
+      continue;
+    }
+    this->hashes[uri] = hash;
+    ret.push_back(std::move(params));
+  }
+  return ret;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "lsptypes.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Remembers what was published for each file, so unchanged diagnostics are
+// not sent again after every analysis. Only a hash of the published
+// diagnostics is kept.
+// Not synchronized, the caller has to hold a lock until it sent what was
+// returned anyway, so the client gets them in the order they were recorded.
+class PublishedDiagnostics {
+public:
+  // Returns the files whose diagnostics differ from the ones published last,
+  // and records them as published. Files without any diagnostics are only
+  // returned, if they had some before.
+  std::vector<PublishDiagnosticsParams>
+  changed(const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+              &diags);
+
+private:
+  std::unordered_map<std::string, size_t> hashes;
+};
@@ -0,0 +1,116 @@
+#include "sharedstate.hpp"
+
+#include "libpkgconf/iter.h"
+#include "log.hpp"
+#include "polyfill.hpp"
+#include "utils.hpp"
+
+#include <cstring>
+#include <libpkgconf/libpkgconf.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+const static Logger LOG("SharedState"); // NOLINT
+
+extern "C" {
+static bool pkgconfLogHandler(const char *msg, const pkgconf_client_t *client,
+                              const void *data) {
+  (void)client;
+  (void)data;
+  (void)msg;
+  return true;
+}
+}
+
+static std::shared_ptr<const PkgConfigPackages>
+scanPackages(const std::vector<std::string> &extraDirectories) {
+  auto ret = std::make_shared<PkgConfigPackages>();
+  auto soutOpt = captureProcessOutput("pkg-config", {"--list-all"});
+  if (soutOpt.has_value()) {
+    const auto &sout = soutOpt.value();
+    std::string pkgName;
+    std::string pkgDescription;
+    auto state = 0;
+    for (const auto chr : sout) {
+      if (chr == '\n') {
+        ret->descriptions[pkgName] = pkgDescription;
+        ret->names.insert(pkgName);
+        pkgName = "";
+        pkgDescription = "";
+        state = 0;
+        continue;
+      }
+      if (state == 0) {
+        if (chr == ' ') {
+          state = 1;
+        } else {
+          pkgName.push_back(chr);
+        }
+        continue;
+      }
+      if (state == 1) {
+        if (chr != ' ') {
+          pkgDescription.push_back(chr);
+          state = 2;
+        }
+        continue;
+      }
+      if (state == 2 && chr != '\r') {
+        pkgDescription.push_back(chr);
+      }
+    }
+    LOG.info(std::format("Found {} packages", ret->names.size()));
+    return ret;
+  }
+  auto *personality = pkgconf_cross_personality_default();
+  pkgconf_list_t dirList = PKGCONF_LIST_INITIALIZER;
+  pkgconf_path_copy_list(&personality->dir_list, &dirList);
+  pkgconf_path_free(&dirList);
+  pkgconf_client_t pkgClient;
+  memset(&pkgClient, 0, sizeof(pkgClient));
+  pkgconf_client_set_trace_handler(&pkgClient, nullptr, nullptr);
+  pkgconf_client_set_sysroot_dir(&pkgClient, nullptr);
+  pkgconf_client_init(&pkgClient,
+                      (pkgconf_error_handler_func_t)pkgconfLogHandler, nullptr,
+                      personality);
+  pkgconf_client_set_trace_handler(
+      &pkgClient, (pkgconf_error_handler_func_t)pkgconfLogHandler, nullptr);
+  pkgconf_client_set_flags(&pkgClient, PKGCONF_PKG_PKGF_NONE);
+  pkgconf_client_dir_list_build(&pkgClient, personality);
+  for (const auto &path : extraDirectories) {
+    // LEAK: It's better to leak memory than have e.g. double frees
+    pkgconf_path_add(strdup(path.c_str()), &pkgClient.dir_list, false);
+  }
+  pkgconf_scan_all(
+      &pkgClient, ret.get(), [](const pkgconf_pkg_t *entry, auto *data) {
+        if ((entry->flags & PKGCONF_PKG_PROPF_UNINSTALLED) != 0U) {
+          return false;
+        }
+        std::string const pkgName{entry->id};
+
+        ((PkgConfigPackages *)data)->names.insert(pkgName);
+        if (entry->description) {
+          std::string const pkgDescription{entry->description};
+          ((PkgConfigPackages *)data)->descriptions[pkgName] = pkgDescription;
+        }
+        return false;
+      });
+  pkgconf_cross_personality_deinit(personality);
+  pkgconf_client_deinit(&pkgClient);
+  LOG.info(std::format("Found {} packages", ret->names.size()));
+  return ret;
+}
+
+std::shared_ptr<const PkgConfigPackages>
+SharedState::packages(const std::vector<std::string> &extraDirectories,
+                      bool rescan) {
+  std::scoped_lock const lock(this->mtx);
+  auto &cached = this->packageCache[extraDirectories];
+  if (!cached || rescan) {
+    cached = scanPackages(extraDirectories);
+  }
+  return cached;
+}
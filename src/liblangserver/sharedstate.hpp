@@ -0,0 +1,40 @@
+#pragma once
+
+#include "parsecache.hpp"
+#include "typenamespace.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+struct PkgConfigPackages {
+  std::set<std::string> names;
+  std::map<std::string /*Name*/, std::string /*Description*/> descriptions;
+};
+
+// Everything that doesn't depend on a single client. A daemon shares one
+// instance between all of its sessions, so e.g. the TypeNamespace is only
+// built once.
+class SharedState {
+public:
+  const TypeNamespace ns;
+  // Used by all workspaces, so e.g. a second editor window or a lint run
+  // on the same project only parses what changed since.
+  const std::shared_ptr<ParseCache> parseCache =
+      std::make_shared<ParseCache>();
+
+  // Scanning all packages is slow, so the result is cached per set of extra
+  // directories. `rescan` forces a new scan, e.g. after the configuration
+  // of the client changed.
+  std::shared_ptr<const PkgConfigPackages>
+  packages(const std::vector<std::string> &extraDirectories,
+           bool rescan = false);
+
+private:
+  std::mutex mtx;
+  std::map<std::vector<std::string>, std::shared_ptr<const PkgConfigPackages>>
+      packageCache;
+};
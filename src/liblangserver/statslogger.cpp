@@ -0,0 +1,28 @@
+#include "statslogger.hpp"
+
+#include "log.hpp"
+#include "polyfill.hpp"
+#include "stats.hpp"
+
+#include <chrono>
+#include <mutex>
+
+const static Logger LOG("Stats"); // NOLINT
+
+StatsLogger::StatsLogger(std::chrono::seconds interval)
+    : thread([this, interval]() {
+        std::unique_lock lock(this->mtx);
+        while (!this->stop.wait_for(lock, interval,
+                                    [this] { return this->stopping; })) {
+          LOG.info(std::format("Stats:\n{}", globalStats().summary()));
+        }
+      }) {}
+
+StatsLogger::~StatsLogger() {
+  {
+    std::scoped_lock const lock(this->mtx);
+    this->stopping = true;
+  }
+  this->stop.notify_all();
+  this->thread.join();
+}
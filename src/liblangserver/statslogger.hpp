@@ -0,0 +1,24 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+constexpr auto STATS_LOG_INTERVAL = std::chrono::minutes(5);
+
+// Logs the global stats periodically, until it is destroyed.
+class StatsLogger {
+public:
+  explicit StatsLogger(std::chrono::seconds interval = STATS_LOG_INTERVAL);
+  ~StatsLogger();
+
+  StatsLogger(const StatsLogger &) = delete;
+  StatsLogger &operator=(const StatsLogger &) = delete;
+
+private:
+  std::mutex mtx;
+  std::condition_variable stop;
+  bool stopping = false;
+  std::thread thread;
+};
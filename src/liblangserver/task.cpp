@@ -1,5 +1,6 @@
 #include "task.hpp"
 
+#include "cancellation.hpp"
 #include "log.hpp"
 #include "polyfill.hpp"
 
@@ -12,11 +13,9 @@ void Task::run() {
     LOG.info("Running task " + this->uuid);
     this->state = TaskState::RUNNING;
     this->taskFunction();
-    if (this->cancelled) {
-      LOG.info(std::format("Task {} was cancelled", this->uuid));
-    } else {
-      LOG.info(std::format("Task {} finished", this->uuid));
-    }
+    LOG.info(std::format("Task {} finished", this->uuid));
+  } catch (const CancelledException &) {
+    LOG.info(std::format("Task {} was cancelled", this->uuid));
   } catch (...) {
     auto currentException = std::current_exception();
     LOG.error(std::format("Caught exception in task {}", this->uuid));
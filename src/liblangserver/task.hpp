@@ -1,9 +1,10 @@
+#include "cancellation.hpp"
 #include "polyfill.hpp"
 
 #include <array>
 #include <atomic>
 #include <functional>
-#include <mutex>
+#include <memory>
 #include <string>
 #include <utility>
 #ifndef _WIN32
@@ -27,15 +28,17 @@ enum class TaskState {
 class Task {
 private:
   std::string uuid;
-  bool cancelled = false;
-  std::mutex mtx;
+  std::shared_ptr<CancellationToken> token;
 
   std::function<void()> taskFunction;
 
 public:
   std::atomic<TaskState> state;
 
-  explicit Task(std::function<void()> func) : taskFunction(std::move(func)) {
+  explicit Task(std::function<void()> func,
+                std::shared_ptr<CancellationToken> token =
+                    std::make_shared<CancellationToken>())
+      : token(std::move(token)), taskFunction(std::move(func)) {
 #ifndef _WIN32
     uuid_t filename;
     uuid_generate(filename);
@@ -51,15 +54,9 @@ public:
 
   [[nodiscard]] std::string getUUID() const { return uuid; }
 
-  void cancel() {
-    std::scoped_lock const lock(mtx);
-    cancelled = true;
-  }
+  void cancel() { this->token->cancel(); }
 
-  [[nodiscard]] bool isCancelled() {
-    std::scoped_lock const lock(mtx);
-    return cancelled;
-  }
+  [[nodiscard]] bool isCancelled() const { return this->token->isCancelled(); }
 
   void run();
 };
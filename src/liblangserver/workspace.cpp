@@ -1,6 +1,7 @@
 #include "workspace.hpp"
 
 #include "analysisoptions.hpp"
+#include "cancellation.hpp"
 #include "codeactionvisitor.hpp"
 #include "completion.hpp"
 #include "documentsymbolvisitor.hpp"
@@ -12,8 +13,10 @@
 #include "mesonmetadata.hpp"
 #include "mesontree.hpp"
 #include "node.hpp"
+#include "piecetable.hpp"
 #include "polyfill.hpp"
 #include "semantictokensvisitor.hpp"
+#include "stats.hpp"
 #include "typenamespace.hpp"
 
 #include <algorithm>
@@ -23,9 +26,12 @@
 #include <filesystem>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 static std::optional<std::string>
@@ -43,157 +49,251 @@ std::vector<MesonTree *> findTrees(const std::shared_ptr<MesonTree> &root) {
   return ret;
 }
 
-bool Workspace::owns(const std::filesystem::path &path) {
-  this->reading.acquire();
-  for (const auto &subTree : this->foundTrees) {
-    if (subTree->ownedFiles.contains(path)) {
-      this->reading.release();
-      return true;
+// The AST of the file as of the last parse, if there is one.
+static Node *lastAst(const MesonTree &tree, const std::filesystem::path &path) {
+  const auto &iter = tree.asts.find(path);
+  if (iter == tree.asts.end() || iter->second.empty()) {
+    return nullptr;
+  }
+  return iter->second.back().get();
+}
+
+void Workspace::publish(const MesonTree *changed) {
+  std::map<std::string, std::shared_ptr<const MesonTree>> previous;
+  for (const auto &tree : this->current.load()->trees) {
+    previous[tree->identifier] = tree;
+  }
+  auto next = std::make_shared<Snapshot>();
+  for (const auto *subTree : this->foundTrees) {
+    const auto &iter = previous.find(subTree->identifier);
+    if (changed && subTree != changed && iter != previous.end()) {
+      // Nothing in here was parsed again
+      next->trees.push_back(iter->second);
+    } else {
+      next->trees.push_back(subTree->snapshot());
     }
   }
-  this->reading.release();
-  return false;
+  for (const auto &subTree : next->trees) {
+    for (const auto &path : subTree->ownedFiles) {
+      next->owners.emplace(fileKey(path), subTree.get());
+    }
+  }
+  this->current.store(std::move(next));
+  if (this->onPublish) {
+    this->onPublish();
+  }
 }
 
-std::vector<InlayHint>
-Workspace::inlayHints(const std::filesystem::path &path) {
-  this->reading.acquire();
-  for (const auto &subTree : this->foundTrees) {
-    if (!subTree->ownedFiles.contains(path)) {
+Workspace::~Workspace() {
+  {
+    std::scoped_lock const lock(this->editsMtx);
+    this->stopping = true;
+  }
+  this->editsChanged.notify_all();
+  if (this->debouncer.joinable()) {
+    this->debouncer.join();
+  }
+}
+
+void Workspace::edit(const std::filesystem::path &path, PieceTable contents,
+                     DiagnosticsCallback func) {
+  {
+    std::scoped_lock const lock(this->editsMtx);
+    if (this->pendingEdits.contains(path)) {
+      globalStats().coalescedEdits.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->pendingEdits[path] = std::move(contents);
+    this->pendingCallback = std::move(func);
+    this->lastEdit = std::chrono::steady_clock::now();
+    if (!this->debouncer.joinable()) {
+      this->debouncer = std::thread(&Workspace::debounce, this);
+    }
+  }
+  this->editsChanged.notify_all();
+}
+
+bool Workspace::parsed() {
+  std::scoped_lock const lock(this->parsedMtx);
+  return this->parsedOnce;
+}
+
+bool Workspace::afterParsed(std::function<void()> job) {
+  std::scoped_lock const lock(this->parsedMtx);
+  if (this->parsedOnce) {
+    return false;
+  }
+  this->parkedJobs.push_back(std::move(job));
+  return true;
+}
+
+void Workspace::markParsed() {
+  std::vector<std::function<void()>> jobs;
+  {
+    std::scoped_lock const lock(this->parsedMtx);
+    this->parsedOnce = true;
+    jobs = std::exchange(this->parkedJobs, {});
+  }
+  for (const auto &job : jobs) {
+    job();
+  }
+}
+
+void Workspace::flushEdits() {
+  {
+    std::scoped_lock const lock(this->editsMtx);
+    if (this->pendingEdits.empty()) {
+      return;
+    }
+    this->flushRequested = true;
+  }
+  this->editsChanged.notify_all();
+}
+
+void Workspace::debounce() {
+  std::unique_lock lock(this->editsMtx);
+  while (!this->stopping) {
+    if (this->pendingEdits.empty()) {
+      this->editsChanged.wait(lock);
       continue;
     }
-    auto ast = subTree->asts[path];
-    if (ast.empty()) {
+    const auto deadline = this->lastEdit + this->options.editDebounce;
+    if (!this->flushRequested && std::chrono::steady_clock::now() < deadline) {
+      this->editsChanged.wait_until(lock, deadline);
       continue;
     }
-    auto visitor =
-        InlayHintVisitor(this->options.removeDefaultTypesInInlayHints,
-                         this->options.disablePosargInlayHints);
-    ast.back()->visit(&visitor);
-    this->reading.release();
-    return visitor.hints;
-  }
-  this->reading.release();
-  return {};
+    auto edits = std::exchange(this->pendingEdits, {});
+    const auto func = this->pendingCallback;
+    this->flushRequested = false;
+    lock.unlock();
+    std::map<std::filesystem::path, std::string> files;
+    for (const auto &[path, contents] : edits) {
+      files.emplace(path, contents.str());
+    }
+    // Blocks while the previous analysis is running, all edits arriving
+    // meanwhile are coalesced into the next one.
+    this->patchFiles(std::move(files), func);
+    lock.lock();
+  }
+}
+
+bool Workspace::owns(const std::filesystem::path &path) {
+  return this->current.load()->owner(path) != nullptr;
+}
+
+std::vector<InlayHint>
+Workspace::inlayHints(const std::filesystem::path &path) {
+  const auto snapshot = this->current.load();
+  const auto *subTree = snapshot->owner(path);
+  if (!subTree) {
+    return {};
+  }
+  auto *ast = lastAst(*subTree, path);
+  if (!ast) {
+    return {};
+  }
+  auto visitor = InlayHintVisitor(this->options.removeDefaultTypesInInlayHints,
+                                  this->options.disablePosargInlayHints);
+  ast->visit(&visitor);
+  return visitor.hints;
 }
 
 std::optional<Hover>
 Workspace::hover(const std::filesystem::path &path, const LSPPosition &position,
                  const std::map<std::string, std::string> &descriptions) {
-  this->reading.acquire();
-  for (const auto &subTree : this->foundTrees) {
-    if (!subTree->ownedFiles.contains(path)) {
-      continue;
-    }
-    auto metadata = subTree->metadata;
-    auto feOpt = metadata.findFunctionExpressionAt(path, position.line,
-                                                   position.character);
-    if (feOpt.has_value()) {
-      auto val = makeHoverForFunctionExpression(feOpt.value(), subTree->options,
-                                                descriptions);
-      this->reading.release();
-      return val;
-    }
-    auto meOpt = metadata.findMethodExpressionAt(path, position.line,
+  const auto snapshot = this->current.load();
+  const auto *subTree = snapshot->owner(path);
+  if (!subTree) {
+    return std::nullopt;
+  }
+  const auto &metadata = *subTree->metadata;
+  auto feOpt = metadata.findFunctionExpressionAt(path, position.line,
                                                  position.character);
-    if (meOpt.has_value()) {
-      auto val = makeHoverForMethodExpression(meOpt.value());
-      this->reading.release();
-      return val;
-    }
-    auto idExprOpt =
-        metadata.findIdExpressionAt(path, position.line, position.character);
-    if (idExprOpt.has_value()) {
-      auto val = makeHoverForId(tree->ns, idExprOpt.value());
-      this->reading.release();
-      return val;
-    }
-    this->reading.release();
-    return {};
+  if (feOpt.has_value()) {
+    auto val = makeHoverForFunctionExpression(feOpt.value(), subTree->options,
+                                              descriptions);
+    return val;
   }
-  this->reading.release();
-  return std::nullopt;
+  auto meOpt = metadata.findMethodExpressionAt(path, position.line,
+                                               position.character);
+  if (meOpt.has_value()) {
+    auto val = makeHoverForMethodExpression(meOpt.value());
+    return val;
+  }
+  auto idExprOpt =
+      metadata.findIdExpressionAt(path, position.line, position.character);
+  if (idExprOpt.has_value()) {
+    auto val = makeHoverForId(subTree->ns, idExprOpt.value());
+    return val;
+  }
+  return {};
 }
 
 std::vector<CodeAction> Workspace::codeAction(const std::filesystem::path &path,
                                               const LSPRange &range) {
-  this->reading.acquire();
-  for (const auto &subTree : this->foundTrees) {
-    if (!subTree->ownedFiles.contains(path)) {
-      continue;
-    }
-    auto ast = subTree->asts[path];
-    if (ast.empty()) {
-      continue;
-    }
-    auto visitor = CodeActionVisitor(range, pathToUrl(path), subTree);
-    ast.back()->visit(&visitor);
-    this->reading.release();
-    return visitor.actions;
+  const auto snapshot = this->current.load();
+  const auto *subTree = snapshot->owner(path);
+  if (!subTree) {
+    return {};
   }
-  this->reading.release();
-  return {};
+  auto *ast = lastAst(*subTree, path);
+  if (!ast) {
+    return {};
+  }
+  auto visitor = CodeActionVisitor(range, pathToUrl(path), subTree);
+  ast->visit(&visitor);
+  return visitor.actions;
 }
 
 std::vector<DocumentHighlight>
 Workspace::highlight(const std::filesystem::path &path,
                      const LSPPosition &position) {
-  this->reading.acquire();
-  for (const auto &subTree : this->foundTrees) {
-    if (!subTree->ownedFiles.contains(path)) {
-      continue;
-    }
-    auto metadata = subTree->metadata;
-    if (!metadata.fileMetadata.contains(path)) {
+  const auto snapshot = this->current.load();
+  const auto *subTree = snapshot->owner(path);
+  if (!subTree) {
+    return {};
+  }
+  const auto &metadata = *subTree->metadata;
+  if (!metadata.fileMetadata.contains(path)) {
+    return {};
+  }
+  auto idExpr =
+      metadata.findIdExpressionAt(path, position.line, position.character);
+  if (!idExpr) {
+    return {};
+  }
+  const auto &identifiers = metadata.fileMetadata.at(path).identifiers;
+  std::vector<DocumentHighlight> ret;
+  for (const auto &toCheck : identifiers) {
+    if (idExpr.value()->id != toCheck->id) {
       continue;
     }
-    auto idExpr =
-        metadata.findIdExpressionAt(path, position.line, position.character);
-    if (!idExpr) {
-      this->reading.release();
-      return {};
-    }
-    const auto &identifiers = metadata.fileMetadata[path].identifiers;
-    std::vector<DocumentHighlight> ret;
-    for (const auto &toCheck : identifiers) {
-      if (idExpr.value()->id != toCheck->id) {
-        continue;
-      }
-      auto kind = DocumentHighlightKind::READ_KIND;
-      const auto *ass = dynamic_cast<AssignmentStatement *>(toCheck->parent);
-      if (ass && toCheck->equals(ass->lhs.get())) {
-        kind = DocumentHighlightKind::WRITE_KIND;
-      }
-      const auto &loc = toCheck->location;
-      auto range = LSPRange(LSPPosition(loc.startLine, loc.startColumn),
-                            LSPPosition(loc.endLine, loc.endColumn));
-      ret.emplace_back(range, kind);
+    auto kind = DocumentHighlightKind::READ_KIND;
+    const auto *ass = dynamic_cast<AssignmentStatement *>(toCheck->parent);
+    if (ass && toCheck->equals(ass->lhs.get())) {
+      kind = DocumentHighlightKind::WRITE_KIND;
     }
-    this->reading.release();
-    return ret;
+    const auto &loc = toCheck->location;
+    auto range = LSPRange(LSPPosition(loc.startLine, loc.startColumn),
+                          LSPPosition(loc.endLine, loc.endColumn));
+    ret.emplace_back(range, kind);
   }
-  this->reading.release();
-  return {};
+  return ret;
 }
 
 std::vector<uint64_t>
 Workspace::semanticTokens(const std::filesystem::path &path) {
-  this->reading.acquire();
-  for (const auto &subTree : this->foundTrees) {
-    if (!subTree->ownedFiles.contains(path)) {
-      continue;
-    }
-    auto ast = subTree->asts[path];
-    if (ast.empty()) {
-      continue;
-    }
-    auto visitor = SemanticTokensVisitor();
-    ast.back()->visit(&visitor);
-    this->reading.release();
-    return visitor.finish();
+  const auto snapshot = this->current.load();
+  const auto *subTree = snapshot->owner(path);
+  if (!subTree) {
+    return {};
   }
-  this->reading.release();
-  return {};
+  auto *ast = lastAst(*subTree, path);
+  if (!ast) {
+    return {};
+  }
+  auto visitor = SemanticTokensVisitor();
+  ast->visit(&visitor);
+  return visitor.finish();
 }
 
 static std::optional<std::string>
@@ -304,18 +404,14 @@ std::vector<LSPLocation> Workspace::jumpTo(const MesonMetadata *metadata,
 
 std::vector<LSPLocation> Workspace::jumpTo(const std::filesystem::path &path,
                                            const LSPPosition &position) {
-  this->reading.acquire();
-  for (const auto &subTree : this->foundTrees) {
-    if (!subTree->ownedFiles.contains(path)) {
-      continue;
-    }
-    const auto &metadata = &subTree->metadata;
-    const auto &ret = Workspace::jumpTo(metadata, path, position);
-    reading.release();
-    return ret;
+  const auto snapshot = this->current.load();
+  const auto *subTree = snapshot->owner(path);
+  if (!subTree) {
+    return {};
   }
-  this->reading.release();
-  return {};
+  const auto *metadata = subTree->metadata.get();
+  const auto &ret = Workspace::jumpTo(metadata, path, position);
+  return ret;
 }
 
 WorkspaceEdit Workspace::rename(const MesonMetadata &metadata,
@@ -344,68 +440,60 @@ WorkspaceEdit Workspace::rename(const MesonMetadata &metadata,
 std::optional<WorkspaceEdit>
 Workspace::rename(const std::filesystem::path &path,
                   const RenameParams &params) {
-  this->reading.acquire();
-  for (const auto &subTree : this->foundTrees) {
-    if (!subTree->ownedFiles.contains(path)) {
-      continue;
-    }
-    auto metadata = subTree->metadata;
-    auto toRenameOpt = metadata.findIdExpressionAt(path, params.position.line,
-                                                   params.position.character);
-    if (!toRenameOpt.has_value()) {
-      this->reading.release();
-      return std::nullopt;
-    }
-    const auto &ret =
-        Workspace::rename(metadata, toRenameOpt.value(), params.newName);
-    this->reading.release();
-    return ret;
+  const auto snapshot = this->current.load();
+  const auto *subTree = snapshot->owner(path);
+  if (!subTree) {
+    return std::nullopt;
   }
-  this->reading.release();
-  return std::nullopt;
+  const auto &metadata = *subTree->metadata;
+  auto toRenameOpt = metadata.findIdExpressionAt(path, params.position.line,
+                                                 params.position.character);
+  if (!toRenameOpt.has_value()) {
+    return std::nullopt;
+  }
+  const auto &ret =
+      Workspace::rename(metadata, toRenameOpt.value(), params.newName);
+  return ret;
 }
 
 std::vector<FoldingRange>
 Workspace::foldingRanges(const std::filesystem::path &path) {
-  this->reading.acquire();
-  for (const auto &subTree : this->foundTrees) {
-    if (!subTree->ownedFiles.contains(path)) {
-      continue;
-    }
-    auto ast = subTree->asts[path];
-    if (ast.empty()) {
-      continue;
-    }
-    auto visitor = FoldingRangeVisitor();
-    ast.back()->visit(&visitor);
-    this->reading.release();
-    return visitor.ranges;
+  const auto snapshot = this->current.load();
+  const auto *subTree = snapshot->owner(path);
+  if (!subTree) {
+    return {};
   }
-  this->reading.release();
-  return {};
+  auto *ast = lastAst(*subTree, path);
+  if (!ast) {
+    return {};
+  }
+  auto visitor = FoldingRangeVisitor();
+  ast->visit(&visitor);
+  return visitor.ranges;
 }
 
 std::vector<SymbolInformation>
 Workspace::documentSymbols(const std::filesystem::path &path) {
-  this->reading.acquire();
-  for (const auto &subTree : this->foundTrees) {
-    if (!subTree->ownedFiles.contains(path)) {
-      continue;
-    }
-    auto ast = subTree->asts[path];
-    if (ast.empty()) {
-      continue;
-    }
-    auto visitor = DocumentSymbolVisitor();
-    ast.back()->visit(&visitor);
-    this->reading.release();
-    return visitor.symbols;
+  const auto snapshot = this->current.load();
+  const auto *subTree = snapshot->owner(path);
+  if (!subTree) {
+    return {};
   }
-  this->reading.release();
-  return {};
+  auto *ast = lastAst(*subTree, path);
+  if (!ast) {
+    return {};
+  }
+  auto visitor = DocumentSymbolVisitor();
+  ast->visit(&visitor);
+  return visitor.symbols;
 }
 
 void Workspace::dropCache(const std::filesystem::path &path) {
+  {
+    // Would bring the contents back after they were dropped
+    std::scoped_lock const lock(this->editsMtx);
+    this->pendingEdits.erase(path);
+  }
   for (const auto &subTree : this->foundTrees) {
     if (!subTree->ownedFiles.contains(path) ||
         !subTree->overrides.contains(path)) {
@@ -420,8 +508,9 @@ std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
 Workspace::clearDiagnostics() {
   std::map<std::filesystem::path, std::vector<LSPDiagnostic>> ret;
 
-  for (const auto &subTree : this->foundTrees) {
-    const auto &metadata = subTree->metadata;
+  const auto snapshot = this->current.load();
+  for (const auto &subTree : snapshot->trees) {
+    const auto &metadata = *subTree->metadata;
     for (const auto &[diagPath, _] : metadata.diagnostics) {
       if (!ret.contains(diagPath)) {
         ret[diagPath] = {};
@@ -433,7 +522,8 @@ Workspace::clearDiagnostics() {
 
 std::optional<std::filesystem::path>
 Workspace::muonConfigFile(const std::filesystem::path &path) {
-  for (const auto &subTree : this->foundTrees) {
+  const auto snapshot = this->current.load();
+  for (const auto &subTree : snapshot->trees) {
     const auto &treePath = subTree->root;
     if (std::filesystem::relative(path, treePath)
             .generic_string()
@@ -455,66 +545,110 @@ Workspace::muonConfigFile(const std::filesystem::path &path) {
 
 std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
 Workspace::fullReparse(const TypeNamespace &ns) {
-  auto newTree = std::make_shared<MesonTree>(this->root, ns);
-  newTree->useCustomParser = this->options.useCustomParser;
-  newTree->fullParse(this->options.analysisOptions,
-                     !this->options.neverDownloadAutomatically);
-  newTree->identifier = this->name;
-  this->tree = newTree;
-  this->foundTrees = findTrees(this->tree);
-  std::map<std::filesystem::path, std::set<LSPDiagnostic>> tmp;
-  for (const auto &subTree : this->foundTrees) {
-    const auto &metadata = subTree->metadata;
-    if (subTree->depth > 0 &&
-        this->options.ignoreDiagnosticsFromSubprojects.has_value()) {
-      const auto &toIgnore = this->options.ignoreDiagnosticsFromSubprojects;
-      if (toIgnore->empty()) {
-        continue; // Skip every subproject
-      }
-      if (std::ranges::find(toIgnore.value(), subTree->name) !=
-          toIgnore->end()) {
-        continue;
-      }
-    }
-    for (const auto &[diagPath, diags] : metadata.diagnostics) {
-      if (!tmp.contains(diagPath)) {
-        tmp[diagPath] = {};
-      }
-      for (const auto &diag : diags) {
-        tmp[diagPath].insert(makeLSPDiagnostic(diag));
-      }
-    }
-  }
-  std::map<std::filesystem::path, std::vector<LSPDiagnostic>> ret;
-  for (const auto &[path, diags] : tmp) {
-    ret[path] = std::vector<LSPDiagnostic>{diags.begin(), diags.end()};
+  // Runs in the background, so edits may be patched in at the same time
+  this->writing.acquire();
+  this->settingUp = true;
+  try {
+    auto newTree = std::make_shared<MesonTree>(this->root, ns);
+    newTree->useCustomParser = this->options.useCustomParser;
+    newTree->parseCache = this->parseCache;
+    newTree->fullParse(this->options.analysisOptions,
+                       !this->options.neverDownloadAutomatically);
+    newTree->identifier = this->name;
+    this->tree = newTree;
+    this->foundTrees = findTrees(this->tree);
+    this->publish(nullptr);
+  } catch (...) {
+    this->settingUp = false;
+    this->writing.release();
+    throw;
   }
+  auto ret = this->collectDiagnostics();
+  this->settingUp = false;
+  this->writing.release();
   return ret;
 }
 
 std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
 Workspace::parse(const TypeNamespace &ns) {
+  // The first parse may run while edits already arrive
+  this->writing.acquire();
   this->settingUp = true;
-  auto newTree = std::make_shared<MesonTree>(this->root, ns);
-  newTree->useCustomParser = this->options.useCustomParser;
-  newTree->fullParse(this->options.analysisOptions,
-                     !this->options.neverDownloadAutomatically);
-  newTree->identifier = this->name;
-  this->tree = newTree;
-  this->foundTrees = findTrees(this->tree);
+  try {
+    auto newTree = std::make_shared<MesonTree>(this->root, ns);
+    newTree->useCustomParser = this->options.useCustomParser;
+    newTree->onSubproject = this->onSubproject;
+    newTree->parseCache = this->parseCache;
+    newTree->fullParse(this->options.analysisOptions,
+                       !this->options.neverDownloadAutomatically);
+    newTree->identifier = this->name;
+    this->tree = newTree;
+    this->foundTrees = findTrees(this->tree);
+    // Only meant for the setup, later analyses must not report progress
+    for (auto *subTree : this->foundTrees) {
+      subTree->onSubproject = nullptr;
+    }
+    this->publish(nullptr);
+  } catch (...) {
+    this->settingUp = false;
+    this->writing.release();
+    this->markParsed();
+    throw;
+  }
+  auto ret = this->collectDiagnostics();
+  this->settingUp = false;
+  this->writing.release();
+  this->markParsed();
+  return ret;
+}
+
+std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+Workspace::reanalyze() {
+  this->writing.acquire();
+  this->settingUp = true;
+  // Subprojects first, as their parents use their results
+  auto trees = this->foundTrees;
+  std::ranges::stable_sort(trees,
+                           [](const MesonTree *lhs, const MesonTree *rhs) {
+                             return lhs->depth > rhs->depth;
+                           });
+  try {
+    for (auto *subTree : trees) {
+      subTree->clear();
+      subTree->partialParse(this->options.analysisOptions);
+    }
+    this->publish(nullptr);
+  } catch (...) {
+    this->settingUp = false;
+    this->writing.release();
+    throw;
+  }
+  auto ret = this->collectDiagnostics();
+  this->settingUp = false;
+  this->writing.release();
+  return ret;
+}
+
+static bool isIgnored(const MesonTree *subTree,
+                      const LanguageServerOptions &options) {
+  if (subTree->depth == 0 ||
+      !options.ignoreDiagnosticsFromSubprojects.has_value()) {
+    return false;
+  }
+  const auto &toIgnore = options.ignoreDiagnosticsFromSubprojects;
+  // Empty means every subproject
+  return toIgnore->empty() ||
+         std::ranges::find(toIgnore.value(), subTree->name) != toIgnore->end();
+}
+
+static std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+diagnosticsOf(const std::vector<const MesonTree *> &trees,
+              const LanguageServerOptions &options) {
   std::map<std::filesystem::path, std::set<LSPDiagnostic>> tmp;
-  for (const auto &subTree : this->foundTrees) {
-    const auto &metadata = subTree->metadata;
-    if (subTree->depth > 0 &&
-        this->options.ignoreDiagnosticsFromSubprojects.has_value()) {
-      const auto &toIgnore = this->options.ignoreDiagnosticsFromSubprojects;
-      if (toIgnore->empty()) {
-        continue; // Skip every subproject
-      }
-      if (std::ranges::find(toIgnore.value(), subTree->name) !=
-          toIgnore->end()) {
-        continue;
-      }
+  for (const auto *subTree : trees) {
+    const auto &metadata = *subTree->metadata;
+    if (isIgnored(subTree, options)) {
+      continue;
     }
     for (const auto &[diagPath, diags] : metadata.diagnostics) {
       if (!tmp.contains(diagPath)) {
@@ -525,7 +659,6 @@ Workspace::parse(const TypeNamespace &ns) {
       }
     }
   }
-  this->settingUp = false;
   std::map<std::filesystem::path, std::vector<LSPDiagnostic>> ret;
   for (const auto &[path, diags] : tmp) {
     ret[path] = std::vector<LSPDiagnostic>{diags.begin(), diags.end()};
@@ -533,26 +666,58 @@ Workspace::parse(const TypeNamespace &ns) {
   return ret;
 }
 
+std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+Workspace::collectDiagnostics() const {
+  return diagnosticsOf({this->foundTrees.begin(), this->foundTrees.end()},
+                       this->options);
+}
+
+std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+Workspace::diagnostics() const {
+  const auto snapshot = this->current.load();
+  std::vector<const MesonTree *> trees;
+  trees.reserve(snapshot->trees.size());
+  for (const auto &subTree : snapshot->trees) {
+    trees.push_back(subTree.get());
+  }
+  return diagnosticsOf(trees, this->options);
+}
+
+std::vector<LSPDiagnostic>
+Workspace::diagnostics(const std::filesystem::path &path) const {
+  const auto snapshot = this->current.load();
+  const auto *subTree = snapshot->owner(path);
+  if (!subTree || isIgnored(subTree, this->options)) {
+    return {};
+  }
+  const auto &diagnostics = subTree->metadata->diagnostics;
+  const auto &iter = diagnostics.find(path);
+  if (iter == diagnostics.end()) {
+    return {};
+  }
+  std::set<LSPDiagnostic> unique;
+  for (const auto &diag : iter->second) {
+    unique.insert(makeLSPDiagnostic(diag));
+  }
+  return {unique.begin(), unique.end()};
+}
+
 std::vector<CompletionItem>
 Workspace::completion(const std::filesystem::path &path,
                       const LSPPosition &position,
-                      const std::set<std::string> &pkgNames) {
-  this->reading.acquire();
-  this->completing = true;
-
-  for (const auto &subTree : this->foundTrees) {
-    if (!subTree->ownedFiles.contains(path)) {
-      continue;
-    }
-    auto ret =
-        complete(path, subTree, subTree->asts[path].back(), position, pkgNames);
-    this->completing = false;
-    this->reading.release();
-    this->logger.info(std::format("Created {} completions", ret.size()));
-    return ret;
+                      const std::set<std::string> &pkgNames,
+                      const CancellationToken *token) {
+  const auto snapshot = this->current.load();
+  const auto *subTree = snapshot->owner(path);
+  if (!subTree) {
+    return {};
   }
-
-  this->completing = false;
-  this->reading.release();
-  return {};
+  const auto &iter = subTree->asts.find(path);
+  if (iter == subTree->asts.end() || iter->second.empty()) {
+    return {};
+  }
+  auto ret = complete(path, subTree, iter->second.back(), position, pkgNames,
+                      token);
+  this->logger.info(std::format("Created {} completions", ret.size()));
+  return ret;
 }
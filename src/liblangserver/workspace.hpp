@@ -1,44 +1,89 @@
 #pragma once
 
+#include "cancellation.hpp"
 #include "langserveroptions.hpp"
 #include "langserverutils.hpp"
 #include "log.hpp"
 #include "lsptypes.hpp"
 #include "mesontree.hpp"
+#include "parsecache.hpp"
+#include "piecetable.hpp"
 #include "task.hpp"
 #include "typenamespace.hpp"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <future>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <semaphore>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 std::vector<MesonTree *> findTrees(const std::shared_ptr<MesonTree> &root);
 
 class Workspace {
 public:
+  using DiagnosticsCallback = std::function<void(
+      const std::map<std::filesystem::path, std::vector<LSPDiagnostic>> &)>;
+
+  // The subtrees as of the last finished analysis.
+  struct Snapshot {
+    std::vector<std::shared_ptr<const MesonTree>> trees;
+    // Every file (see fileKey) to the first of `trees` owning it
+    std::unordered_map<std::string, const MesonTree *> owners;
+
+    [[nodiscard]] const MesonTree *
+    owner(const std::filesystem::path &path) const {
+      const auto &iter = this->owners.find(fileKey(path));
+      return iter == this->owners.end() ? nullptr : iter->second;
+    }
+  };
+
   std::filesystem::path root;
   std::string name;
   std::map<std::string /*Identifier*/, std::shared_ptr<Task>> tasks;
   std::map<std::string /*Identifier*/, std::future<void>> futures;
   std::atomic<bool> settingUp = false;
-  std::atomic<bool> completing = false;
   std::atomic<bool> running = false;
   std::vector<MesonTree *> foundTrees;
   Logger logger;
   LanguageServerOptions &options;
+  // Called after each new snapshot, possibly from the thread that analyzed
+  // the workspace.
+  std::function<void()> onPublish;
+  // How many analyses patchFile started
+  std::atomic<uint64_t> analyses = 0;
+  // Called on the analyzing thread right before partialParse, after the
+  // subtree was cleared. Lets tests hold an analysis while reading.
+  std::function<void()> onAnalysis;
+  // Called by parse with the name of each subproject, before it is parsed
+  std::function<void(const std::string &)> onSubproject;
+  // Tokens and trees of the files, kept across full reparses, so only what
+  // changed on disk is parsed again. The language server replaces it with
+  // the one of its SharedState.
+  std::shared_ptr<ParseCache> parseCache = std::make_shared<ParseCache>();
 
   Workspace(const WorkspaceFolder &wspf, LanguageServerOptions &options)
       : name(wspf.name), logger("ws-" + wspf.name), options(options) {
     this->root = extractPathFromUrl(wspf.uri);
   }
 
+  ~Workspace();
+
+  Workspace(const Workspace &) = delete;
+  Workspace &operator=(const Workspace &) = delete;
+
   std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
   parse(const TypeNamespace &ns);
   std::optional<Hover>
@@ -52,47 +97,115 @@ public:
                                   const LSPPosition &position);
   std::vector<CodeAction> codeAction(const std::filesystem::path &path,
                                      const LSPRange &range);
-  std::vector<CompletionItem> completion(const std::filesystem::path &path,
-                                         const LSPPosition &position,
-                                         const std::set<std::string> &pkgNames);
+  std::vector<CompletionItem>
+  completion(const std::filesystem::path &path, const LSPPosition &position,
+             const std::set<std::string> &pkgNames,
+             const CancellationToken *token = nullptr);
 
   bool owns(const std::filesystem::path &path);
+  // Whether parse finished at least once, before that the workspace owns
+  // no files at all.
+  [[nodiscard]] bool parsed();
+  // Returns false if parse finished already. Otherwise `job` is run on the
+  // parsing thread once it finished, so it must not block.
+  bool afterParsed(std::function<void()> job);
   std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
   fullReparse(const TypeNamespace &ns);
+  // Runs the type analysis, which emits the lints, of every tree again, e.g.
+  // after lint options changed. Unlike parse, the subprojects are neither
+  // found nor set up again.
+  std::map<std::filesystem::path, std::vector<LSPDiagnostic>> reanalyze();
+
+  // Queues the new contents of a file. Only once no edit arrived for
+  // `options.editDebounce`, the latest contents of every queued file are
+  // patched in, with the callback of the latest edit.
+  void edit(const std::filesystem::path &path, PieceTable contents,
+            DiagnosticsCallback func);
+  // Patches all queued edits in right away, e.g. because the user saved.
+  void flushEdits();
 
   template <typename Func>
   void patchFile(const std::filesystem::path &path, const std::string &contents,
                  const Func &func) {
-    this->writing.acquire();
-    this->reading.acquire();
-    this->settingUp = true;
+    this->patchFiles({{path, contents}}, func);
+  }
 
-    for (const auto &subTree : this->foundTrees) {
-      if (!subTree->ownedFiles.contains(path)) {
-        continue;
+  // Like patchFile for several files at once. All new contents of the files
+  // of a subtree are applied before it is analyzed, so each subtree is only
+  // analyzed once.
+  template <typename Func>
+  void patchFiles(std::map<std::filesystem::path, std::string> files,
+                  const Func &func) {
+    // The subtrees will be parsed again with these contents anyway, so still
+    // running analyses triggered by older edits of these files are wasted
+    // work.
+    {
+      std::scoped_lock const lock(this->patchesMutex);
+      for (const auto &[path, _] : files) {
+        if (this->pendingPatches.contains(path)) {
+          this->pendingPatches[path]->cancel();
+        }
+      }
+    }
+    while (!files.empty()) {
+      // Released once the analysis of the subtree finished
+      this->writing.acquire();
+      this->settingUp = true;
+
+      const auto owner = std::ranges::find_if(
+          this->foundTrees, [&files](const MesonTree *subTree) {
+            return std::ranges::any_of(files, [subTree](const auto &file) {
+              return subTree->ownedFiles.contains(file.first);
+            });
+          });
+      if (owner == this->foundTrees.end()) {
+        this->settingUp = false;
+        this->writing.release();
+        return;
       }
+      auto *subTree = *owner;
       this->running = true;
+      std::set<std::filesystem::path> paths;
+      for (auto iter = files.begin(); iter != files.end();) {
+        if (!subTree->ownedFiles.contains(iter->first)) {
+          iter++;
+          continue;
+        }
+        paths.insert(iter->first);
+        subTree->overrides[iter->first] = std::move(iter->second);
+        iter = files.erase(iter);
+      }
       std::set<std::filesystem::path> oldDiags;
       const auto /*Copy explicitly, as subtree is not valid anymore after
                     parsing*/
           identifier = subTree->identifier;
-      for (const auto &[diagPath, _] : subTree->metadata.diagnostics) {
+      for (const auto &[diagPath, _] : subTree->metadata->diagnostics) {
         oldDiags.insert(diagPath);
       }
+      if (this->unclearedDiagnostics.contains(identifier)) {
+        oldDiags.merge(this->unclearedDiagnostics[identifier]);
+        this->unclearedDiagnostics.erase(identifier);
+      }
       subTree->clear();
-      subTree->overrides[path] = contents;
 
-      auto newTask = std::make_shared<Task>([&subTree, func, oldDiags, this]() {
-        this->update<Func>(subTree, func, oldDiags);
-      });
+      auto token = std::make_shared<CancellationToken>();
+      {
+        std::scoped_lock const lock(this->patchesMutex);
+        for (const auto &path : paths) {
+          this->pendingPatches[path] = token;
+        }
+      }
+      auto newTask = std::make_shared<Task>(
+          [subTree, func, oldDiags, paths, token, this]() {
+            this->update<Func>(subTree, func, oldDiags, paths, token);
+          },
+          token);
 
       this->tasks[identifier] = newTask;
       this->settingUp = false;
       futures[identifier] = std::async(std::launch::async, &Task::run, newTask);
-      return;
+      this->analyses++;
     }
-
-    this->settingUp = false;
   }
 
   std::vector<InlayHint> inlayHints(const std::filesystem::path &path);
@@ -105,6 +218,17 @@ public:
   void dropCache(const std::filesystem::path &path);
   std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
   clearDiagnostics();
+  // The diagnostics of the current snapshot, for clients pulling them
+  [[nodiscard]] std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+  diagnostics() const;
+  // Only looks at the subtree owning `path`
+  [[nodiscard]] std::vector<LSPDiagnostic>
+  diagnostics(const std::filesystem::path &path) const;
+
+  // Requests read from this and never wait for an analysis to finish.
+  [[nodiscard]] std::shared_ptr<const Snapshot> snapshot() const {
+    return this->current.load();
+  }
 
 private:
   static std::vector<LSPLocation> jumpTo(const MesonMetadata *metadata,
@@ -122,13 +246,42 @@ private:
                               const IdExpression *toRename,
                               const std::string &newName);
 
+  void finishPatch(const std::set<std::filesystem::path> &paths,
+                   const std::shared_ptr<CancellationToken> &token) {
+    std::scoped_lock const lock(this->patchesMutex);
+    for (const auto &path : paths) {
+      if (this->pendingPatches.contains(path) &&
+          this->pendingPatches[path] == token) {
+        this->pendingPatches.erase(path);
+      }
+    }
+  }
+
   template <typename Func>
   void update(MesonTree *subTree, const Func &func,
-              const std::set<std::filesystem::path> &oldDiags) {
-    assert(!this->completing);
+              const std::set<std::filesystem::path> &oldDiags,
+              const std::set<std::filesystem::path> &paths,
+              const std::shared_ptr<CancellationToken> &token) {
     std::exception_ptr exception = nullptr;
     try {
-      subTree->partialParse(this->options.analysisOptions);
+      if (this->onAnalysis) {
+        this->onAnalysis();
+      }
+      subTree->partialParse(this->options.analysisOptions, token.get());
+    } catch (const CancelledException &) {
+      // A newer edit is waiting for the semaphores and will parse the
+      // subtree again. Publishing now would only flash half-analyzed
+      // diagnostics, so hand the stale paths over to it instead.
+      this->unclearedDiagnostics[subTree->identifier].insert(oldDiags.begin(),
+                                                             oldDiags.end());
+      // The parse may have stopped before reaching the files, but the next
+      // edit has to find this subtree again.
+      subTree->ownedFiles.insert(paths.begin(), paths.end());
+      this->finishPatch(paths, token);
+      this->tasks.erase(subTree->identifier);
+      this->running = false;
+      this->writing.release();
+      throw;
     } catch (...) {
       exception = std::current_exception();
     }
@@ -139,17 +292,17 @@ private:
         ret[oldDiag] = {};
       }
       func(ret);
+      this->finishPatch(paths, token);
       this->tasks.erase(subTree->identifier);
       this->running = false;
       this->writing.release();
-      this->reading.release();
       std::rethrow_exception(exception);
       return;
     }
 
     std::map<std::filesystem::path, std::set<LSPDiagnostic>> tmp;
 
-    const auto &metadata = subTree->metadata;
+    const auto &metadata = *subTree->metadata;
     for (const auto &[diagPath, diags] : metadata.diagnostics) {
       if (!tmp.contains(diagPath)) {
         tmp[diagPath] = {};
@@ -167,15 +320,52 @@ private:
     for (const auto &[path, diags] : tmp) {
       ret[path] = std::vector<LSPDiagnostic>{diags.begin(), diags.end()};
     }
+    this->foundTrees = findTrees(this->tree);
+    this->publish(subTree);
     func(ret);
+    this->finishPatch(paths, token);
     this->tasks.erase(subTree->identifier);
-    this->foundTrees = findTrees(this->tree);
     this->running = false;
-    this->reading.release();
     this->writing.release();
   }
 
+  // Waits for the edits to pause and patches them in, see `edit`.
+  void debounce();
+  void markParsed();
+  // The diagnostics of `foundTrees`, respecting the options
+  [[nodiscard]] std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+  collectDiagnostics() const;
+
+  // Builds the next snapshot out of `foundTrees`. Only `changed` was parsed
+  // again, the others are taken over from the current snapshot. If it is
+  // null, everything is copied anew.
+  void publish(const MesonTree *changed);
+
   std::shared_ptr<MesonTree> tree;
+  // Held while a tree is parsed, so only one analysis runs at a time.
   std::binary_semaphore writing{1};
-  std::binary_semaphore reading{1};
+  // Replaced as a whole once an analysis finished. Requests keep the one
+  // they loaded, even while the next one is published.
+  std::atomic<std::shared_ptr<const Snapshot>> current =
+      std::make_shared<const Snapshot>();
+  std::mutex parsedMtx;
+  bool parsedOnce = false;
+  std::vector<std::function<void()>> parkedJobs;
+  std::mutex editsMtx;
+  std::condition_variable editsChanged;
+  // The latest contents of each edited file, that was not patched in yet
+  // Only turned into a string once they are analyzed
+  std::map<std::filesystem::path, PieceTable> pendingEdits;
+  DiagnosticsCallback pendingCallback;
+  std::chrono::steady_clock::time_point lastEdit;
+  bool flushRequested = false;
+  bool stopping = false;
+  // Started with the first edit
+  std::thread debouncer;
+  std::mutex patchesMutex;
+  std::map<std::filesystem::path, std::shared_ptr<CancellationToken>>
+      pendingPatches;
+  // Diagnostics of cancelled parses, which still have to be cleared.
+  std::map<std::string /*Identifier*/, std::set<std::filesystem::path>>
+      unclearedDiagnostics;
 };
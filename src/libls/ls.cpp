@@ -1,54 +1,326 @@
 #include "ls.hpp"
 
+#include "cancellation.hpp"
 #include "jsonrpc.hpp"
+#include "jsonwriter.hpp"
 #include "log.hpp"
 #include "lsptypes.hpp"
 #include "nlohmann/json.hpp"
+#include "paramsreader.hpp"
 #include "polyfill.hpp"
+#include "stats.hpp"
 
+#include <atomic>
 #include <exception>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 const static Logger LOG("AbstractLanguageServer"); // NOLINT
 
+// Serializes the results directly into the reply, as these lists can get
+// large enough that building a nlohmann::json first dominates the response
+// time.
+template <typename T>
+static void replyArray(jsonrpc::JsonRpcServer &server,
+                       const nlohmann::json &callId,
+                       const std::vector<T> &values) {
+  server.reply(callId, [&values](std::string &out) {
+    JsonWriter writer(out);
+    writer.beginArray();
+    for (const auto &value : values) {
+      value.writeJson(writer);
+    }
+    writer.endArray();
+  });
+}
+
+// All durations in microseconds
+static nlohmann::json histogramToJson(const Histogram &histogram) {
+  return {{"count", histogram.total()},
+          {"total", histogram.sum()},
+          {"p50", histogram.percentile(50)},
+          {"p95", histogram.percentile(95)},
+          {"p99", histogram.percentile(99)},
+          {"max", histogram.max()}};
+}
+
+static nlohmann::json statsToJson(const Stats &stats) {
+  nlohmann::json methods = nlohmann::json::object();
+  stats.methods.forEach([&methods](std::string_view name,
+                                   const MethodStats &methodStats) {
+    methods[std::string(name)] = {
+        {"count", methodStats.latency.total()},
+        {"latency", histogramToJson(methodStats.latency)},
+        {"queueWait", histogramToJson(methodStats.queueWait)},
+        {"deduplicated",
+         methodStats.deduplicated.load(std::memory_order_relaxed)},
+        {"precomputed",
+         {{"hits", methodStats.precomputedHits.load(std::memory_order_relaxed)},
+          {"misses",
+           methodStats.precomputedMisses.load(std::memory_order_relaxed)}}}};
+  });
+  return {
+      {"methods", methods},
+      {"partialParse", histogramToJson(stats.partialParse)},
+      {"fullParse", histogramToJson(stats.fullParse)},
+      {"savedTrees",
+       {{"hits", stats.savedTreesHits.load(std::memory_order_relaxed)},
+        {"misses", stats.savedTreesMisses.load(std::memory_order_relaxed)}}},
+      {"parseCache",
+       {{"hits", stats.parseCacheHits.load(std::memory_order_relaxed)},
+        {"misses", stats.parseCacheMisses.load(std::memory_order_relaxed)},
+        {"incremental",
+         stats.incrementalParses.load(std::memory_order_relaxed)}}},
+      {"coalescedEdits", stats.coalescedEdits.load(std::memory_order_relaxed)},
+      {"bytesRead", stats.bytesRead.load(std::memory_order_relaxed)},
+      {"bytesWritten", stats.bytesWritten.load(std::memory_order_relaxed)}};
+}
+
+std::unique_ptr<jsonrpc::ParamsReader>
+AbstractLanguageServer::paramsReader(const std::string &method) {
+  return makeParamsReader(this, method);
+}
+
+// Everything else, e.g. didChangeConfiguration and initialize, may
+// (re)parse whole workspaces, so it goes to the background lane.
+// NOLINTNEXTLINE
+const static std::unordered_map<std::string_view, jsonrpc::Lane> LANES{
+    {"textDocument/completion", jsonrpc::Lane::INTERACTIVE},
+    {"textDocument/hover", jsonrpc::Lane::INTERACTIVE},
+    {"textDocument/documentHighlight", jsonrpc::Lane::INTERACTIVE},
+    {"textDocument/declaration", jsonrpc::Lane::INTERACTIVE},
+    {"textDocument/definition", jsonrpc::Lane::INTERACTIVE},
+    {"textDocument/inlayHint", jsonrpc::Lane::INTERACTIVE},
+    {"textDocument/semanticTokens/full", jsonrpc::Lane::INTERACTIVE},
+    {"textDocument/foldingRange", jsonrpc::Lane::INTERACTIVE},
+    {"textDocument/documentSymbol", jsonrpc::Lane::INTERACTIVE},
+    {"textDocument/codeAction", jsonrpc::Lane::INTERACTIVE},
+    {"textDocument/diagnostic", jsonrpc::Lane::INTERACTIVE},
+    // Edits only apply to the text they were made on, so the text is
+    // synchronized in the order the messages arrived. All of these only
+    // queue the analysis, so they are cheap.
+    {"textDocument/didOpen", jsonrpc::Lane::INLINE},
+    {"textDocument/didChange", jsonrpc::Lane::INLINE},
+    {"textDocument/didSave", jsonrpc::Lane::INLINE},
+    {"textDocument/didClose", jsonrpc::Lane::INLINE},
+    {"textDocument/formatting", jsonrpc::Lane::EDIT},
+    {"textDocument/rename", jsonrpc::Lane::EDIT},
+    {"exit", jsonrpc::Lane::EDIT},
+    {"shutdown", jsonrpc::Lane::INLINE},
+    // Must be answered even if all workers are stuck
+    {"mesonlsp/stats", jsonrpc::Lane::INLINE},
+};
+
+static bool isNonFileDocument(const nlohmann::json &params) {
+  if (!params.contains("textDocument") ||
+      !params["textDocument"].contains("uri")) {
+    return false;
+  }
+  const auto &uri = params["textDocument"]["uri"];
+  return uri.is_string() && !uri.get<std::string>().starts_with("file");
+}
+
+jsonrpc::Lane AbstractLanguageServer::lane(const std::string &method,
+                                           const nlohmann::json &params) {
+  const auto &iter = LANES.find(method);
+  if (iter == LANES.end()) {
+    return jsonrpc::Lane::BACKGROUND;
+  }
+  // Answered with null right away, see handleRequest
+  if (iter->second == jsonrpc::Lane::INTERACTIVE && params.is_object() &&
+      isNonFileDocument(params)) {
+    return jsonrpc::Lane::INLINE;
+  }
+  return iter->second;
+}
+
+using NotificationHandler = void (*)(AbstractLanguageServer *,
+                                     nlohmann::json &);
+
+template <typename P, void (AbstractLanguageServer::*F)(P &)>
+static void notify(AbstractLanguageServer *server, nlohmann::json &params) {
+  P serializedParams(params);
+  (server->*F)(serializedParams);
+}
+
+// NOLINTNEXTLINE
+const static std::unordered_map<std::string_view, NotificationHandler>
+    NOTIFICATIONS{
+        {"initialized",
+         [](AbstractLanguageServer *server, nlohmann::json & /*params*/) {
+           InitializedParams serializedParams;
+           server->onInitialized(serializedParams);
+         }},
+        {"textDocument/didOpen",
+         notify<DidOpenTextDocumentParams,
+                &AbstractLanguageServer::onDidOpenTextDocument>},
+        {"textDocument/didClose",
+         notify<DidCloseTextDocumentParams,
+                &AbstractLanguageServer::onDidCloseTextDocument>},
+        {"textDocument/didChange",
+         notify<DidChangeTextDocumentParams,
+                &AbstractLanguageServer::onDidChangeTextDocument>},
+        {"textDocument/didSave",
+         notify<DidSaveTextDocumentParams,
+                &AbstractLanguageServer::onDidSaveTextDocument>},
+        {"workspace/didChangeConfiguration",
+         notify<DidChangeConfigurationParams,
+                &AbstractLanguageServer::onDidChangeConfiguration>},
+        {"exit",
+         [](AbstractLanguageServer *server, nlohmann::json & /*params*/) {
+           server->onExit();
+           server->server->exit();
+         }},
+    };
+
+// Each handler sends the reply itself, as the large results are written
+// straight into it.
+using RequestHandler = void (*)(AbstractLanguageServer *,
+                                const nlohmann::json &callId,
+                                nlohmann::json &params,
+                                const CancellationToken &token);
+
+template <typename P, typename T,
+          std::vector<T> (AbstractLanguageServer::*F)(P &)>
+static void replyWithArray(AbstractLanguageServer *server,
+                           const nlohmann::json &callId,
+                           nlohmann::json &params,
+                           const CancellationToken & /*token*/) {
+  P serializedParams(params);
+  replyArray(*server->server, callId, (server->*F)(serializedParams));
+}
+
+template <typename P, typename T,
+          std::optional<T> (AbstractLanguageServer::*F)(P &)>
+static void replyWithOptional(AbstractLanguageServer *server,
+                              const nlohmann::json &callId,
+                              nlohmann::json &params,
+                              const CancellationToken & /*token*/) {
+  P serializedParams(params);
+  auto result = (server->*F)(serializedParams);
+  server->server->reply(callId, result.has_value() ? result->toJson()
+                                                   : nlohmann::json(nullptr));
+}
+
+template <typename P, typename T, T (AbstractLanguageServer::*F)(P &)>
+static void replyWithObject(AbstractLanguageServer *server,
+                            const nlohmann::json &callId,
+                            nlohmann::json &params,
+                            const CancellationToken & /*token*/) {
+  P serializedParams(params);
+  server->server->reply(callId, (server->*F)(serializedParams).toJson());
+}
+
+// NOLINTNEXTLINE
+const static std::unordered_map<std::string_view, RequestHandler> REQUESTS{
+    {"initialize",
+     replyWithObject<InitializeParams, InitializeResult,
+                     &AbstractLanguageServer::initialize>},
+    {"textDocument/inlayHint",
+     replyWithArray<InlayHintParams, InlayHint,
+                    &AbstractLanguageServer::inlayHints>},
+    {"textDocument/foldingRange",
+     replyWithArray<FoldingRangeParams, FoldingRange,
+                    &AbstractLanguageServer::foldingRanges>},
+    {"textDocument/semanticTokens/full",
+     [](AbstractLanguageServer *server, const nlohmann::json &callId,
+        nlohmann::json &params, const CancellationToken & /*token*/) {
+       SemanticTokensParams serializedParams(params);
+       const auto &tokens = server->semanticTokens(serializedParams);
+       server->server->reply(callId, [&tokens](std::string &out) {
+         JsonWriter writer(out);
+         writer.beginObject();
+         writer.key("data");
+         writer.beginArray();
+         for (const auto token : tokens) {
+           writer.number(token);
+         }
+         writer.endArray();
+         writer.endObject();
+       });
+     }},
+    {"textDocument/formatting",
+     [](AbstractLanguageServer *server, const nlohmann::json &callId,
+        nlohmann::json &params, const CancellationToken & /*token*/) {
+       DocumentFormattingParams serializedParams(params);
+       const auto &edit = server->formatting(serializedParams);
+       server->server->reply(callId,
+                             std::vector<nlohmann::json>{edit.toJson()});
+     }},
+    {"textDocument/documentSymbol",
+     replyWithArray<DocumentSymbolParams, SymbolInformation,
+                    &AbstractLanguageServer::documentSymbols>},
+    {"textDocument/hover",
+     replyWithOptional<HoverParams, Hover, &AbstractLanguageServer::hover>},
+    {"textDocument/documentHighlight",
+     replyWithArray<DocumentHighlightParams, DocumentHighlight,
+                    &AbstractLanguageServer::highlight>},
+    {"textDocument/rename",
+     replyWithOptional<RenameParams, WorkspaceEdit,
+                       &AbstractLanguageServer::rename>},
+    {"textDocument/declaration",
+     replyWithArray<DeclarationParams, LSPLocation,
+                    &AbstractLanguageServer::declaration>},
+    {"textDocument/definition",
+     replyWithArray<DefinitionParams, LSPLocation,
+                    &AbstractLanguageServer::definition>},
+    {"textDocument/codeAction",
+     [](AbstractLanguageServer *server, const nlohmann::json &callId,
+        nlohmann::json &params, const CancellationToken & /*token*/) {
+       CodeActionParams serializedParams(params);
+       auto jsonObjects = nlohmann::json::array();
+       for (auto &result : server->codeAction(serializedParams)) {
+         jsonObjects.push_back(result.toJson());
+       }
+       server->server->reply(callId, jsonObjects);
+     }},
+    {"textDocument/completion",
+     [](AbstractLanguageServer *server, const nlohmann::json &callId,
+        nlohmann::json &params, const CancellationToken &token) {
+       CompletionParams serializedParams(params);
+       replyArray(*server->server, callId,
+                  server->completion(serializedParams, token));
+     }},
+    {"textDocument/diagnostic",
+     replyWithObject<DocumentDiagnosticParams, DocumentDiagnosticReport,
+                     &AbstractLanguageServer::diagnostic>},
+    {"workspace/diagnostic",
+     replyWithObject<WorkspaceDiagnosticParams, WorkspaceDiagnosticReport,
+                     &AbstractLanguageServer::workspaceDiagnostic>},
+    {"mesonlsp/diagnostics",
+     [](AbstractLanguageServer *server, const nlohmann::json &callId,
+        nlohmann::json &params, const CancellationToken & /*token*/) {
+       std::vector<nlohmann::json> objs;
+       for (const auto &fileDiags : server->projectDiagnostics(
+                params["rootUri"].get<std::string>())) {
+         objs.push_back(fileDiags.toJson());
+       }
+       server->server->reply(callId, objs);
+     }},
+    {"mesonlsp/stats",
+     [](AbstractLanguageServer *server, const nlohmann::json &callId,
+        nlohmann::json & /*params*/, const CancellationToken & /*token*/) {
+       server->server->reply(callId, statsToJson(globalStats()));
+     }},
+    {"shutdown",
+     [](AbstractLanguageServer *server, const nlohmann::json &callId,
+        nlohmann::json & /*params*/, const CancellationToken & /*token*/) {
+       server->shutdown();
+       server->server->reply(callId, nlohmann::json(nullptr));
+     }},
+};
+
 void AbstractLanguageServer::handleNotification(std::string method,
                                                 nlohmann::json params) {
   try {
     LOG.info(std::format("Received notification {}", method));
-    if (method == "initialized") {
-      InitializedParams serializedParams;
-      this->onInitialized(serializedParams);
-      return;
-    }
-    if (method == "textDocument/didOpen") {
-      DidOpenTextDocumentParams serializedParams(params);
-      this->onDidOpenTextDocument(serializedParams);
-      return;
-    }
-    if (method == "textDocument/didClose") {
-      DidCloseTextDocumentParams serializedParams(params);
-      this->onDidCloseTextDocument(serializedParams);
-      return;
-    }
-    if (method == "textDocument/didChange") {
-      DidChangeTextDocumentParams serializedParams(params);
-      this->onDidChangeTextDocument(serializedParams);
-      return;
-    }
-    if (method == "textDocument/didSave") {
-      DidSaveTextDocumentParams serializedParams(params);
-      this->onDidSaveTextDocument(serializedParams);
-      return;
-    }
-    if (method == "workspace/didChangeConfiguration") {
-      DidChangeConfigurationParams serializedParams(params);
-      this->onDidChangeConfiguration(serializedParams);
-      return;
-    }
-    if (method == "exit") {
-      this->onExit();
-      this->server->exit();
+    const auto &iter = NOTIFICATIONS.find(method);
+    if (iter != NOTIFICATIONS.end()) {
+      iter->second(this, params);
       return;
     }
     LOG.warn(std::format("Unknown notification: '{}'", method));
@@ -64,121 +336,28 @@ void AbstractLanguageServer::handleNotification(std::string method,
   }
 }
 
-void AbstractLanguageServer::handleRequest(std::string method,
-                                           nlohmann::json callId,
-                                           nlohmann::json params) {
+void AbstractLanguageServer::handleRequest(
+    std::string method, nlohmann::json callId, nlohmann::json params,
+    std::shared_ptr<CancellationToken> token) {
   LOG.info(std::format("Received request: {}", method));
   try {
-    nlohmann::json ret;
-    if (params.contains("textDocument") &&
-        params["textDocument"].contains("uri")) {
-      const auto &uri = params["textDocument"]["uri"];
-      if (uri.is_string() && !uri.get<std::string>().starts_with("file")) {
-        this->server->reply(callId, ret);
-        return;
-      }
+    if (isNonFileDocument(params)) {
+      this->server->reply(callId, nlohmann::json(nullptr));
+      return;
     }
-    if (method == "initialize") {
-      InitializeParams serializedParams(params);
-      auto results = this->initialize(serializedParams);
-      ret = results.toJson();
-    } else if (method == "textDocument/inlayHint") {
-      InlayHintParams serializedParams(params);
-      auto results = this->inlayHints(serializedParams);
-      auto jsonObjects = nlohmann::json::array();
-      for (auto &result : results) {
-        jsonObjects.push_back(result.toJson());
-      }
-      ret = jsonObjects;
-    } else if (method == "textDocument/foldingRange") {
-      FoldingRangeParams serializedParams(params);
-      auto results = this->foldingRanges(serializedParams);
-      auto jsonObjects = nlohmann::json::array();
-      for (auto &result : results) {
-        jsonObjects.push_back(result.toJson());
-      }
-      ret = jsonObjects;
-    } else if (method == "textDocument/semanticTokens/full") {
-      SemanticTokensParams serializedParams(params);
-      ret = {{"data", this->semanticTokens(serializedParams)}};
-    } else if (method == "textDocument/formatting") {
-      DocumentFormattingParams serializedParams(params);
-      ret = std::vector<nlohmann::json>{
-          this->formatting(serializedParams).toJson()};
-    } else if (method == "textDocument/documentSymbol") {
-      DocumentSymbolParams serializedParams(params);
-      auto results = this->documentSymbols(serializedParams);
-      auto jsonObjects = nlohmann::json::array();
-      for (auto &result : results) {
-        jsonObjects.push_back(result.toJson());
-      }
-      ret = jsonObjects;
-    } else if (method == "textDocument/hover") {
-      HoverParams serializedParams(params);
-      auto result = this->hover(serializedParams);
-      if (result.has_value()) {
-        ret = result->toJson();
-      } else {
-        ret = nullptr;
-      }
-    } else if (method == "textDocument/documentHighlight") {
-      DocumentHighlightParams serializedParams(params);
-      auto results = this->highlight(serializedParams);
-      auto jsonObjects = nlohmann::json::array();
-      for (auto &result : results) {
-        jsonObjects.push_back(result.toJson());
-      }
-      ret = jsonObjects;
-    } else if (method == "textDocument/rename") {
-      RenameParams serializedParams(params);
-      auto result = this->rename(serializedParams);
-      if (result.has_value()) {
-        ret = result->toJson();
-      } else {
-        ret = nullptr;
-      }
-    } else if (method == "textDocument/declaration") {
-      DeclarationParams serializedParams(params);
-      auto results = this->declaration(serializedParams);
-      auto jsonObjects = nlohmann::json::array();
-      for (auto &result : results) {
-        jsonObjects.push_back(result.toJson());
-      }
-      ret = jsonObjects;
-    } else if (method == "textDocument/definition") {
-      DefinitionParams serializedParams(params);
-      auto results = this->definition(serializedParams);
-      auto jsonObjects = nlohmann::json::array();
-      for (auto &result : results) {
-        jsonObjects.push_back(result.toJson());
-      }
-      ret = jsonObjects;
-    } else if (method == "textDocument/codeAction") {
-      CodeActionParams serializedParams(params);
-      auto results = this->codeAction(serializedParams);
-      auto jsonObjects = nlohmann::json::array();
-      for (auto &result : results) {
-        jsonObjects.push_back(result.toJson());
-      }
-      ret = jsonObjects;
-    } else if (method == "textDocument/completion") {
-      CompletionParams serializedParams(params);
-      auto results = this->completion(serializedParams);
-      auto jsonObjects = nlohmann::json::array();
-      for (auto &result : results) {
-        jsonObjects.push_back(result.toJson());
-      }
-      ret = jsonObjects;
-    } else if (method == "shutdown") {
-      this->shutdown();
-      ret = nullptr;
-    } else {
+    const auto &iter = REQUESTS.find(method);
+    if (iter == REQUESTS.end()) {
       LOG.warn(std::format("Unknown request: '{}'", method));
       this->server->returnError(callId, jsonrpc::JsonrpcError::METHOD_NOT_FOUND,
                                 std::format("Unknown request: {}", method));
       return;
     }
-    this->server->reply(callId, ret);
+    iter->second(this, callId, params, *token);
+  } catch (const CancelledException &) {
+    LOG.info(std::format("Request {} was cancelled", method));
+    this->server->returnError(callId,
+                              jsonrpc::JsonrpcError::REQUEST_CANCELLED,
+                              "Request was cancelled");
   } catch (const std::string &str) {
     LOG.error(std::format("Got error {}", str));
     this->server->returnError(callId, jsonrpc::JsonrpcError::INTERNAL_ERROR,
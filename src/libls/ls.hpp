@@ -1,8 +1,10 @@
 #pragma once
+#include "cancellation.hpp"
 #include "jsonrpc.hpp"
 #include "lsptypes.hpp"
 
 #include <cstdint>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <optional>
 #include <string>
@@ -12,7 +14,12 @@ class AbstractLanguageServer : public jsonrpc::JsonRpcHandler {
 public:
   void handleNotification(std::string method, nlohmann::json params) override;
   void handleRequest(std::string method, nlohmann::json callId,
-                     nlohmann::json params) override;
+                     nlohmann::json params,
+                     std::shared_ptr<CancellationToken> token) override;
+  std::unique_ptr<jsonrpc::ParamsReader>
+  paramsReader(const std::string &method) override;
+  jsonrpc::Lane lane(const std::string &method,
+                     const nlohmann::json &params) override;
 
   virtual InitializeResult initialize(InitializeParams &params) = 0;
   virtual std::vector<InlayHint> inlayHints(InlayHintParams &params) = 0;
@@ -30,8 +37,16 @@ public:
   virtual std::vector<LSPLocation> declaration(DeclarationParams &params) = 0;
   virtual std::vector<LSPLocation> definition(DefinitionParams &params) = 0;
   virtual std::vector<CodeAction> codeAction(CodeActionParams &params) = 0;
-  virtual std::vector<CompletionItem> completion(CompletionParams &params) = 0;
+  virtual std::vector<CompletionItem>
+  completion(CompletionParams &params, const CancellationToken &token) = 0;
+  virtual DocumentDiagnosticReport
+  diagnostic(DocumentDiagnosticParams &params) = 0;
+  virtual WorkspaceDiagnosticReport
+  workspaceDiagnostic(WorkspaceDiagnosticParams &params) = 0;
   virtual void shutdown() = 0;
+  // Not part of LSP, lets e.g. mesonlint reuse the state of a daemon.
+  virtual std::vector<PublishDiagnosticsParams>
+  projectDiagnostics(const std::string &rootUri) = 0;
 
   virtual void onInitialized(InitializedParams &params) = 0;
   virtual void onExit() = 0;
@@ -0,0 +1,149 @@
+#include "paramsreader.hpp"
+
+#include "log.hpp"
+#include "ls.hpp"
+#include "lsptypes.hpp"
+#include "messageparser.hpp"
+#include "polyfill.hpp"
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+const static Logger LOG("ParamsReader"); // NOLINT
+
+template <typename Func>
+static void runNotification(std::string_view method, const Func &func) {
+  try {
+    LOG.info(std::format("Received notification {}", method));
+    func();
+  } catch (const std::exception &exc) {
+    LOG.error(std::format("Got error {} in {}", exc.what(), method));
+  } catch (...) {
+    LOG.error(std::format("Something else was caught in {}", method));
+  }
+}
+
+// These carry the whole document, reading them into the params directly
+// means the text is moved out of the parser without ever building a
+// nlohmann::json for it.
+class DidOpenReader : public LspParamsReader {
+public:
+  using LspParamsReader::LspParamsReader;
+
+  void finish() override {
+    runNotification("textDocument/didOpen", [this]() {
+      DidOpenTextDocumentParams params(TextDocumentItem(
+          std::move(this->uri), this->version, std::move(this->text)));
+      this->server->onDidOpenTextDocument(params);
+    });
+  }
+
+protected:
+  void onString(std::string &val) override {
+    if (this->at({"textDocument", "uri"})) {
+      this->uri = std::move(val);
+    } else if (this->at({"textDocument", "text"})) {
+      this->text = std::move(val);
+    }
+  }
+
+  void onInteger(int64_t val) override {
+    if (this->at({"textDocument", "version"})) {
+      this->version = val;
+    }
+  }
+
+private:
+  std::string uri;
+  int64_t version = 0;
+  std::string text;
+};
+
+class DidChangeReader : public LspParamsReader {
+public:
+  using LspParamsReader::LspParamsReader;
+
+  void finish() override {
+    runNotification("textDocument/didChange", [this]() {
+      DidChangeTextDocumentParams params(
+          VersionedTextDocumentIdentifier(std::move(this->uri), this->version),
+          std::move(this->changes));
+      this->server->onDidChangeTextDocument(params);
+    });
+  }
+
+  bool start_object(std::size_t elements) override {
+    if (this->at({"contentChanges"})) {
+      this->changes.emplace_back(std::string());
+    } else if (this->at({"contentChanges", "range"}) &&
+               !this->changes.empty()) {
+      this->changes.back().range =
+          LSPRange(LSPPosition(0, 0), LSPPosition(0, 0));
+    }
+    return LspParamsReader::start_object(elements);
+  }
+
+protected:
+  void onString(std::string &val) override {
+    if (this->at({"textDocument", "uri"})) {
+      this->uri = std::move(val);
+    } else if (this->at({"contentChanges", "text"}) && !this->changes.empty()) {
+      this->changes.back().text = std::move(val);
+    }
+  }
+
+  void onInteger(int64_t val) override {
+    if (this->at({"textDocument", "version"})) {
+      this->version = val;
+      return;
+    }
+    if (this->changes.empty() || !this->changes.back().range.has_value()) {
+      return;
+    }
+    auto &range = *this->changes.back().range;
+    if (this->at({"contentChanges", "range", "start", "line"})) {
+      range.start.line = (uint64_t)val;
+    } else if (this->at({"contentChanges", "range", "start", "character"})) {
+      range.start.character = (uint64_t)val;
+    } else if (this->at({"contentChanges", "range", "end", "line"})) {
+      range.end.line = (uint64_t)val;
+    } else if (this->at({"contentChanges", "range", "end", "character"})) {
+      range.end.character = (uint64_t)val;
+    }
+  }
+
+private:
+  std::string uri;
+  int64_t version = 0;
+  std::vector<TextDocumentContentChangeEvent> changes;
+};
+
+using ReaderFactory =
+    std::unique_ptr<jsonrpc::ParamsReader> (*)(AbstractLanguageServer *);
+
+template <typename T>
+static std::unique_ptr<jsonrpc::ParamsReader>
+makeReader(AbstractLanguageServer *server) {
+  return std::make_unique<T>(server);
+}
+
+// NOLINTNEXTLINE
+const static std::unordered_map<std::string_view, ReaderFactory> READERS{
+    {"textDocument/didOpen", makeReader<DidOpenReader>},
+    {"textDocument/didChange", makeReader<DidChangeReader>},
+};
+
+std::unique_ptr<jsonrpc::ParamsReader>
+makeParamsReader(AbstractLanguageServer *server, const std::string &method) {
+  const auto &iter = READERS.find(method);
+  if (iter == READERS.end()) {
+    return nullptr;
+  }
+  return iter->second(server);
+}
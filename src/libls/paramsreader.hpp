@@ -0,0 +1,78 @@
+#pragma once
+#include "jsonrpc.hpp"
+#include "messageparser.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class AbstractLanguageServer;
+
+// Base for readers that pick a few values out of the params of a
+// notification and ignore everything else. Keeps track of the keys leading
+// to the current value, arrays are transparent.
+class LspParamsReader : public jsonrpc::ParamsReader {
+public:
+  explicit LspParamsReader(AbstractLanguageServer *server) : server(server) {}
+
+  bool null() override { return true; }
+  bool boolean(bool /*val*/) override { return true; }
+  bool number_integer(number_integer_t val) override {
+    this->onInteger(val);
+    return true;
+  }
+  bool number_unsigned(number_unsigned_t val) override {
+    this->onInteger((int64_t)val);
+    return true;
+  }
+  bool number_float(number_float_t /*val*/,
+                    const string_t & /*str*/) override {
+    return true;
+  }
+  bool string(string_t &val) override {
+    this->onString(val);
+    return true;
+  }
+  bool binary(binary_t & /*val*/) override { return true; }
+  bool start_object(std::size_t /*elements*/) override {
+    this->path.emplace_back();
+    return true;
+  }
+  bool key(string_t &val) override {
+    this->path.back() = val;
+    return true;
+  }
+  bool end_object() override {
+    this->path.pop_back();
+    return true;
+  }
+  bool start_array(std::size_t /*elements*/) override { return true; }
+  bool end_array() override { return true; }
+  bool parse_error(std::size_t /*position*/, const std::string & /*lastToken*/,
+                   const nlohmann::detail::exception & /*ex*/) override {
+    return false;
+  }
+
+protected:
+  AbstractLanguageServer *server;
+
+  [[nodiscard]] bool at(std::initializer_list<std::string_view> keys) const {
+    return std::equal(this->path.begin(), this->path.end(), keys.begin(),
+                      keys.end());
+  }
+
+  virtual void onString(std::string &val) = 0;
+  virtual void onInteger(int64_t val) = 0;
+
+private:
+  std::vector<std::string> path;
+};
+
+std::unique_ptr<jsonrpc::ParamsReader>
+makeParamsReader(AbstractLanguageServer *server, const std::string &method);
@@ -0,0 +1,180 @@
+#pragma once
+#include <array>
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Appends JSON directly to a string, without building a nlohmann::json
+// first. Commas are inserted automatically, keys have to be written in the
+// order nlohmann::json would dump them, if the output should be identical.
+class JsonWriter {
+public:
+  explicit JsonWriter(std::string &out) : out(out) {}
+
+  void beginObject() {
+    this->separate();
+    this->out.push_back('{');
+    this->needsComma = false;
+  }
+
+  void endObject() {
+    this->out.push_back('}');
+    this->needsComma = true;
+  }
+
+  void beginArray() {
+    this->separate();
+    this->out.push_back('[');
+    this->needsComma = false;
+  }
+
+  void endArray() {
+    this->out.push_back(']');
+    this->needsComma = true;
+  }
+
+  void key(std::string_view name) {
+    this->separate();
+    this->appendEscaped(name);
+    this->out.push_back(':');
+    this->needsComma = false;
+  }
+
+  void string(std::string_view value) {
+    this->separate();
+    this->appendEscaped(value);
+    this->needsComma = true;
+  }
+
+  template <std::integral T>
+    requires(!std::same_as<T, bool>)
+  void number(T value) {
+    this->separate();
+    std::array<char, 24> buf;
+    const auto [end, _] = std::to_chars(buf.data(), buf.data() + buf.size(),
+                                        value);
+    this->out.append(buf.data(), end);
+    this->needsComma = true;
+  }
+
+  void boolean(bool value) {
+    this->separate();
+    this->out.append(value ? "true" : "false");
+    this->needsComma = true;
+  }
+
+  void null() {
+    this->separate();
+    this->out.append("null");
+    this->needsComma = true;
+  }
+
+private:
+  std::string &out;
+  bool needsComma = false;
+
+  void separate() {
+    if (this->needsComma) {
+      this->out.push_back(',');
+    }
+  }
+
+  // The length of the UTF-8 sequence starting at `idx` and whether it is
+  // valid. For invalid ones, it is the length of the longest prefix that
+  // could have started a valid sequence, at least one byte.
+  static std::pair<size_t, bool> utf8Sequence(std::string_view value,
+                                              size_t idx) {
+    const auto lead = (unsigned char)value[idx];
+    size_t length = 0;
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+      length = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+      length = 3;
+      // No overlong encodings and no surrogates
+      low = lead == 0xE0 ? 0xA0 : 0x80;
+      high = lead == 0xED ? 0x9F : 0xBF;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+      length = 4;
+      // No overlong encodings and nothing beyond U+10FFFF
+      low = lead == 0xF0 ? 0x90 : 0x80;
+      high = lead == 0xF4 ? 0x8F : 0xBF;
+    } else {
+      return {1, false};
+    }
+    for (size_t i = 1; i < length; i++) {
+      if (idx + i >= value.size()) {
+        return {i, false};
+      }
+      const auto chr = (unsigned char)value[idx + i];
+      if (chr < low || chr > high) {
+        return {i, false};
+      }
+      low = 0x80;
+      high = 0xBF;
+    }
+    return {length, true};
+  }
+
+  // Same escaping as nlohmann::json::dump() with error_handler_t::replace:
+  // Invalid UTF-8 is replaced with U+FFFD, as file contents may contain
+  // anything and the output has to stay valid JSON.
+  void appendEscaped(std::string_view value) {
+    constexpr std::string_view HEX = "0123456789abcdef";
+    constexpr std::string_view REPLACEMENT = "\xEF\xBF\xBD";
+    this->out.push_back('"');
+    size_t plainStart = 0;
+    for (size_t i = 0; i < value.size(); i++) {
+      const auto chr = (unsigned char)value[i];
+      if (chr >= 0x80) {
+        const auto [length, valid] = utf8Sequence(value, i);
+        if (!valid) {
+          this->out.append(value.substr(plainStart, i - plainStart));
+          this->out.append(REPLACEMENT);
+          plainStart = i + length;
+        }
+        i += length - 1;
+        continue;
+      }
+      if (chr >= 0x20 && chr != '"' && chr != '\\') {
+        continue;
+      }
+      this->out.append(value.substr(plainStart, i - plainStart));
+      plainStart = i + 1;
+      switch (chr) {
+      case '"':
+        this->out.append("\\\"");
+        break;
+      case '\\':
+        this->out.append("\\\\");
+        break;
+      case '\b':
+        this->out.append("\\b");
+        break;
+      case '\f':
+        this->out.append("\\f");
+        break;
+      case '\n':
+        this->out.append("\\n");
+        break;
+      case '\r':
+        this->out.append("\\r");
+        break;
+      case '\t':
+        this->out.append("\\t");
+        break;
+      default:
+        this->out.append("\\u00");
+        this->out.push_back(HEX[chr >> 4]);
+        this->out.push_back(HEX[chr & 0xF]);
+        break;
+      }
+    }
+    this->out.append(value.substr(plainStart));
+    this->out.push_back('"');
+  }
+};
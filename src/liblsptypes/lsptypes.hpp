@@ -1,4 +1,6 @@
 #pragma once
+#include "jsonwriter.hpp"
+
 #include <cassert>
 #include <cstdint>
 #include <iostream>
@@ -33,13 +35,43 @@ public:
   std::string uri;
   std::string name;
 
+  WorkspaceFolder(std::string uri, std::string name)
+      : uri(std::move(uri)), name(std::move(name)) {}
+
   explicit WorkspaceFolder(nlohmann::json &jsonObj) {
     this->uri = jsonObj["uri"];
     this->name = jsonObj["name"];
   }
 };
 
-class ClientCapabilities : public BaseObject {};
+class ClientCapabilities : public BaseObject {
+public:
+  // Whether the client shows progress the server initiated
+  bool workDoneProgress = false;
+  // Whether the client asks for diagnostics instead of having them pushed
+  bool pullDiagnostics = false;
+  // Whether the client pulls diagnostics again, if the server asks it to
+  bool diagnosticRefresh = false;
+
+  ClientCapabilities() = default;
+
+  explicit ClientCapabilities(const nlohmann::json &data) {
+    if (data.contains("window") && data["window"].is_object() &&
+        data["window"].contains("workDoneProgress")) {
+      this->workDoneProgress = data["window"]["workDoneProgress"] == true;
+    }
+    if (data.contains("textDocument") && data["textDocument"].is_object()) {
+      this->pullDiagnostics = data["textDocument"].contains("diagnostic");
+    }
+    if (data.contains("workspace") && data["workspace"].is_object() &&
+        data["workspace"].contains("diagnostics") &&
+        data["workspace"]["diagnostics"].is_object() &&
+        data["workspace"]["diagnostics"].contains("refreshSupport")) {
+      this->diagnosticRefresh =
+          data["workspace"]["diagnostics"]["refreshSupport"] == true;
+    }
+  }
+};
 
 enum class TextDocumentSyncKind { NONE = 0, FULL = 1, INCREMENTAL = 2 };
 
@@ -107,6 +139,21 @@ public:
   }
 };
 
+class DiagnosticOptions : public BaseObject {
+public:
+  bool interFileDependencies;
+  bool workspaceDiagnostics;
+
+  DiagnosticOptions(bool interFileDependencies, bool workspaceDiagnostics)
+      : interFileDependencies(interFileDependencies),
+        workspaceDiagnostics(workspaceDiagnostics) {}
+
+  [[nodiscard]] nlohmann::json toJson() const {
+    return {{"interFileDependencies", interFileDependencies},
+            {"workspaceDiagnostics", workspaceDiagnostics}};
+  }
+};
+
 class ServerCapabilities : public BaseObject {
 public:
   TextDocumentSyncOptions textDocumentSync;
@@ -123,6 +170,8 @@ public:
   CompletionOptions completionProvider;
   SemanticTokensOptions semanticTokensProvider;
   std::optional<WorkspaceCapabilities> workspace;
+  // Only offered to clients that support pulling diagnostics
+  std::optional<DiagnosticOptions> diagnosticProvider;
 
   // This is stupid
   ServerCapabilities(TextDocumentSyncOptions textDocumentSync,
@@ -149,20 +198,25 @@ public:
         workspace(workspace) {}
 
   [[nodiscard]] nlohmann::json toJson() const {
-    return {{"textDocumentSync", this->textDocumentSync.toJson()},
-            {"hoverProvider", hoverProvider},
-            {"definitionProvider", definitionProvider},
-            {"declarationProvider", declarationProvider},
-            {"documentHighlightProvider", documentHighlightProvider},
-            {"documentSymbolProvider", documentSymbolProvider},
-            {"codeActionProvider", codeActionProvider},
-            {"documentFormattingProvider", documentFormattingProvider},
-            {"renameProvider", renameProvider},
-            {"foldingRangeProvider", foldingRangeProvider},
-            {"inlayHintProvider", inlayHintProvider},
-            {"completionProvider", completionProvider.toJson()},
-            {"semanticTokensProvider", semanticTokensProvider.toJson()},
-            {"workspace", workspace->toJson()}};
+    nlohmann::json ret = {
+        {"textDocumentSync", this->textDocumentSync.toJson()},
+        {"hoverProvider", hoverProvider},
+        {"definitionProvider", definitionProvider},
+        {"declarationProvider", declarationProvider},
+        {"documentHighlightProvider", documentHighlightProvider},
+        {"documentSymbolProvider", documentSymbolProvider},
+        {"codeActionProvider", codeActionProvider},
+        {"documentFormattingProvider", documentFormattingProvider},
+        {"renameProvider", renameProvider},
+        {"foldingRangeProvider", foldingRangeProvider},
+        {"inlayHintProvider", inlayHintProvider},
+        {"completionProvider", completionProvider.toJson()},
+        {"semanticTokensProvider", semanticTokensProvider.toJson()},
+        {"workspace", workspace->toJson()}};
+    if (diagnosticProvider.has_value()) {
+      ret["diagnosticProvider"] = diagnosticProvider->toJson();
+    }
+    return ret;
   }
 };
 
@@ -180,6 +234,9 @@ public:
     if (jsonObj.contains("initializationOptions")) {
       this->initializationOptions = jsonObj["initializationOptions"];
     }
+    if (jsonObj.contains("capabilities")) {
+      this->capabilities = ClientCapabilities(jsonObj["capabilities"]);
+    }
     assert(jsonObj.contains("workspaceFolders"));
     for (auto wsFolder : jsonObj["workspaceFolders"]) {
       this->workspaceFolders.emplace_back(wsFolder);
@@ -247,6 +304,15 @@ public:
     return {{"line", line}, {"character", character}};
   }
 
+  void writeJson(JsonWriter &writer) const {
+    writer.beginObject();
+    writer.key("character");
+    writer.number(character);
+    writer.key("line");
+    writer.number(line);
+    writer.endObject();
+  }
+
   bool operator<(const LSPPosition &right) const {
     if (this->line < right.line) {
       return true;
@@ -277,6 +343,15 @@ public:
     return {{"start", start.toJson()}, {"end", end.toJson()}};
   }
 
+  void writeJson(JsonWriter &writer) const {
+    writer.beginObject();
+    writer.key("end");
+    end.writeJson(writer);
+    writer.key("start");
+    start.writeJson(writer);
+    writer.endObject();
+  }
+
   [[nodiscard]] bool contains(const LSPPosition &position) const {
     if (position.line > this->start.line && position.line < this->end.line) {
       return true;
@@ -354,11 +429,17 @@ public:
 class TextDocumentItem : public BaseObject {
 public:
   std::string uri;
+  int64_t version;
   std::string text;
 
+  TextDocumentItem(std::string uri, int64_t version, std::string text)
+      : uri(std::move(uri)), version(version), text(std::move(text)) {}
+
   explicit TextDocumentItem(nlohmann::json &jsonObj) {
     this->uri = jsonObj["uri"];
-    this->text = jsonObj["text"];
+    this->version = jsonObj.value("version", 0);
+    // The document may be huge, so it is moved out instead of copied.
+    this->text = std::move(jsonObj["text"].get_ref<std::string &>());
   }
 };
 
@@ -366,6 +447,9 @@ class DidOpenTextDocumentParams : public BaseObject {
 public:
   TextDocumentItem textDocument;
 
+  explicit DidOpenTextDocumentParams(TextDocumentItem textDocument)
+      : textDocument(std::move(textDocument)) {}
+
   explicit DidOpenTextDocumentParams(nlohmann::json &jsonObj)
       : textDocument(jsonObj["textDocument"]) {}
 };
@@ -374,23 +458,55 @@ class TextDocumentIdentifier : public BaseObject {
 public:
   std::string uri;
 
+  explicit TextDocumentIdentifier(std::string uri) : uri(std::move(uri)) {}
+
   explicit TextDocumentIdentifier(nlohmann::json &jsonObj)
       : uri(jsonObj["uri"]) {}
 };
 
+class VersionedTextDocumentIdentifier : public TextDocumentIdentifier {
+public:
+  int64_t version;
+
+  VersionedTextDocumentIdentifier(std::string uri, int64_t version)
+      : TextDocumentIdentifier(std::move(uri)), version(version) {}
+
+  explicit VersionedTextDocumentIdentifier(nlohmann::json &jsonObj)
+      : TextDocumentIdentifier(jsonObj), version(jsonObj.value("version", 0)) {
+  }
+};
+
 class TextDocumentContentChangeEvent : public BaseObject {
 public:
+  // Replaces the whole document, if not set
+  std::optional<LSPRange> range;
   std::string text;
 
+  explicit TextDocumentContentChangeEvent(std::string text)
+      : text(std::move(text)) {}
+
+  TextDocumentContentChangeEvent(LSPRange range, std::string text)
+      : range(std::move(range)), text(std::move(text)) {}
+
   explicit TextDocumentContentChangeEvent(nlohmann::json &jsonObj)
-      : text(jsonObj["text"]) {}
+      : text(std::move(jsonObj["text"].get_ref<std::string &>())) {
+    if (jsonObj.contains("range")) {
+      this->range = LSPRange(jsonObj["range"]);
+    }
+  }
 };
 
 class DidChangeTextDocumentParams : public BaseObject {
 public:
-  TextDocumentIdentifier textDocument;
+  VersionedTextDocumentIdentifier textDocument;
   std::vector<TextDocumentContentChangeEvent> contentChanges;
 
+  DidChangeTextDocumentParams(
+      VersionedTextDocumentIdentifier textDocument,
+      std::vector<TextDocumentContentChangeEvent> contentChanges)
+      : textDocument(std::move(textDocument)),
+        contentChanges(std::move(contentChanges)) {}
+
   explicit DidChangeTextDocumentParams(nlohmann::json &jsonObj)
       : textDocument(jsonObj["textDocument"]) {
     for (auto &change : jsonObj["contentChanges"]) {
@@ -435,6 +551,15 @@ public:
   [[nodiscard]] nlohmann::json toJson() const {
     return {{"position", position.toJson()}, {"label", this->label}};
   }
+
+  void writeJson(JsonWriter &writer) const {
+    writer.beginObject();
+    writer.key("label");
+    writer.string(label);
+    writer.key("position");
+    position.writeJson(writer);
+    writer.endObject();
+  }
 };
 
 class FoldingRangeParams : public BaseObject {
@@ -456,6 +581,15 @@ public:
   [[nodiscard]] nlohmann::json toJson() const {
     return {{"startLine", startLine}, {"endLine", endLine}};
   }
+
+  void writeJson(JsonWriter &writer) const {
+    writer.beginObject();
+    writer.key("endLine");
+    writer.number(endLine);
+    writer.key("startLine");
+    writer.number(startLine);
+    writer.endObject();
+  }
 };
 
 class SemanticTokensParams : public BaseObject {
@@ -500,6 +634,15 @@ public:
     return {{"range", range.toJson()}, {"newText", newText}};
   }
 
+  void writeJson(JsonWriter &writer) const {
+    writer.beginObject();
+    writer.key("newText");
+    writer.string(newText);
+    writer.key("range");
+    range.writeJson(writer);
+    writer.endObject();
+  }
+
   bool operator<(const TextEdit &other) const {
     return this->range < other.range;
   }
@@ -517,6 +660,81 @@ public:
       : textDocument(jsonObj["textDocument"]) {}
 };
 
+class DocumentDiagnosticParams : public BaseObject {
+public:
+  TextDocumentIdentifier textDocument;
+  std::optional<std::string> previousResultId;
+
+  explicit DocumentDiagnosticParams(nlohmann::json &jsonObj)
+      : textDocument(jsonObj["textDocument"]) {
+    if (jsonObj.contains("previousResultId") &&
+        jsonObj["previousResultId"].is_string()) {
+      this->previousResultId = jsonObj["previousResultId"];
+    }
+  }
+};
+
+class WorkspaceDiagnosticParams : public BaseObject {
+public:
+  // The URI of each file to the result id the client has for it
+  std::map<std::string, std::string> previousResultIds;
+
+  explicit WorkspaceDiagnosticParams(nlohmann::json &jsonObj) {
+    if (!jsonObj.contains("previousResultIds")) {
+      return;
+    }
+    for (const auto &previous : jsonObj["previousResultIds"]) {
+      this->previousResultIds[previous["uri"]] = previous["value"];
+    }
+  }
+};
+
+// Either all diagnostics of a file, or only the result id the client already
+// has, if they did not change.
+class DocumentDiagnosticReport : public BaseObject {
+public:
+  std::string resultId;
+  bool unchanged;
+  std::vector<LSPDiagnostic> items;
+
+  explicit DocumentDiagnosticReport(std::string resultId)
+      : resultId(std::move(resultId)), unchanged(true) {}
+
+  DocumentDiagnosticReport(std::string resultId,
+                           std::vector<LSPDiagnostic> items)
+      : resultId(std::move(resultId)), unchanged(false),
+        items(std::move(items)) {}
+
+  [[nodiscard]] nlohmann::json toJson() const {
+    if (this->unchanged) {
+      return {{"kind", "unchanged"}, {"resultId", resultId}};
+    }
+    std::vector<nlohmann::json> objs;
+    objs.reserve(this->items.size());
+    for (const auto &item : this->items) {
+      objs.push_back(item.toJson());
+    }
+    return {{"kind", "full"}, {"resultId", resultId}, {"items", objs}};
+  }
+};
+
+class WorkspaceDiagnosticReport : public BaseObject {
+public:
+  std::vector<std::pair<std::string /*URI*/, DocumentDiagnosticReport>> items;
+
+  [[nodiscard]] nlohmann::json toJson() const {
+    std::vector<nlohmann::json> objs;
+    objs.reserve(this->items.size());
+    for (const auto &[uri, report] : this->items) {
+      auto obj = report.toJson();
+      obj["uri"] = uri;
+      obj["version"] = nullptr;
+      objs.push_back(std::move(obj));
+    }
+    return {{"items", objs}};
+  }
+};
+
 enum class SymbolKind {
   VARIABLE_KIND = 13,
   STRING_KIND = 15,
@@ -537,6 +755,15 @@ public:
   [[nodiscard]] nlohmann::json toJson() const {
     return {{"uri", uri}, {"range", range.toJson()}};
   }
+
+  void writeJson(JsonWriter &writer) const {
+    writer.beginObject();
+    writer.key("range");
+    range.writeJson(writer);
+    writer.key("uri");
+    writer.string(uri);
+    writer.endObject();
+  }
 };
 
 class SymbolInformation : public BaseObject {
@@ -551,6 +778,17 @@ public:
   [[nodiscard]] nlohmann::json toJson() const {
     return {{"name", name}, {"kind", kind}, {"location", location.toJson()}};
   }
+
+  void writeJson(JsonWriter &writer) const {
+    writer.beginObject();
+    writer.key("kind");
+    writer.number((int)kind);
+    writer.key("location");
+    location.writeJson(writer);
+    writer.key("name");
+    writer.string(name);
+    writer.endObject();
+  }
 };
 
 class HoverParams : public BaseObject {
@@ -609,6 +847,15 @@ public:
   [[nodiscard]] nlohmann::json toJson() const {
     return {{"range", range.toJson()}, {"kind", kind}};
   }
+
+  void writeJson(JsonWriter &writer) const {
+    writer.beginObject();
+    writer.key("kind");
+    writer.number((int)kind);
+    writer.key("range");
+    range.writeJson(writer);
+    writer.endObject();
+  }
 };
 
 class RenameParams : public BaseObject {
@@ -718,6 +965,19 @@ public:
     };
   }
 
+  void writeJson(JsonWriter &writer) const {
+    writer.beginObject();
+    writer.key("insertTextFormat");
+    writer.number(2);
+    writer.key("kind");
+    writer.number((int)kind);
+    writer.key("label");
+    writer.string(label);
+    writer.key("textEdit");
+    textEdit.writeJson(writer);
+    writer.endObject();
+  }
+
   bool operator<(const CompletionItem &other) const {
     return this->label < other.label;
   }
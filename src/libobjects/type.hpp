@@ -145,84 +145,69 @@ class Dict : public Type {
 public:
   std::vector<std::shared_ptr<Type>> types;
 
+  // The name is built right away, as types in the TypeNamespace are shared
+  // by analyses running in parallel.
   explicit Dict(const std::vector<std::shared_ptr<Type>> &types)
       : Type("dict", TypeName::DICT), types(types) {
     const auto len = types.size();
     this->simple = false;
     if (len == 0) {
-      this->cached = true;
       this->cache = "dict()";
     } else if (len == 1) [[likely]] {
-      this->cached = true;
       this->cache = std::format("dict({})", types[0]->toString());
+    } else {
+      std::vector<std::string> names;
+      names.reserve(types.size());
+      for (const auto &element : types) {
+        names.push_back(element->toString());
+      }
+      std::ranges::sort(names);
+      this->cache = "dict(" + joinStrings(names, '|') + ")";
     }
   }
 
-  Dict() : Type("dict", TypeName::DICT), cache("dict()"), cached(true) {
+  Dict() : Type("dict", TypeName::DICT), cache("dict()") {
     this->simple = false;
   }
 
-  const std::string &toString() override {
-    if (this->cached) {
-      return this->cache;
-    }
-    std::vector<std::string> names;
-    names.reserve(types.size());
-    for (const auto &element : types) {
-      names.push_back(element->toString());
-    }
-
-    std::ranges::sort(names);
-    this->cache = "dict(" + joinStrings(names, '|') + ")";
-    this->cached = true;
-    return this->cache;
-  }
+  const std::string &toString() override { return this->cache; }
 
 private:
   std::string cache;
-  bool cached{false};
 };
 
 class List : public Type {
 public:
   std::vector<std::shared_ptr<Type>> types;
 
+  // See Dict
   explicit List(const std::vector<std::shared_ptr<Type>> &types)
       : Type("list", TypeName::LIST), types(types) {
     const auto len = types.size();
     this->simple = false;
     if (len == 0) {
-      this->cached = true;
       this->cache = "list()";
     } else if (len == 1) [[likely]] {
-      this->cached = true;
       this->cache = std::format("list({})", types[0]->toString());
+    } else {
+      std::vector<std::string> names;
+      names.reserve(types.size());
+      for (const auto &element : types) {
+        names.push_back(element->toString());
+      }
+      std::ranges::sort(names);
+      this->cache = std::format("list({})", joinStrings(names, '|'));
     }
   }
 
-  List() : Type("list", TypeName::LIST), cache("list()"), cached(true) {
+  List() : Type("list", TypeName::LIST), cache("list()") {
     this->simple = false;
   }
 
-  const std::string &toString() override {
-    if (this->cached) {
-      return this->cache;
-    }
-    std::vector<std::string> names;
-    names.reserve(types.size());
-    for (const auto &element : types) {
-      names.push_back(element->toString());
-    }
-
-    std::ranges::sort(names);
-    this->cache = std::format("list({})", joinStrings(names, '|'));
-    this->cached = true;
-    return this->cache;
-  }
+  const std::string &toString() override { return this->cache; }
 
 private:
   std::string cache;
-  bool cached{false};
 };
 
 class Subproject : public AbstractObject {
@@ -9,6 +9,9 @@
 #include <string>
 #include <vector>
 
+// Built once and never changed afterwards, so all lookups may run
+// concurrently, e.g. by workspaces analyzed in parallel. This includes the
+// types it hands out, which must not be modified either.
 class TypeNamespace {
 public:
   std::map<std::string, std::shared_ptr<Function>> functions;
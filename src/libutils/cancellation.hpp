@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+
+class CancelledException : public std::exception {
+public:
+  [[nodiscard]] const char *what() const noexcept override {
+    return "Operation was cancelled";
+  }
+};
+
+// Shared between whoever wants to cancel some work and the work itself,
+// which has to poll it at suitable points.
+class CancellationToken {
+public:
+  void cancel() { this->cancelled.store(true, std::memory_order_relaxed); }
+
+  [[nodiscard]] bool isCancelled() const {
+    return this->cancelled.load(std::memory_order_relaxed);
+  }
+
+  void throwIfCancelled() const {
+    if (this->isCancelled()) {
+      throw CancelledException();
+    }
+  }
+
+  static void check(const CancellationToken *token) {
+    if (token) {
+      token->throwIfCancelled();
+    }
+  }
+
+private:
+  std::atomic<bool> cancelled = false;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "stats.hpp"
+
+#include <exception>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Runs identical computations only once while they are in flight: whoever
+// asks for a key that is already being computed waits for that result
+// instead of computing it again. Nothing is cached once the computation is
+// done, so the key must identify the inputs, e.g. by including the version
+// of the document.
+template <typename T> class InFlight {
+public:
+  explicit InFlight(std::string_view method)
+      : stats(globalStats().methods.get(method)) {}
+
+  template <typename Func> T run(const std::string &key, const Func &compute) {
+    std::promise<T> promise;
+    std::shared_future<T> future;
+    bool owner = false;
+    {
+      std::scoped_lock const lock(this->mtx);
+      const auto &iter = this->running.find(key);
+      if (iter == this->running.end()) {
+        future = promise.get_future().share();
+        this->running.emplace(key, future);
+        owner = true;
+      } else {
+        future = iter->second;
+      }
+    }
+    if (!owner) {
+      this->stats.deduplicated.fetch_add(1, std::memory_order_relaxed);
+      // Copied, as every caller gets a result of its own
+      return future.get();
+    }
+    try {
+      promise.set_value(compute());
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+    }
+    {
+      std::scoped_lock const lock(this->mtx);
+      this->running.erase(key);
+    }
+    return future.get();
+  }
+
+private:
+  MethodStats &stats;
+  std::mutex mtx;
+  std::map<std::string, std::shared_future<T>> running;
+};
@@ -0,0 +1,408 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// The text of a document as pieces of immutable buffers, kept in a treap
+// ordered by their position in the text. Every edit takes O(log n) for n
+// pieces and returns a new table that shares all pieces and nodes it did not
+// touch with the old one. So a table is never modified after it was created,
+// and copying one to hand it to another thread is cheap.
+// Lines end with "\n", "\r\n" or "\r", as in LSP.
+class PieceTable {
+public:
+  PieceTable() = default;
+
+  explicit PieceTable(std::string text) {
+    if (!text.empty()) {
+      const auto length = text.size();
+      this->root = piece(makeBuffer(std::move(text)), 0, length,
+                         nextPriority(), nullptr, nullptr);
+    }
+  }
+
+  [[nodiscard]] size_t size() const { return totalLength(this->root); }
+
+  [[nodiscard]] size_t pieces() const { return countPieces(this->root.get()); }
+
+  // The byte offset of an LSP position, so `character` is in UTF-16 code
+  // units. Positions past the end of a line are clamped to its end, lines
+  // past the end of the text to the end of the text.
+  [[nodiscard]] size_t offsetOf(uint64_t line, uint64_t character) const {
+    const auto start = this->lineStart(line);
+    auto offset = start;
+    uint64_t units = 0;
+    this->forEachChunk(start, [&offset, &units,
+                               character](std::string_view chunk) {
+      for (const auto chr : chunk) {
+        const auto byte = (unsigned char)chr;
+        // Continuation bytes belong to the code point before
+        if ((byte & 0xC0) != 0x80) {
+          if (units >= character || chr == '\n' || chr == '\r') {
+            return false;
+          }
+          // Everything beyond the BMP takes a surrogate pair
+          units += byte >= 0xF0 ? 2 : 1;
+        }
+        offset++;
+      }
+      return true;
+    });
+    return offset;
+  }
+
+  // Replaces the bytes from `start` up to `end` with `text`. Small pieces
+  // next to the replaced bytes are copied into the new one, so typing one
+  // character after another does not leave a piece for each of them.
+  [[nodiscard]] PieceTable replace(size_t start, size_t end,
+                                   std::string text) const {
+    const auto clampedEnd = std::min(end, this->size());
+    const auto clampedStart = std::min(start, clampedEnd);
+    auto [before, rest] = split(this->root, clampedStart);
+    auto [_, after] = split(rest, clampedEnd - clampedStart);
+    const auto *last = lastPiece(before.get());
+    const auto *first = firstPiece(after.get());
+    const auto fits = [&text](const Node *node, size_t others) {
+      return node && node->length + text.size() + others <= COMPACT_LENGTH;
+    };
+    // Deleting only merges the pieces around it
+    const auto takeLast =
+        text.empty() ? fits(last, first ? first->length : COMPACT_LENGTH)
+                     : fits(last, 0);
+    const auto takeFirst =
+        text.empty() ? takeLast : fits(first, takeLast ? last->length : 0);
+    if (takeLast) {
+      text.insert(0, contentsOf(*last));
+      before = split(before, totalLength(before) - last->length).first;
+    }
+    if (takeFirst) {
+      text += contentsOf(*first);
+      after = split(after, first->length).second;
+    }
+    PieceTable ret;
+    if (text.empty()) {
+      ret.root = merge(before, after);
+      return ret;
+    }
+    const auto length = text.size();
+    auto inserted = piece(makeBuffer(std::move(text)), 0, length,
+                          nextPriority(), nullptr, nullptr);
+    ret.root = merge(merge(before, inserted), after);
+    return ret;
+  }
+
+  [[nodiscard]] std::string str() const {
+    std::string ret;
+    ret.reserve(this->size());
+    this->forEachChunk(0, [&ret](std::string_view chunk) {
+      ret += chunk;
+      return true;
+    });
+    return ret;
+  }
+
+private:
+  // Pieces up to this length are merged with the text replacing their
+  // neighbour.
+  constexpr static size_t COMPACT_LENGTH = 64;
+
+  struct Buffer {
+    std::string text;
+    // The offsets of all line breaks, i.e. of every '\r' and of every '\n'
+    // not directly after a '\r'.
+    std::vector<size_t> lineBreaks;
+  };
+
+  struct Node;
+  using NodePtr = std::shared_ptr<const Node>;
+
+  struct Node {
+    std::shared_ptr<const Buffer> buffer;
+    size_t start;
+    size_t length;
+    // Counting a '\n' at the start of the piece, even if the text before
+    // ends with '\r'.
+    size_t lineBreaks;
+    uint64_t priority;
+    NodePtr left;
+    NodePtr right;
+    // Of the whole subtree, which starts with `firstChar` and ends with
+    // `lastChar`. The line breaks again count a leading '\n'.
+    size_t totalLength;
+    size_t totalLineBreaks;
+    char firstChar;
+    char lastChar;
+  };
+
+  NodePtr root;
+
+  static std::shared_ptr<const Buffer> makeBuffer(std::string text) {
+    std::vector<size_t> lineBreaks;
+    for (size_t i = 0; i < text.size(); i++) {
+      if (text[i] == '\r' ||
+          (text[i] == '\n' && (i == 0 || text[i - 1] != '\r'))) {
+        lineBreaks.push_back(i);
+      }
+    }
+    return std::make_shared<const Buffer>(
+        Buffer{.text = std::move(text), .lineBreaks = std::move(lineBreaks)});
+  }
+
+  static size_t totalLength(const NodePtr &node) {
+    return node ? node->totalLength : 0;
+  }
+
+  // The line breaks of `node`, if it follows `prev`
+  static size_t lineBreaksAfter(const Node *node, char prev) {
+    if (!node) {
+      return 0;
+    }
+    return node->totalLineBreaks -
+           (prev == '\r' && node->firstChar == '\n' ? 1 : 0);
+  }
+
+  static size_t countPieces(const Node *node) {
+    return node ? countPieces(node->left.get()) + 1 +
+                      countPieces(node->right.get())
+                : 0;
+  }
+
+  static std::string_view contentsOf(const Node &node) {
+    return std::string_view(node.buffer->text).substr(node.start, node.length);
+  }
+
+  static const Node *firstPiece(const Node *node) {
+    while (node && node->left) {
+      node = node->left.get();
+    }
+    return node;
+  }
+
+  static const Node *lastPiece(const Node *node) {
+    while (node && node->right) {
+      node = node->right.get();
+    }
+    return node;
+  }
+
+  static uint64_t nextPriority() {
+    // splitmix64 of a counter, random enough to keep the treap balanced
+    static std::atomic<uint64_t> counter = 0;
+    auto val = counter.fetch_add(1, std::memory_order_relaxed) +
+               0x9E3779B97F4A7C15ULL;
+    val = (val ^ (val >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    val = (val ^ (val >> 27)) * 0x94D049BB133111EBULL;
+    return val ^ (val >> 31);
+  }
+
+  static NodePtr withChildren(const Node &node, NodePtr left, NodePtr right) {
+    const auto length = node.length + totalLength(left) + totalLength(right);
+    const auto &text = node.buffer->text;
+    const auto first = text[node.start];
+    const auto last = text[node.start + node.length - 1];
+    auto lineBreaks = lineBreaksAfter(left.get(), '\0') + node.lineBreaks +
+                      lineBreaksAfter(right.get(), last);
+    // A "\r\n" across two pieces is only one line break
+    if (left && left->lastChar == '\r' && first == '\n') {
+      lineBreaks--;
+    }
+    const auto firstChar = left ? left->firstChar : first;
+    const auto lastChar = right ? right->lastChar : last;
+    return std::make_shared<const Node>(
+        Node{.buffer = node.buffer,
+             .start = node.start,
+             .length = node.length,
+             .lineBreaks = node.lineBreaks,
+             .priority = node.priority,
+             .left = std::move(left),
+             .right = std::move(right),
+             .totalLength = length,
+             .totalLineBreaks = lineBreaks,
+             .firstChar = firstChar,
+             .lastChar = lastChar});
+  }
+
+  // The line breaks of a piece are looked up in those of its buffer, so
+  // cutting a piece in two does not have to count them again.
+  static NodePtr piece(std::shared_ptr<const Buffer> buffer, size_t start,
+                       size_t length, uint64_t priority, NodePtr left,
+                       NodePtr right) {
+    const auto &lineBreaks = buffer->lineBreaks;
+    auto lineBreaksOfPiece =
+        (size_t)(std::ranges::lower_bound(lineBreaks, start + length) -
+                 std::ranges::lower_bound(lineBreaks, start));
+    // Not in the buffer, as it follows a '\r' there
+    if (start > 0 && buffer->text[start - 1] == '\r' &&
+        buffer->text[start] == '\n') {
+      lineBreaksOfPiece++;
+    }
+    return withChildren(Node{.buffer = std::move(buffer),
+                             .start = start,
+                             .length = length,
+                             .lineBreaks = lineBreaksOfPiece,
+                             .priority = priority,
+                             .left = nullptr,
+                             .right = nullptr,
+                             .totalLength = 0,
+                             .totalLineBreaks = 0,
+                             .firstChar = '\0',
+                             .lastChar = '\0'},
+                        std::move(left), std::move(right));
+  }
+
+  // Splits into the first `offset` bytes and the rest. A piece containing
+  // the offset is cut in two.
+  static std::pair<NodePtr, NodePtr> split(const NodePtr &node,
+                                           size_t offset) {
+    if (!node) {
+      return {nullptr, nullptr};
+    }
+    const auto leftLength = totalLength(node->left);
+    if (offset <= leftLength) {
+      auto [left, right] = split(node->left, offset);
+      return {left, withChildren(*node, right, node->right)};
+    }
+    if (offset >= leftLength + node->length) {
+      auto [left, right] =
+          split(node->right, offset - leftLength - node->length);
+      return {withChildren(*node, node->left, left), right};
+    }
+    const auto inner = offset - leftLength;
+    return {piece(node->buffer, node->start, inner, node->priority,
+                  node->left, nullptr),
+            piece(node->buffer, node->start + inner, node->length - inner,
+                  node->priority, nullptr, node->right)};
+  }
+
+  static NodePtr merge(const NodePtr &left, const NodePtr &right) {
+    if (!left) {
+      return right;
+    }
+    if (!right) {
+      return left;
+    }
+    if (left->priority > right->priority) {
+      return withChildren(*left, left->left, merge(left->right, right));
+    }
+    return withChildren(*right, merge(left, right->left), right->right);
+  }
+
+  // The byte at `offset`, or '\0' past the end
+  [[nodiscard]] char charAt(size_t offset) const {
+    const auto *node = this->root.get();
+    while (node) {
+      const auto leftLength = totalLength(node->left);
+      if (offset < leftLength) {
+        node = node->left.get();
+        continue;
+      }
+      offset -= leftLength;
+      if (offset < node->length) {
+        return node->buffer->text[node->start + offset];
+      }
+      offset -= node->length;
+      node = node->right.get();
+    }
+    return '\0';
+  }
+
+  // The offset of the first byte of `line`, or the size, if there are less
+  // lines.
+  [[nodiscard]] size_t lineStart(uint64_t line) const {
+    if (line == 0) {
+      return 0;
+    }
+    const auto *node = this->root.get();
+    size_t offset = 0;
+    auto remaining = (size_t)line;
+    // The byte before the subtree of `node`
+    char prev = '\0';
+    while (node) {
+      const auto leftLineBreaks = lineBreaksAfter(node->left.get(), prev);
+      if (remaining <= leftLineBreaks) {
+        node = node->left.get();
+        continue;
+      }
+      remaining -= leftLineBreaks;
+      offset += totalLength(node->left);
+      if (node->left) {
+        prev = node->left->lastChar;
+      }
+      const auto &text = node->buffer->text;
+      // Ends the "\r\n" started by the piece before
+      const auto continues = text[node->start] == '\n' && prev == '\r';
+      const auto lineBreaks = node->lineBreaks - (continues ? 1 : 0);
+      if (remaining <= lineBreaks) {
+        return this->lineBreakInPiece(*node, offset, prev, remaining);
+      }
+      remaining -= lineBreaks;
+      offset += node->length;
+      prev = text[node->start + node->length - 1];
+      node = node->right.get();
+    }
+    return this->size();
+  }
+
+  // The offset of the first byte after the `nth` line break of `node`, which
+  // starts at `offset` and follows `prev`.
+  [[nodiscard]] size_t lineBreakInPiece(const Node &node, size_t offset,
+                                        char prev, size_t nth) const {
+    const auto &text = node.buffer->text;
+    const auto &lineBreaks = node.buffer->lineBreaks;
+    auto iter = std::ranges::lower_bound(lineBreaks, node.start);
+    if (text[node.start] == '\n') {
+      const auto inBuffer = iter != lineBreaks.end() && *iter == node.start;
+      if (prev != '\r' && !inBuffer && --nth == 0) {
+        return offset + 1;
+      }
+      if (prev == '\r' && inBuffer) {
+        iter++;
+      }
+    }
+    const auto at = *(iter + (std::ptrdiff_t)(nth - 1));
+    const auto ret = offset + (at - node.start) + 1;
+    if (text[at] != '\r') {
+      return ret;
+    }
+    // The '\n' of a "\r\n" belongs to the line break
+    const auto next =
+        at + 1 < node.start + node.length ? text[at + 1] : this->charAt(ret);
+    return next == '\n' ? ret + 1 : ret;
+  }
+
+  // Calls `func` with the text from `from` on, chunk by chunk, until it
+  // returns false.
+  template <typename Func>
+  void forEachChunk(size_t from, const Func &func) const {
+    visit(this->root.get(), from, func);
+  }
+
+  template <typename Func>
+  static bool visit(const Node *node, size_t from, const Func &func) {
+    if (!node) {
+      return true;
+    }
+    const auto leftLength = totalLength(node->left);
+    if (from < leftLength) {
+      if (!visit(node->left.get(), from, func)) {
+        return false;
+      }
+      from = leftLength;
+    }
+    const auto pieceFrom = from - leftLength;
+    if (pieceFrom < node->length &&
+        !func(contentsOf(*node).substr(pieceFrom))) {
+      return false;
+    }
+    return visit(node->right.get(),
+                 pieceFrom > node->length ? pieceFrom - node->length : 0,
+                 func);
+  }
+};
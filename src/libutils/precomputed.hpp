@@ -0,0 +1,81 @@
+#pragma once
+
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Results computed before anyone asked for them, e.g. right after a
+// document was opened. Only the result for the latest key of each document
+// is kept, so as with InFlight, the key must identify the inputs. Results
+// of older generations are dropped as soon as the generation advances, as
+// their keys can never be asked for again.
+template <typename T> class Precomputed {
+public:
+  explicit Precomputed(std::string_view method)
+      : stats(globalStats().methods.get(method)) {}
+
+  // `generation` is the one `key` was made in. Results that were computed
+  // while the generation advanced are already outdated and are dropped.
+  void put(const std::string &document, const std::string &key,
+           uint64_t generation, T value) {
+    std::scoped_lock const lock(this->mtx);
+    if (generation < this->generation) {
+      return;
+    }
+    this->results.insert_or_assign(
+        document,
+        Entry{.key = key, .generation = generation, .value = std::move(value)});
+  }
+
+  void advance(uint64_t generation) {
+    std::scoped_lock const lock(this->mtx);
+    this->generation = std::max(this->generation, generation);
+    std::erase_if(this->results, [this](const auto &pair) {
+      return pair.second.generation < this->generation;
+    });
+  }
+
+  [[nodiscard]] size_t size() {
+    std::scoped_lock const lock(this->mtx);
+    return this->results.size();
+  }
+
+  // Counts as a hit or a miss in the stats of the method.
+  std::optional<T> get(const std::string &document, const std::string &key) {
+    {
+      std::scoped_lock const lock(this->mtx);
+      const auto &iter = this->results.find(document);
+      if (iter != this->results.end() && iter->second.key == key) {
+        this->stats.precomputedHits.fetch_add(1, std::memory_order_relaxed);
+        return iter->second.value;
+      }
+    }
+    this->stats.precomputedMisses.fetch_add(1, std::memory_order_relaxed);
+    return std::nullopt;
+  }
+
+  void erase(const std::string &document) {
+    std::scoped_lock const lock(this->mtx);
+    this->results.erase(document);
+  }
+
+private:
+  struct Entry {
+    std::string key;
+    uint64_t generation;
+    T value;
+  };
+
+  MethodStats &stats;
+  std::mutex mtx;
+  uint64_t generation = 0;
+  std::map<std::string, Entry> results;
+};
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "polyfill.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Everything in here is recorded from hot paths, possibly from many threads
+// at once, so recording only ever does relaxed atomic operations.
+
+// A histogram of durations with logarithmic buckets: Four buckets per power
+// of two of microseconds, so percentiles are accurate to about 25%.
+class Histogram {
+public:
+  static constexpr size_t NUM_BUCKETS = 4 * 40;
+
+  void record(std::chrono::nanoseconds duration) {
+    const auto micros = (uint64_t)std::max(
+        std::chrono::duration_cast<std::chrono::microseconds>(duration)
+            .count(),
+        (int64_t)0);
+    this->buckets[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+    this->count.fetch_add(1, std::memory_order_relaxed);
+    this->sumMicros.fetch_add(micros, std::memory_order_relaxed);
+    auto max = this->maxMicros.load(std::memory_order_relaxed);
+    while (max < micros && !this->maxMicros.compare_exchange_weak(
+                               max, micros, std::memory_order_relaxed)) {
+    }
+  }
+
+  [[nodiscard]] uint64_t total() const {
+    return this->count.load(std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] uint64_t sum() const {
+    return this->sumMicros.load(std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] uint64_t max() const {
+    return this->maxMicros.load(std::memory_order_relaxed);
+  }
+
+  // The upper bound in microseconds of the bucket the given percentile
+  // (0-100) falls into.
+  [[nodiscard]] uint64_t percentile(double percent) const {
+    const auto numValues = this->total();
+    if (numValues == 0) {
+      return 0;
+    }
+    const auto target = std::max(
+        (uint64_t)((double)numValues * percent / 100.0 + 0.5), (uint64_t)1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+      seen += this->buckets[i].load(std::memory_order_relaxed);
+      if (seen >= target) {
+        return std::min(upperBound(i), this->max());
+      }
+    }
+    return this->max();
+  }
+
+  static size_t bucketFor(uint64_t micros) {
+    if (micros < 4) {
+      return (size_t)micros;
+    }
+    const auto exponent = (size_t)std::bit_width(micros) - 1;
+    const auto sub = (size_t)(micros >> (exponent - 2)) & 3;
+    return std::min(4 * (exponent - 1) + sub, NUM_BUCKETS - 1);
+  }
+
+  static uint64_t upperBound(size_t bucket) {
+    if (bucket < 4) {
+      return bucket;
+    }
+    const auto exponent = (bucket / 4) + 1;
+    const auto lower = (uint64_t)(4 + (bucket % 4)) << (exponent - 2);
+    return lower + ((uint64_t)1 << (exponent - 2)) - 1;
+  }
+
+private:
+  std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets{};
+  std::atomic<uint64_t> count = 0;
+  std::atomic<uint64_t> sumMicros = 0;
+  std::atomic<uint64_t> maxMicros = 0;
+};
+
+struct MethodStats {
+  // From the moment the message was read until a worker picked it up
+  Histogram queueWait;
+  // How long the handler took
+  Histogram latency;
+  // Requests that joined an identical one that was already running
+  std::atomic<uint64_t> deduplicated = 0;
+  // Requests answered from a result computed ahead of time, and those that
+  // could have been, but found none
+  std::atomic<uint64_t> precomputedHits = 0;
+  std::atomic<uint64_t> precomputedMisses = 0;
+};
+
+// Maps method names to their stats without locking: Slots are claimed with
+// a compare-and-swap and never given up again. Once all slots are taken,
+// everything else is counted under "<other>".
+class MethodTable {
+public:
+  static constexpr size_t CAPACITY = 128;
+
+  MethodStats &get(std::string_view method) {
+    const auto start = std::hash<std::string_view>{}(method) % CAPACITY;
+    for (size_t i = 0; i < CAPACITY; i++) {
+      auto &slot = this->slots[(start + i) % CAPACITY];
+      auto state = slot.state.load(std::memory_order_acquire);
+      if (state == EMPTY) {
+        if (slot.state.compare_exchange_strong(state, CLAIMED,
+                                               std::memory_order_acquire)) {
+          slot.name = method;
+          slot.state.store(READY, std::memory_order_release);
+          return slot.stats;
+        }
+      }
+      // Someone else is just now writing the name of this slot
+      while (state == CLAIMED) {
+        state = slot.state.load(std::memory_order_acquire);
+      }
+      if (slot.name == method) {
+        return slot.stats;
+      }
+    }
+    return this->other;
+  }
+
+  void forEach(
+      const std::function<void(std::string_view, const MethodStats &)> &func)
+      const {
+    for (const auto &slot : this->slots) {
+      if (slot.state.load(std::memory_order_acquire) == READY) {
+        func(slot.name, slot.stats);
+      }
+    }
+    if (this->other.latency.total() != 0) {
+      func("<other>", this->other);
+    }
+  }
+
+private:
+  static constexpr int EMPTY = 0;
+  static constexpr int CLAIMED = 1;
+  static constexpr int READY = 2;
+
+  struct Slot {
+    std::atomic<int> state = EMPTY;
+    std::string name;
+    MethodStats stats;
+  };
+
+  std::array<Slot, CAPACITY> slots{};
+  MethodStats other;
+};
+
+struct Stats {
+  MethodTable methods;
+  Histogram partialParse;
+  Histogram fullParse;
+  std::atomic<uint64_t> savedTreesHits = 0;
+  std::atomic<uint64_t> savedTreesMisses = 0;
+  // Files whose tokens or tree were taken over from an earlier parse
+  std::atomic<uint64_t> parseCacheHits = 0;
+  std::atomic<uint64_t> parseCacheMisses = 0;
+  // Misses parsed by editing the tree of the previous contents
+  std::atomic<uint64_t> incrementalParses = 0;
+  // Edits replaced by a later one before they were analyzed
+  std::atomic<uint64_t> coalescedEdits = 0;
+  std::atomic<uint64_t> bytesRead = 0;
+  std::atomic<uint64_t> bytesWritten = 0;
+
+  [[nodiscard]] std::string summary() const {
+    std::string ret;
+    const auto appendHistogram = [&ret](std::string_view name,
+                                        const Histogram &histogram) {
+      ret += std::format("{}: n={} p50={}us p95={}us p99={}us max={}us\n",
+                         name, histogram.total(), histogram.percentile(50),
+                         histogram.percentile(95), histogram.percentile(99),
+                         histogram.max());
+    };
+    this->methods.forEach([&ret, &appendHistogram](std::string_view name,
+                                                   const MethodStats &stats) {
+      appendHistogram(std::format("{} (latency)", name), stats.latency);
+      appendHistogram(std::format("{} (queue wait)", name), stats.queueWait);
+      const auto deduplicated =
+          stats.deduplicated.load(std::memory_order_relaxed);
+      if (deduplicated != 0) {
+        ret += std::format("{}: deduplicated={}\n", name, deduplicated);
+      }
+      const auto hits = stats.precomputedHits.load(std::memory_order_relaxed);
+      const auto misses =
+          stats.precomputedMisses.load(std::memory_order_relaxed);
+      if (hits + misses != 0) {
+        ret += std::format("{}: precomputed hits={} misses={}\n", name, hits,
+                           misses);
+      }
+    });
+    appendHistogram("partialParse", this->partialParse);
+    appendHistogram("fullParse", this->fullParse);
+    ret += std::format(
+        "savedTrees: hits={} misses={}\n"
+        "parseCache: hits={} misses={} incremental={}\n"
+        "coalescedEdits: {}\nbytes: read={} written={}",
+        this->savedTreesHits.load(std::memory_order_relaxed),
+        this->savedTreesMisses.load(std::memory_order_relaxed),
+        this->parseCacheHits.load(std::memory_order_relaxed),
+        this->parseCacheMisses.load(std::memory_order_relaxed),
+        this->incrementalParses.load(std::memory_order_relaxed),
+        this->coalescedEdits.load(std::memory_order_relaxed),
+        this->bytesRead.load(std::memory_order_relaxed),
+        this->bytesWritten.load(std::memory_order_relaxed));
+    return ret;
+  }
+};
+
+inline Stats &globalStats() {
+  static Stats stats;
+  return stats;
+}
+
+// Records the time from construction to destruction into `histogram`.
+class ScopedTimer {
+public:
+  explicit ScopedTimer(Histogram &histogram) : histogram(histogram) {}
+  ~ScopedTimer() {
+    this->histogram.record(std::chrono::steady_clock::now() - this->start);
+  }
+
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+  Histogram &histogram;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+};
@@ -67,7 +67,7 @@ void Linter::writeMuonConfigFile() {
 }
 
 void Linter::printDiagnostics() const {
-  const auto &metadata = tree.metadata;
+  const auto &metadata = *tree.metadata;
   const auto &keyview = std::views::keys(metadata.diagnostics);
   std::vector<std::filesystem::path> keys{keyview.begin(), keyview.end()};
   std::ranges::sort(keys);
@@ -154,7 +154,7 @@ void Linter::lintFormattingTracked() {
 bool Linter::lintCode() {
   this->tree.useCustomParser = true;
   tree.partialParse(this->config.linting.options);
-  const auto &metadata = tree.metadata;
+  const auto &metadata = *tree.metadata;
   const auto &keyview = std::views::keys(metadata.diagnostics);
   uint32_t numErrors = 0;
   for (const auto &file : keyview) {
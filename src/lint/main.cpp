@@ -1,14 +1,25 @@
+#include "langserverutils.hpp"
 #include "linter.hpp"
 #include "lintingconfig.hpp"
+#include "lsptypes.hpp"
 #include "polyfill.hpp"
+#ifndef _WIN32
+#include "unixsocket.hpp"
+#endif
 #include "vcs_version.h"
 
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
 #include <filesystem>
 #include <iostream>
+#include <nlohmann/json.hpp>
+#include <string>
 #include <sys/types.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #ifdef USE_MIMALLOC
 #include <mimalloc.h>
 #endif
@@ -32,6 +43,12 @@ void printHelp() {
   std::cerr << "OPTIONS:" << std::endl;
   std::cerr << "--fix        \tFix errors automatically (If possible)"
             << std::endl;
+#ifndef _WIN32
+  std::cerr << "--connect    \tCheck the code using a running `mesonlsp "
+               "--daemon` (Skips formatting)"
+            << std::endl;
+  std::cerr << "--socket <path>\tThe socket of the daemon" << std::endl;
+#endif
   std::cerr << "--version    \tPrint version" << std::endl;
   std::cerr << "--help       \tPrint this help" << std::endl;
 }
@@ -50,6 +67,57 @@ void printVersion() {
 #endif
 }
 
+#ifndef _WIN32
+// The daemon already has a warm TypeNamespace and pkg-config cache, so
+// this is a lot faster than doing everything in this process.
+int lintWithDaemon(const MesonLintConfig &config,
+                   const std::filesystem::path &root,
+                   const std::filesystem::path &socketPath) {
+  nlohmann::json result;
+  try {
+    const auto fd = jsonrpc::connectUnix(socketPath);
+    try {
+      result = jsonrpc::request(
+          fd, "mesonlsp/diagnostics",
+          {{"rootUri", pathToUrl(std::filesystem::absolute(root))}});
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+    close(fd);
+  } catch (const std::exception &exc) {
+    std::cerr << std::format("Failed to query daemon: {}", exc.what())
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  uint32_t numErrors = 0;
+  for (auto &file : result) {
+    const auto &path = extractPathFromUrl(file["uri"]);
+    const auto &relative =
+        std::filesystem::relative(path, std::filesystem::absolute(root))
+            .generic_string();
+    for (auto &diag : file["diagnostics"]) {
+      const auto isError =
+          diag["severity"] == (int)DiagnosticSeverity::LSP_ERROR ||
+          config.linting.werror;
+      if (isError) {
+        numErrors++;
+      }
+      const auto *icon = isError ? "🔴" : "⚠️";
+      const LSPPosition start(diag["range"]["start"]);
+      std::cerr << relative << "[" << start.line + 1 << ":" << start.character
+                << "] " << icon << "  "
+                << diag["message"].get<std::string>() << std::endl;
+    }
+  }
+  if (numErrors == 0) {
+    std::cout << "No linting errors found ✨ 🍰 ✨" << std::endl;
+    return EXIT_SUCCESS;
+  }
+  return EXIT_FAILURE;
+}
+#endif
+
 int main(int argc, char **argv) {
   struct arena arena;
   struct arena a_scratch;
@@ -79,6 +147,8 @@ int main(int argc, char **argv) {
   bool version = false;
   bool error = false;
   bool fix = false;
+  bool connect = false;
+  std::string socketPath;
   std::string path;
   unsigned int numPaths = 0;
   for (int i = 1; i < argc; i++) {
@@ -94,6 +164,22 @@ int main(int argc, char **argv) {
       fix = true;
       continue;
     }
+#ifndef _WIN32
+    if (strcmp("--connect", argv[i]) == 0) {
+      connect = true;
+      continue;
+    }
+    if (strcmp("--socket", argv[i]) == 0) {
+      if (i + 1 == argc) {
+        std::cerr << "Missing value for --socket <path>" << std::endl;
+        error = true;
+        break;
+      }
+      socketPath = argv[i + 1];
+      i++;
+      continue;
+    }
+#endif
     if (strncmp(argv[i], "--", 2) == 0) {
       std::cerr << "Unknown option: " << argv[i] << std::endl;
       error = true;
@@ -149,6 +235,16 @@ int main(int argc, char **argv) {
     ar_destroy(&a_scratch);
     return EXIT_FAILURE;
   }
+#ifndef _WIN32
+  if (connect) {
+    ar_destroy(&arena);
+    ar_destroy(&a_scratch);
+    return lintWithDaemon(config, root,
+                          socketPath.empty()
+                              ? jsonrpc::defaultSocketPath()
+                              : std::filesystem::path(socketPath));
+  }
+#endif
   Linter linter{config, root, &wk};
   auto result = linter.lint() ? EXIT_SUCCESS : EXIT_FAILURE;
   if (fix) {
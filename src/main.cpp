@@ -1,19 +1,29 @@
 #include "analysisoptions.hpp"
+#ifndef _WIN32
+#include "daemon.hpp"
+#endif
 #include "jsonrpc.hpp"
 #include "langserver.hpp"
 #include "libwrap/wrap.hpp"
 #include "mesonmetadata.hpp"
 #include "mesontree.hpp"
 #include "polyfill.hpp"
+#include "sharedstate.hpp"
+#include "statslogger.hpp"
 #include "typenamespace.hpp"
+#ifndef _WIN32
+#include "unixsocket.hpp"
+#endif
 #include "vcs_version.h"
 
 #include <algorithm>
 #include <csignal>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
 #include <cxxabi.h>
 #include <dlfcn.h>
+#include <exception>
 #include <filesystem>
 #include <iostream>
 #include <locale>
@@ -26,6 +36,8 @@
 #include <fcntl.h>
 #include <io.h>
 #include <stdio.h>
+#else
+#include <unistd.h>
 #endif
 
 #ifdef USE_MIMALLOC
@@ -35,6 +47,8 @@
 #include <jemalloc/jemalloc.h>
 #endif
 
+constexpr size_t INTERACTIVE_WORKERS = 1;
+
 __attribute__((noinline, noreturn)) void f4() {
   throw std::runtime_error("test");
 }
@@ -70,6 +84,17 @@ void printHelp() {
       << std::endl;
   std::cerr << "--lsp        \t\t\tStart language server using stdio"
             << std::endl;
+#ifndef _WIN32
+  std::cerr << "--daemon     \t\t\tServe any number of language server "
+               "sessions on a unix socket"
+            << std::endl;
+  std::cerr << "--connect    \t\t\tStart language server using stdio, backed "
+               "by a running daemon"
+            << std::endl;
+  std::cerr << "--socket <path>\t\t\tThe socket of the daemon (default: "
+            << jsonrpc::defaultSocketPath().generic_string() << ")"
+            << std::endl;
+#endif
   std::cerr << "--wrap <wrapFile>\t\tExtract and parse this wrap file"
             << std::endl;
   std::cerr << "--wrap-output <dir>\t\tSet the directory into that the given "
@@ -111,13 +136,52 @@ void startLanguageServer() {
     throw std::runtime_error("Cannot set stdout mode to _O_BINARY");
   }
 #endif
+  // Without this std::cin is unbuffered and the JSON-RPC reader would have
+  // to fetch every byte on its own.
+  std::ios_base::sync_with_stdio(false);
   auto handler = std::make_shared<LanguageServer>();
-  auto server = std::make_shared<jsonrpc::JsonRpcServer>();
+  // Workers kept free for completion, hover etc., so these never wait
+  // behind a reparse.
+  auto server = std::make_shared<jsonrpc::JsonRpcServer>(
+      jsonrpc::defaultNumWorkers(), jsonrpc::DEFAULT_QUEUE_CAPACITY,
+      INTERACTIVE_WORKERS);
   handler->server = server;
+  const StatsLogger statsLogger;
   server->loop(handler);
   server->wait();
 }
 
+#ifndef _WIN32
+int startDaemon(const std::filesystem::path &socketPath) {
+  int listenFd = -1;
+  try {
+    listenFd = jsonrpc::listenUnix(socketPath);
+  } catch (const std::exception &exc) {
+    std::cerr << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  // A client disconnecting must only end its own session
+  (void)signal(SIGPIPE, SIG_IGN);
+  Daemon daemon(std::make_shared<SharedState>(), INTERACTIVE_WORKERS);
+  daemon.run(listenFd);
+  close(listenFd);
+  return EXIT_FAILURE;
+}
+
+int connectToDaemon(const std::filesystem::path &socketPath) {
+  int socketFd = -1;
+  try {
+    socketFd = jsonrpc::connectUnix(socketPath);
+  } catch (const std::exception &exc) {
+    std::cerr << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  jsonrpc::proxy(STDIN_FILENO, STDOUT_FILENO, socketFd);
+  close(socketFd);
+  return EXIT_SUCCESS;
+}
+#endif
+
 int parseWraps(const std::vector<std::string> &wraps, const std::string &output,
                const std::string &packageFiles) {
   if (output.empty()) {
@@ -156,7 +220,7 @@ int parseWraps(const std::vector<std::string> &wraps, const std::string &output,
 void printDiagnostics(const MesonTree &tree) {
   const auto &projects = tree.flatten();
   for (const auto &proj : projects) {
-    const auto &metadata = proj->metadata;
+    const auto &metadata = *proj->metadata;
     if (metadata.diagnostics.empty()) {
       continue;
     }
@@ -169,7 +233,7 @@ void printDiagnostics(const MesonTree &tree) {
     for (const auto &file : keys) {
       const auto &relative =
           std::filesystem::relative(file, proj->root).generic_string();
-      const auto &diags = proj->metadata.diagnostics.at(file);
+      const auto &diags = proj->metadata->diagnostics.at(file);
       for (const auto &diag : diags) {
         const auto *icon = diag.severity == Severity::ERROR ? "🔴" : "⚠️";
         std::cerr << relative << "[" << diag.startLine + 1 << ":"
@@ -208,6 +272,9 @@ int main(int argc, char **argv) {
   bool version = false;
   bool error = false;
   bool full = false;
+  bool daemon = false;
+  bool connect = false;
+  std::string socketPath;
   for (int i = 1; i < argc; i++) {
     if (strcmp("--crash-test", argv[i]) == 0) {
       g1();
@@ -217,6 +284,26 @@ int main(int argc, char **argv) {
       lsp = true;
       continue;
     }
+#ifndef _WIN32
+    if (strcmp("--daemon", argv[i]) == 0) {
+      daemon = true;
+      continue;
+    }
+    if (strcmp("--connect", argv[i]) == 0) {
+      connect = true;
+      continue;
+    }
+    if (strcmp("--socket", argv[i]) == 0) {
+      if (i + 1 == argc) {
+        std::cerr << "Error: Missing value for --socket <path>" << std::endl;
+        error = true;
+        break;
+      }
+      socketPath = std::string(argv[i + 1]);
+      i++;
+      continue;
+    }
+#endif
     if (strcmp("--full", argv[i]) == 0) {
       full = true;
       continue;
@@ -289,6 +376,14 @@ int main(int argc, char **argv) {
     printVersion();
     return EXIT_SUCCESS;
   }
+#ifndef _WIN32
+  if (daemon || connect) {
+    const auto &socket = socketPath.empty()
+                             ? jsonrpc::defaultSocketPath()
+                             : std::filesystem::path(socketPath);
+    return daemon ? startDaemon(socket) : connectToDaemon(socket);
+  }
+#endif
   if (lsp) {
     startLanguageServer();
     return EXIT_SUCCESS;
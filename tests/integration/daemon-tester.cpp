@@ -0,0 +1,216 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include "daemon.hpp"
+#include "langserverutils.hpp"
+#include "log.hpp"
+#include "nlohmann/json.hpp"
+#include "sharedstate.hpp"
+#include "unixsocket.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct SessionResult {
+  nlohmann::json diagnostics;
+  uint64_t hits;
+  uint64_t misses;
+};
+
+// Connects a new client to the daemon, asks it for the diagnostics of the
+// project and for the parse cache statistics afterwards.
+static SessionResult runSession(Daemon &daemon, const std::string &rootUri) {
+  int fds[2];
+  assert(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+  std::thread session(&Daemon::serve, &daemon, fds[1]);
+  SessionResult ret;
+  ret.diagnostics =
+      jsonrpc::request(fds[0], "mesonlsp/diagnostics", {{"rootUri", rootUri}});
+  const auto stats = jsonrpc::request(fds[0], "mesonlsp/stats", {});
+  ret.hits = stats["parseCache"]["hits"].get<uint64_t>();
+  ret.misses = stats["parseCache"]["misses"].get<uint64_t>();
+  ::close(fds[0]);
+  session.join();
+  return ret;
+}
+
+static void send(std::ostream &output, const nlohmann::json &message) {
+  const auto &payload = message.dump();
+  output << std::format("Content-Length: {}\r\n\r\n{}", payload.size(),
+                        payload);
+  output.flush();
+}
+
+static void notify(std::ostream &output, const std::string &method,
+                   const nlohmann::json &params) {
+  send(output, {{"jsonrpc", "2.0"}, {"method", method}, {"params", params}});
+}
+
+static std::optional<nlohmann::json> receive(std::istream &input) {
+  constexpr std::string_view PREFIX = "Content-Length: ";
+  size_t contentLength = 0;
+  std::string line;
+  while (std::getline(input, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      std::string body(contentLength, '\0');
+      input.read(body.data(), (std::streamsize)contentLength);
+      return nlohmann::json::parse(body);
+    }
+    if (line.starts_with(PREFIX)) {
+      std::from_chars(line.data() + PREFIX.size(), line.data() + line.size(),
+                      contentLength);
+    }
+  }
+  return std::nullopt;
+}
+
+// Talks to the daemon like an editor would. Returns the number of
+// textDocument/publishDiagnostics notifications the session sent in total.
+static size_t runEditorSession(Daemon &daemon,
+                               const std::filesystem::path &toParse) {
+  int fds[2];
+  assert(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+  std::thread session(&Daemon::serve, &daemon, fds[1]);
+  jsonrpc::FdStreamBuf buffer(fds[0]);
+  std::istream input(&buffer);
+  std::ostream output(&buffer);
+  size_t published = 0;
+  const auto isPublished = [](const nlohmann::json &message) {
+    return message.value("method", "") == "textDocument/publishDiagnostics";
+  };
+  // Reads everything up to the first message matching `until`
+  const auto receiveUntil =
+      [&input, &published, &isPublished](
+          const std::function<bool(const nlohmann::json &)> &until) {
+        while (auto message = receive(input)) {
+          if (isPublished(*message)) {
+            published++;
+          }
+          if (until(*message)) {
+            return std::move(*message);
+          }
+        }
+        assert(false);
+        return nlohmann::json();
+      };
+  // Only the root file has diagnostics
+  const auto publishedFor = [&isPublished](size_t count) {
+    return [&isPublished, count](const nlohmann::json &message) {
+      return isPublished(message) &&
+             message["params"]["diagnostics"].size() == count;
+    };
+  };
+  const auto replyTo = [](int id) {
+    return [id](const nlohmann::json &message) {
+      return message.contains("id") && message["id"] == id &&
+             !message.contains("method");
+    };
+  };
+
+  send(output,
+       {{"jsonrpc", "2.0"},
+        {"id", 1},
+        {"method", "initialize"},
+        {"params",
+         {{"capabilities", nlohmann::json::object()},
+          {"workspaceFolders",
+           {{{"uri", pathToUrl(toParse.parent_path())},
+             {"name", "root"}}}}}}});
+  receiveUntil(replyTo(1));
+  notify(output, "initialized", nlohmann::json::object());
+  // The one warning of the project
+  receiveUntil(publishedFor(1));
+  const auto uri = pathToUrl(std::filesystem::absolute(toParse));
+  const auto contents = readFile(toParse);
+  notify(output, "textDocument/didOpen",
+         {{"textDocument",
+           {{"uri", uri},
+            {"languageId", "meson"},
+            {"version", 1},
+            {"text", contents}}}});
+  // Changes nothing, so nothing must be published for it
+  notify(output, "textDocument/didChange",
+         {{"textDocument", {{"uri", uri}, {"version", 2}}},
+          {"contentChanges", {{{"text", contents}}}}});
+  // Adds a lint to the root file, the one in the subdir stays unchanged
+  const auto &edited = contents + "\nfooBar = 1\nmessage(fooBar)\n";
+  notify(output, "textDocument/didChange",
+         {{"textDocument", {{"uri", uri}, {"version", 3}}},
+          {"contentChanges", {{{"text", edited}}}}});
+  notify(output, "textDocument/didSave",
+         {{"textDocument", {{"uri", uri}}}});
+  receiveUntil(publishedFor(2));
+  // Clients may skip versions, the ranged change still applies to the text
+  // of version 3.
+  const auto end = std::ranges::count(edited, '\n');
+  const nlohmann::json position = {{"line", end}, {"character", 0}};
+  notify(output, "textDocument/didChange",
+         {{"textDocument", {{"uri", uri}, {"version", 5}}},
+          {"contentChanges",
+           {{{"range", {{"start", position}, {"end", position}}},
+             {"text", "barBaz = 1\nmessage(barBaz)\n"}}}}});
+  notify(output, "textDocument/didSave",
+         {{"textDocument", {{"uri", uri}}}});
+  const auto &lints = receiveUntil(isPublished);
+  assert(lints["params"]["diagnostics"].size() == 3);
+  send(output, {{"jsonrpc", "2.0"},
+                {"id", 2},
+                {"method", "shutdown"},
+                {"params", nullptr}});
+  receiveUntil(replyTo(2));
+  notify(output, "exit", nullptr);
+  // The session closes the socket once it ended
+  while (receive(input)) {
+  }
+  ::close(fds[0]);
+  session.join();
+  return published;
+}
+
+int main(int /*argc*/, char **argv) {
+  Logger const logger("daemon-tester");
+  std::filesystem::path const toParse = argv[1];
+  const auto rootUri = pathToUrl(toParse.parent_path());
+  Daemon daemon(std::make_shared<SharedState>());
+
+  const auto first = runSession(daemon, rootUri);
+  assert(first.diagnostics.size() == 1);
+  assert(first.misses > 0);
+  logger.info(std::format("First session: hits={} misses={}", first.hits,
+                          first.misses));
+
+  // Nothing changed on disk, so the second session must get every file
+  // from the cache of the first one.
+  const auto second = runSession(daemon, rootUri);
+  assert(second.diagnostics == first.diagnostics);
+  assert(second.misses == first.misses);
+  assert(second.hits > first.hits);
+  logger.info(std::format("Second session: hits={} misses={}", second.hits,
+                          second.misses));
+
+  // Only diagnostics that changed are sent to the editor: The first
+  // analysis and the ones of the two lints, all only for the root file.
+  const auto published = runEditorSession(daemon, toParse);
+  logger.info(std::format("Published diagnostics: {}", published));
+  assert(published == 3);
+}
@@ -7,12 +7,28 @@
 #include "log.hpp"
 #include "lsptypes.hpp"
 #include "nlohmann/json.hpp"
+#include "piecetable.hpp"
+#include "publisheddiagnostics.hpp"
+#include "stats.hpp"
 #include "typenamespace.hpp"
+#include "utils.hpp"
 #include "workspace.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
 #include <filesystem>
+#include <latch>
+#include <map>
 #include <string>
+#include <thread>
+#include <vector>
+
+constexpr auto MAX_READ_LATENCY = std::chrono::milliseconds(250);
+constexpr auto EDIT_DEBOUNCE = std::chrono::milliseconds(200);
+constexpr auto KEYSTROKE_INTERVAL = std::chrono::milliseconds(10);
 
 int main(int /*argc*/, char **argv) {
   Logger const logger("workspace-tester");
@@ -34,6 +50,10 @@ int main(int /*argc*/, char **argv) {
   assert(diag.message ==
          "Meson version 0.21.0 is requested, but meson.project_build_root() is "
          "only available since 0.56.0");
+  // Pulled for a single file
+  const auto pulled = workspace.diagnostics(diags.begin()->first);
+  assert(pulled.size() == 1);
+  assert(pulled[0].message == diag.message);
   auto gotoDefinition = workspace.jumpTo(diags.begin()->first, {9, 8});
   assert(gotoDefinition.size() == 1);
   assert(gotoDefinition[0].range.start.line == 4);
@@ -52,6 +72,14 @@ int main(int /*argc*/, char **argv) {
   assert(gotoDefinition[0].range.start.character == 0);
   gotoDefinition = workspace.jumpTo(diags.begin()->first, {0, 31});
   assert(gotoDefinition.empty());
+  // `x` is not the first identifier of the file
+  const auto highlights = workspace.highlight(diags.begin()->first, {9, 8});
+  assert(highlights.size() == 3);
+  assert(std::ranges::count_if(highlights, [](const auto &highlight) {
+           return highlight.kind == DocumentHighlightKind::WRITE_KIND;
+         }) == 2);
+  assert(highlights.back().range.start.line == 9);
+  assert(highlights.back().range.start.character == 8);
   nlohmann::json renameJsonParams;
   renameJsonParams["textDocument"] = {{"uri", diags.begin()->first}};
   renameJsonParams["newName"] = "foo123";
@@ -73,5 +101,205 @@ int main(int /*argc*/, char **argv) {
   renameEdit =
       workspace.rename(diags.begin()->first, RenameParams(renameJsonParams));
   assert(!renameEdit.has_value());
+  // Requests are answered from the last snapshot, while the next analysis
+  // is still running.
+  const std::filesystem::path mesonBuild = diags.begin()->first;
+  assert(workspace.owns(mesonBuild.parent_path() / "subdir" / ".." /
+                        "meson.build"));
+  assert(!workspace.owns(mesonBuild.parent_path() / "missing" / "meson.build"));
+  assert(isWithin("/ws/foo/meson.build", "/ws/foo"));
+  assert(isWithin("/ws/foo", "/ws/foo/"));
+  assert(isWithin("/ws/foo/sub/../meson.build", "/ws/foo"));
+  assert(!isWithin("/ws/foobar/meson.build", "/ws/foo"));
+  assert(!isWithin("/ws/foo/../bar/meson.build", "/ws/foo"));
+  // The analysis is held right after the subtree was cleared, until all
+  // reads are done.
+  std::latch analysisStarted(1);
+  std::latch readsDone(1);
+  std::atomic<bool> analyzed = false;
+  workspace.onAnalysis = [&analysisStarted, &readsDone]() {
+    analysisStarted.count_down();
+    readsDone.wait();
+  };
+  workspace.patchFile(
+      mesonBuild, readFile(mesonBuild) + "\nfoo123 = 1\n",
+      [&analyzed](
+          const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+              & /*diags*/) { analyzed = true; });
+  analysisStarted.wait();
+  assert(workspace.running);
+  auto maxLatency = std::chrono::nanoseconds(0);
+  for (int i = 0; i < 100; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    assert(workspace.owns(mesonBuild));
+    assert(workspace.jumpTo(mesonBuild, {9, 8}).size() == 1);
+    assert(!workspace.semanticTokens(mesonBuild).empty());
+    const auto latency = std::chrono::steady_clock::now() - start;
+    maxLatency = std::max(
+        maxLatency,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(latency));
+  }
+  assert(!analyzed);
+  assert(maxLatency < MAX_READ_LATENCY);
+  // Still the old snapshot
+  assert(std::ranges::none_of(workspace.documentSymbols(mesonBuild),
+                              [](const auto &symbol) {
+                                return symbol.name == "foo123";
+                              }));
+  readsDone.count_down();
+  workspace.futures.at(workspace.name).wait();
+  workspace.onAnalysis = nullptr;
+  assert(analyzed);
+  assert(std::ranges::any_of(workspace.documentSymbols(mesonBuild),
+                             [](const auto &symbol) {
+                               return symbol.name == "foo123";
+                             }));
+  // A burst of typing is analyzed once it settled
+  options.editDebounce = EDIT_DEBOUNCE;
+  const auto analysesBefore = workspace.analyses.load();
+  std::atomic<int> published = 0;
+  auto contents = readFile(mesonBuild) + "\nbar = '";
+  // Typed as the client sends it, one ranged change at a time
+  PieceTable document(contents);
+  for (const auto chr : std::string("typed'")) {
+    contents.push_back(chr);
+    const auto end = document.offsetOf(std::ranges::count(contents, '\n'),
+                                       contents.size());
+    document = document.replace(end, end, std::string(1, chr));
+    workspace.edit(
+        mesonBuild, document,
+        [&published](
+            const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+                & /*diags*/) { published++; });
+    std::this_thread::sleep_for(KEYSTROKE_INTERVAL);
+  }
+  assert(document.str() == contents);
+  assert(workspace.analyses == analysesBefore);
+  while (published == 0) {
+    std::this_thread::sleep_for(KEYSTROKE_INTERVAL);
+  }
+  std::this_thread::sleep_for(2 * EDIT_DEBOUNCE);
+  logger.info(std::format("Analyses for 6 keystrokes: {}",
+                          workspace.analyses - analysesBefore));
+  assert(workspace.analyses == analysesBefore + 1);
+  assert(published == 1);
+  assert(std::ranges::any_of(
+      workspace.documentSymbols(mesonBuild),
+      [](const auto &symbol) { return symbol.name == "bar"; }));
+  // Unless a flush is requested
+  options.editDebounce = std::chrono::hours(1);
+  workspace.edit(
+      mesonBuild, PieceTable(contents + "\n"),
+      [&published](
+          const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+              & /*diags*/) { published++; });
+  workspace.flushEdits();
+  while (published == 1) {
+    std::this_thread::sleep_for(KEYSTROKE_INTERVAL);
+  }
+  assert(workspace.analyses == analysesBefore + 2);
+  // Edits of several files of one subtree are analyzed together
+  const auto subdirBuild = mesonBuild.parent_path() / "subdir" / "meson.build";
+  std::atomic<bool> batchPublished = false;
+  const auto batchCallback =
+      [&batchPublished](
+          const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+              & /*diags*/) { batchPublished = true; };
+  workspace.edit(subdirBuild, PieceTable(readFile(subdirBuild)),
+                 batchCallback);
+  workspace.edit(mesonBuild, PieceTable(contents + "\n\n"), batchCallback);
+  workspace.flushEdits();
+  while (!batchPublished) {
+    std::this_thread::sleep_for(KEYSTROKE_INTERVAL);
+  }
+  workspace.futures.at(workspace.name).wait();
+  assert(workspace.analyses == analysesBefore + 3);
+
+  // Only options changing how files are parsed need a full parse
+  auto changed = options;
+  changed.disableInlayHints = !changed.disableInlayHints;
+  changed.editDebounce = EDIT_DEBOUNCE;
+  changed.pkgConfigDirectories.emplace_back("/nonexistent");
+  assert(LanguageServerOptions::impact(options, changed) ==
+         OptionsImpact::PRESENTATION);
+  changed.update(nlohmann::json::parse(
+      R"({"others": {"ignoreDiagnosticsFromSubprojects": true}})"));
+  assert(LanguageServerOptions::impact(options, changed) ==
+         OptionsImpact::RECOLLECT);
+  changed = options;
+  changed.analysisOptions.disableNameLinting = true;
+  assert(LanguageServerOptions::impact(options, changed) ==
+         OptionsImpact::LINTS);
+  changed.useCustomParser = !changed.useCustomParser;
+  assert(LanguageServerOptions::impact(options, changed) ==
+         OptionsImpact::PARSING);
+  changed = options;
+  changed.neverDownloadAutomatically = !changed.neverDownloadAutomatically;
+  assert(LanguageServerOptions::impact(options, changed) ==
+         OptionsImpact::PARSING);
+
+  workspace.edit(
+      mesonBuild, PieceTable(contents + "\nfooBar = 1\nmessage(fooBar)\n"),
+      [&published](
+          const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+              & /*diags*/) { published++; });
+  workspace.flushEdits();
+  while (published == 2) {
+    std::this_thread::sleep_for(KEYSTROKE_INTERVAL);
+  }
+  const auto snakeCaseLints =
+      [](const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+             &diags) {
+        size_t ret = 0;
+        for (const auto &[_, fileDiags] : diags) {
+          ret += std::ranges::count_if(fileDiags, [](const auto &diag) {
+            return diag.message == "Expected snake case";
+          });
+        }
+        return ret;
+      };
+  const auto fullParses = globalStats().fullParse.total();
+  const auto linted = workspace.reanalyze();
+  assert(snakeCaseLints(linted) > 0);
+  options.analysisOptions.disableNameLinting = true;
+  const auto unlinted = workspace.reanalyze();
+  assert(snakeCaseLints(unlinted) == 0);
+  assert(globalStats().fullParse.total() == fullParses);
+  // The edit is still there
+  assert(std::ranges::any_of(
+      workspace.documentSymbols(mesonBuild),
+      [](const auto &symbol) { return symbol.name == "fooBar"; }));
+
+  // Only the edited file differs from what was parsed last, everything else
+  // is taken from the cache
+  const auto cacheHits = globalStats().parseCacheHits.load();
+  const auto cacheMisses = globalStats().parseCacheMisses.load();
+  workspace.fullReparse(ns);
+  assert(globalStats().parseCacheMisses.load() <= cacheMisses + 1);
+  workspace.fullReparse(ns);
+  assert(globalStats().parseCacheHits.load() > cacheHits);
+  assert(globalStats().parseCacheMisses.load() <= cacheMisses + 1);
+
+  // An edit that changes nothing publishes nothing
+  PublishedDiagnostics publishedDiagnostics;
+  const auto reparsed = workspace.fullReparse(ns);
+  assert(!publishedDiagnostics.changed(reparsed).empty());
+  std::atomic<size_t> notifications = 0;
+  std::atomic<bool> edited = false;
+  workspace.edit(
+      mesonBuild, PieceTable(readFile(mesonBuild)),
+      [&publishedDiagnostics, &notifications, &edited](
+          const std::map<std::filesystem::path, std::vector<LSPDiagnostic>>
+              &changes) {
+        notifications += publishedDiagnostics.changed(changes).size();
+        edited = true;
+      });
+  workspace.flushEdits();
+  while (!edited) {
+    std::this_thread::sleep_for(KEYSTROKE_INTERVAL);
+  }
+  logger.info(std::format("Notifications for an unchanged file: {}",
+                          notifications.load()));
+  assert(notifications == 0);
   logger.info("Success");
 }
@@ -0,0 +1,54 @@
+#include "parsecache.hpp"
+#include "stats.hpp"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <string>
+
+static uint64_t misses() { return globalStats().parseCacheMisses.load(); }
+
+TEST(ParseCacheTest, testSameContentsAreLexedOnce) {
+  ParseCache cache;
+  const auto &first = cache.lex("/a/meson.build", "project('a')\n");
+  const auto before = misses();
+  ASSERT_EQ(first, cache.lex("/a/meson.build", "project('a')\n"));
+  ASSERT_EQ(before, misses());
+  ASSERT_NE(first, cache.lex("/a/meson.build", "project('b')\n"));
+  ASSERT_EQ(before + 1, misses());
+  ASSERT_EQ(1, cache.size());
+}
+
+TEST(ParseCacheTest, testLeastRecentlyUsedAreDropped) {
+  const std::string contents = "x = 1\n";
+  ParseCache cache(3 * contents.size());
+  cache.lex("/a/meson.build", contents);
+  cache.lex("/b/meson.build", contents);
+  cache.lex("/c/meson.build", contents);
+  // Used again, so /b is the least recently used one now
+  cache.lex("/a/meson.build", contents);
+  cache.lex("/d/meson.build", contents);
+  ASSERT_EQ(3, cache.size());
+  auto before = misses();
+  cache.lex("/a/meson.build", contents);
+  cache.lex("/c/meson.build", contents);
+  cache.lex("/d/meson.build", contents);
+  ASSERT_EQ(before, misses());
+  cache.lex("/b/meson.build", contents);
+  ASSERT_EQ(before + 1, misses());
+  ASSERT_EQ(3, cache.size());
+}
+
+TEST(ParseCacheTest, testFileLargerThanCapacityIsKept) {
+  ParseCache cache(1);
+  cache.lex("/a/meson.build", "x = 1\n");
+  cache.lex("/b/meson.build", "y = 1\n");
+  ASSERT_EQ(1, cache.size());
+  const auto before = misses();
+  cache.lex("/b/meson.build", "y = 1\n");
+  ASSERT_EQ(before, misses());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,232 @@
+#include "jsonrpc.hpp"
+#include "messageparser.hpp"
+#include "polyfill.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class StringCollector : public jsonrpc::ParamsReader {
+public:
+  std::vector<std::string> &strings;
+  std::atomic<size_t> &finished;
+
+  StringCollector(std::vector<std::string> &strings,
+                  std::atomic<size_t> &finished)
+      : strings(strings), finished(finished) {}
+
+  void finish() override { this->finished++; }
+
+  bool null() override { return true; }
+  bool boolean(bool /*val*/) override { return true; }
+  bool number_integer(number_integer_t /*val*/) override { return true; }
+  bool number_unsigned(number_unsigned_t /*val*/) override { return true; }
+  bool number_float(number_float_t /*val*/,
+                    const string_t & /*str*/) override {
+    return true;
+  }
+  bool string(string_t &val) override {
+    this->strings.emplace_back(std::move(val));
+    return true;
+  }
+  bool binary(binary_t & /*val*/) override { return true; }
+  bool start_object(std::size_t /*elements*/) override { return true; }
+  bool key(string_t & /*val*/) override { return true; }
+  bool end_object() override { return true; }
+  bool start_array(std::size_t /*elements*/) override { return true; }
+  bool end_array() override { return true; }
+  bool parse_error(std::size_t /*position*/, const std::string & /*lastToken*/,
+                   const nlohmann::detail::exception & /*ex*/) override {
+    return false;
+  }
+};
+
+class ReadingHandler : public jsonrpc::JsonRpcHandler {
+public:
+  std::vector<std::string> strings;
+  std::atomic<size_t> finished = 0;
+  std::atomic<size_t> notifications = 0;
+
+  void handleNotification(std::string /*method*/,
+                          nlohmann::json /*params*/) override {
+    this->notifications++;
+  }
+
+  void handleRequest(std::string /*method*/, nlohmann::json callId,
+                     nlohmann::json /*params*/,
+                     std::shared_ptr<CancellationToken> /*token*/) override {
+    this->server->reply(callId, nlohmann::json());
+  }
+
+  std::unique_ptr<jsonrpc::ParamsReader>
+  paramsReader(const std::string &method) override {
+    if (method != "read") {
+      return nullptr;
+    }
+    return std::make_unique<StringCollector>(this->strings, this->finished);
+  }
+};
+
+static bool parse(jsonrpc::MessageParser &parser, const std::string &text) {
+  return nlohmann::json::sax_parse(text.begin(), text.end(), &parser);
+}
+
+TEST(MessageParserTest, testBuildsSameJson) {
+  const std::vector<std::string> messages{
+      R"({"jsonrpc":"2.0","id":1,"method":"a","params":{"b":[1,-2,3.5]}})",
+      R"({"jsonrpc":"2.0","method":"a","params":[[],{},[{"c":null}]]})",
+      R"({"params":{"x":"y\n\"z\""},"method":"read","jsonrpc":"2.0"})",
+      R"({"jsonrpc":"2.0","method":"a","params":{"d":true,"e":false}})",
+      R"([1,"two",{"three":3}])",
+      R"("just a string")",
+  };
+  ReadingHandler handler;
+  for (const auto &text : messages) {
+    jsonrpc::MessageParser parser(handler);
+    ASSERT_TRUE(parse(parser, text));
+    ASSERT_EQ(nlohmann::json::parse(text), parser.message);
+    ASSERT_EQ(nullptr, parser.paramsReader);
+  }
+}
+
+TEST(MessageParserTest, testParamsAreRead) {
+  ReadingHandler handler;
+  jsonrpc::MessageParser parser(handler);
+  ASSERT_TRUE(parse(
+      parser,
+      R"({"jsonrpc":"2.0","method":"read","params":{"a":[1,{"b":"x"}],"c":"y"},"z":"after"})"));
+  ASSERT_NE(nullptr, parser.paramsReader);
+  ASSERT_FALSE(parser.message.contains("params"));
+  ASSERT_EQ("after", parser.message["z"]);
+  ASSERT_EQ((std::vector<std::string>{"x", "y"}), handler.strings);
+  ASSERT_EQ(0, handler.finished);
+}
+
+TEST(MessageParserTest, testReportsErrors) {
+  ReadingHandler handler;
+  jsonrpc::MessageParser parser(handler);
+  ASSERT_FALSE(parse(parser, R"({"jsonrpc":"2.0","method":)"));
+  ASSERT_FALSE(parser.error.empty());
+}
+
+static std::string frame(const std::string &payload) {
+  return std::format("Content-Length: {}\r\n\r\n{}", payload.size(), payload);
+}
+
+TEST(MessageParserTest, testReaderGetsNotification) {
+  auto handler = std::make_shared<ReadingHandler>();
+  std::string script;
+  script += frame(R"({"jsonrpc":"2.0","method":"read","params":["a"]})");
+  script += frame(R"({"jsonrpc":"2.0","method":"other","params":["b"]})");
+  script += frame(R"({"jsonrpc":"2.0","id":5,"method":"read","params":[]})");
+  std::istringstream input(script);
+  std::ostringstream output;
+  {
+    auto server = std::make_shared<jsonrpc::JsonRpcServer>(input, output, 1);
+    handler->server = server;
+    server->loop(handler);
+    server->wait();
+    handler->server = nullptr;
+  }
+  ASSERT_EQ(1, handler->finished);
+  ASSERT_EQ(1, handler->notifications);
+  // Readers are for notifications only
+  ASSERT_NE(std::string::npos, output.str().find("-32600"));
+}
+
+TEST(MessageParserTest, testResponsesReachCallback) {
+  auto handler = std::make_shared<ReadingHandler>();
+  std::string script;
+  script += frame(R"({"jsonrpc":"2.0","id":"server-0","result":{"a":1}})");
+  script += frame(R"({"jsonrpc":"2.0","id":"server-1","error":{}})");
+  // Not an answer to anything we sent
+  script += frame(R"({"jsonrpc":"2.0","id":"server-7","result":null})");
+  std::istringstream input(script);
+  std::ostringstream output;
+  std::vector<nlohmann::json> results;
+  {
+    auto server = std::make_shared<jsonrpc::JsonRpcServer>(input, output, 1);
+    handler->server = server;
+    server->request("first", nlohmann::json::object(),
+                    [&results](const nlohmann::json &result) {
+                      results.push_back(result);
+                    });
+    server->request("second", nlohmann::json::object(),
+                    [&results](const nlohmann::json &result) {
+                      results.push_back(result);
+                    });
+    server->loop(handler);
+    server->wait();
+    handler->server = nullptr;
+  }
+  ASSERT_EQ(1, results.size());
+  ASSERT_EQ(1, results[0]["a"]);
+  ASSERT_NE(std::string::npos, output.str().find(R"("method":"first")"));
+  // Responses are never answered with an error
+  ASSERT_EQ(std::string::npos, output.str().find("-32700"));
+}
+
+// Answers requests only once it gets a "release" notification
+class ParkingHandler : public jsonrpc::JsonRpcHandler {
+public:
+  std::vector<std::pair<nlohmann::json, std::shared_ptr<CancellationToken>>>
+      parked;
+
+  void handleNotification(std::string /*method*/,
+                          nlohmann::json /*params*/) override {
+    for (auto &[callId, token] : std::exchange(this->parked, {})) {
+      if (token->isCancelled()) {
+        this->server->returnError(callId,
+                                  jsonrpc::JsonrpcError::REQUEST_CANCELLED,
+                                  "Request was cancelled");
+      } else {
+        this->server->reply(callId, nlohmann::json());
+      }
+    }
+  }
+
+  void handleRequest(std::string /*method*/, nlohmann::json callId,
+                     nlohmann::json /*params*/,
+                     std::shared_ptr<CancellationToken> token) override {
+    this->parked.emplace_back(std::move(callId), std::move(token));
+  }
+
+  jsonrpc::Lane lane(const std::string & /*method*/,
+                     const nlohmann::json & /*params*/) override {
+    return jsonrpc::Lane::INLINE;
+  }
+};
+
+TEST(MessageParserTest, testParkedRequestsCanBeCancelled) {
+  auto handler = std::make_shared<ParkingHandler>();
+  std::string script;
+  script += frame(R"({"jsonrpc":"2.0","id":3,"method":"park","params":{}})");
+  script += frame(R"({"jsonrpc":"2.0","id":4,"method":"park","params":{}})");
+  script += frame(
+      R"({"jsonrpc":"2.0","method":"$/cancelRequest","params":{"id":3}})");
+  script += frame(R"({"jsonrpc":"2.0","method":"release","params":{}})");
+  std::istringstream input(script);
+  std::ostringstream output;
+  {
+    auto server = std::make_shared<jsonrpc::JsonRpcServer>(input, output, 1);
+    handler->server = server;
+    server->loop(handler);
+    server->wait();
+    handler->server = nullptr;
+  }
+  // Still pending while it was parked, so the cancellation reached it
+  ASSERT_NE(std::string::npos, output.str().find(R"(-32800,"message")"));
+  ASSERT_NE(std::string::npos, output.str().find(R"(},"id":3,)"));
+  ASSERT_NE(std::string::npos, output.str().find(R"({"id":4,)"));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
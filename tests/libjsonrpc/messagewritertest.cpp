@@ -0,0 +1,133 @@
+#include "messagewriter.hpp"
+#include "polyfill.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <gtest/gtest.h>
+#include <ios>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Stalls the first write until `release` is called, like a client that
+// does not read from the pipe.
+class StallingBuffer : public std::streambuf {
+public:
+  std::promise<void> stalled;
+  std::string contents;
+
+  void release() { this->released.set_value(); }
+
+protected:
+  std::streamsize xsputn(const char *data, std::streamsize count) override {
+    if (!this->first) {
+      this->first = true;
+      this->stalled.set_value();
+      this->released.get_future().wait();
+    }
+    this->contents.append(data, (size_t)count);
+    return count;
+  }
+
+  int overflow(int chr) override {
+    const char asChar = (char)chr;
+    this->xsputn(&asChar, 1);
+    return chr;
+  }
+
+private:
+  std::promise<void> released;
+  bool first = false;
+};
+
+static jsonrpc::OutgoingMessage message(jsonrpc::MessageWriter &writer,
+                                        const std::string &payload) {
+  auto ret = writer.newMessage();
+  ret.buffer += payload;
+  ret.finish();
+  return ret;
+}
+
+static std::vector<std::string> payloads(const std::string &output) {
+  std::vector<std::string> ret;
+  size_t pos = 0;
+  while (pos < output.size()) {
+    const auto headerEnd = output.find("\r\n\r\n", pos);
+    const auto len = (size_t)std::stoul(output.substr(
+        pos + std::string("Content-Length: ").size(), headerEnd - pos));
+    ret.emplace_back(output.substr(headerEnd + 4, len));
+    pos = headerEnd + 4 + len;
+  }
+  return ret;
+}
+
+TEST(MessageWriterTest, testFramesAllMessages) {
+  std::ostringstream output;
+  {
+    jsonrpc::MessageWriter writer(output);
+    for (size_t i = 0; i < 1000; i++) {
+      writer.send(message(writer, std::to_string(i)));
+    }
+    writer.flush();
+  }
+  const auto &written = payloads(output.str());
+  ASSERT_EQ(1000, written.size());
+  for (size_t i = 0; i < 1000; i++) {
+    ASSERT_EQ(std::to_string(i), written[i]);
+  }
+}
+
+TEST(MessageWriterTest, testQueuedMessageIsSuperseded) {
+  StallingBuffer buffer;
+  std::ostream output(&buffer);
+  {
+    jsonrpc::MessageWriter writer(output);
+    writer.send(message(writer, "first"));
+    buffer.stalled.get_future().wait();
+    writer.send(message(writer, "a1"), "a");
+    writer.send(message(writer, "b1"), "b");
+    writer.send(message(writer, "a2"), "a");
+    writer.send(message(writer, "plain"));
+    writer.send(message(writer, "a3"), "a");
+    buffer.release();
+    writer.flush();
+  }
+  const std::vector<std::string> expected{"first", "a3", "b1", "plain"};
+  ASSERT_EQ(expected, payloads(buffer.contents));
+}
+
+TEST(MessageWriterTest, testSendBlocksIfClientIsSlow) {
+  StallingBuffer buffer;
+  std::ostream output(&buffer);
+  jsonrpc::MessageWriter writer(output, 2);
+  writer.send(message(writer, "first"));
+  buffer.stalled.get_future().wait();
+  writer.send(message(writer, "second"));
+  writer.send(message(writer, "third"), "key");
+  // Replacing a queued message needs no space
+  writer.send(message(writer, "fourth"), "key");
+  std::atomic<bool> sent = false;
+  std::thread sender([&writer, &sent]() {
+    writer.send(message(writer, "fifth"));
+    sent = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_FALSE(sent);
+  buffer.release();
+  sender.join();
+  ASSERT_TRUE(sent);
+  writer.flush();
+  const std::vector<std::string> expected{"first", "second", "fourth",
+                                          "fifth"};
+  ASSERT_EQ(expected, payloads(buffer.contents));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -23,7 +23,8 @@ public:
   }
 
   void handleRequest(std::string method, nlohmann::json callId,
-                     nlohmann::json params) override {
+                     nlohmann::json params,
+                     std::shared_ptr<CancellationToken> /*token*/) override {
     this->logger.info(std::format("Got request: {}", method));
     if (strcmp(method.data(), "add") == 0) {
       int const a = params["a"];
@@ -0,0 +1,168 @@
+#include "jsonrpc.hpp"
+#include "polyfill.hpp"
+#include "unixsocket.hpp"
+
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <istream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class EchoHandler : public jsonrpc::JsonRpcHandler {
+public:
+  void handleNotification(std::string /*method*/,
+                          nlohmann::json /*params*/) override {}
+
+  void handleRequest(std::string method, nlohmann::json callId,
+                     nlohmann::json params,
+                     std::shared_ptr<CancellationToken> /*token*/) override {
+    if (method == "fail") {
+      this->server->returnError(callId, jsonrpc::JsonrpcError::INTERNAL_ERROR,
+                                "Failed on purpose");
+      return;
+    }
+    this->server->notification("noise", nlohmann::json::object());
+    this->server->reply(callId, params);
+  }
+};
+
+static std::array<int, 2> makeSocketPair() {
+  std::array<int, 2> fds{};
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds.data()) == -1) {
+    throw std::runtime_error("socketpair failed");
+  }
+  return fds;
+}
+
+static void serve(int fd) {
+  jsonrpc::FdStreamBuf buffer(fd);
+  std::istream input(&buffer);
+  std::ostream output(&buffer);
+  auto handler = std::make_shared<EchoHandler>();
+  auto server = std::make_shared<jsonrpc::JsonRpcServer>(input, output, 2);
+  handler->server = server;
+  server->loop(handler);
+  server->wait();
+  handler->server = nullptr;
+}
+
+TEST(UnixSocketTest, testRequestOverSocketPair) {
+  const auto fds = makeSocketPair();
+  std::thread serverThread(serve, fds[0]);
+  const nlohmann::json params = {{"text", std::string(100000, 'x')}};
+  ASSERT_EQ(params, jsonrpc::request(fds[1], "echo", params));
+  ASSERT_EQ(params, jsonrpc::request(fds[1], "echo", params));
+  ASSERT_THROW(jsonrpc::request(fds[1], "fail", params), std::runtime_error);
+  // The client going away ends the session
+  shutdown(fds[1], SHUT_WR);
+  serverThread.join();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(UnixSocketTest, testProxyForwardsBothWays) {
+  const auto input = makeSocketPair();
+  const auto output = makeSocketPair();
+  const auto daemon = makeSocketPair();
+  std::thread echo([fd = daemon[1]]() {
+    std::vector<char> buffer(16);
+    ssize_t got = 0;
+    while ((got = read(fd, buffer.data(), buffer.size())) > 0) {
+      ASSERT_EQ(got, write(fd, buffer.data(), (size_t)got));
+    }
+    close(fd);
+  });
+  std::thread proxy(jsonrpc::proxy, input[0], output[0], daemon[0]);
+  const std::string message = "Content-Length: 2\r\n\r\n{}";
+  ASSERT_EQ(message.size(), write(input[1], message.data(), message.size()));
+  // Closing stdin must not lose the replies that are still on their way
+  close(input[1]);
+  std::string received;
+  std::vector<char> buffer(64);
+  while (received.size() < message.size()) {
+    const auto got = read(output[1], buffer.data(), buffer.size());
+    ASSERT_GT(got, 0);
+    received.append(buffer.data(), (size_t)got);
+  }
+  ASSERT_EQ(message, received);
+  proxy.join();
+  echo.join();
+  close(input[0]);
+  close(output[0]);
+  close(output[1]);
+  close(daemon[0]);
+}
+
+TEST(UnixSocketTest, testListenReplacesStaleSocket) {
+  const auto &path = std::filesystem::temp_directory_path() /
+                     std::format("mesonlsp-test-{}.sock", getpid());
+  const auto stale = jsonrpc::listenUnix(path);
+  close(stale);
+  ASSERT_TRUE(std::filesystem::exists(path));
+  const auto listening = jsonrpc::listenUnix(path);
+  ASSERT_THROW(jsonrpc::listenUnix(path), std::runtime_error);
+  const auto client = jsonrpc::connectUnix(path);
+  const auto accepted = accept(listening, nullptr, nullptr);
+  ASSERT_NE(-1, accepted);
+  close(accepted);
+  close(client);
+  close(listening);
+  std::filesystem::remove(path);
+}
+
+TEST(UnixSocketTest, testSocketIsPrivate) {
+  const auto &dir = std::filesystem::temp_directory_path() /
+                    std::format("mesonlsp-test-{}", getpid());
+  const auto &path = dir / "mesonlsp.sock";
+  const auto listening = jsonrpc::listenUnix(path);
+  struct stat info {};
+  ASSERT_EQ(0, stat(dir.c_str(), &info));
+  ASSERT_EQ(0700, info.st_mode & 0777);
+  ASSERT_EQ(0, stat(path.c_str(), &info));
+  ASSERT_EQ(0, info.st_mode & 077);
+  const auto client = jsonrpc::connectUnix(path);
+  const auto accepted = accept(listening, nullptr, nullptr);
+  ASSERT_NE(-1, accepted);
+  ASSERT_TRUE(jsonrpc::peerIsCurrentUser(accepted));
+  ASSERT_TRUE(jsonrpc::peerIsCurrentUser(client));
+  close(accepted);
+  close(client);
+  close(listening);
+  std::filesystem::remove_all(dir);
+}
+
+TEST(UnixSocketTest, testListenKeepsOtherFiles) {
+  const auto &path = std::filesystem::temp_directory_path() /
+                     std::format("mesonlsp-test-{}.txt", getpid());
+  std::ofstream(path) << "Not a socket";
+  ASSERT_THROW(jsonrpc::listenUnix(path), std::runtime_error);
+  ASSERT_TRUE(std::filesystem::is_regular_file(path));
+  std::filesystem::remove(path);
+}
+
+TEST(UnixSocketTest, testListenRefusesWritableDirectory) {
+  const auto &dir = std::filesystem::temp_directory_path() /
+                    std::format("mesonlsp-test-{}-shared", getpid());
+  std::filesystem::create_directory(dir);
+  std::filesystem::permissions(dir, std::filesystem::perms::all);
+  ASSERT_THROW(jsonrpc::listenUnix(dir / "mesonlsp.sock"), std::runtime_error);
+  ASSERT_FALSE(std::filesystem::exists(dir / "mesonlsp.sock"));
+  std::filesystem::remove_all(dir);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,333 @@
+#include "jsonrpc.hpp"
+#include "polyfill.hpp"
+#include "workerpool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <future>
+#include <iterator>
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+constexpr size_t NUM_MESSAGES = 5000;
+
+static size_t currentThreadCount() {
+#ifdef __linux__
+  const auto &tasks = std::filesystem::directory_iterator("/proc/self/task");
+  return (size_t)std::distance(std::filesystem::begin(tasks),
+                               std::filesystem::end(tasks));
+#else
+  return 0;
+#endif
+}
+
+class RecordingHandler : public jsonrpc::JsonRpcHandler {
+public:
+  std::mutex mtx;
+  std::set<std::thread::id> threads;
+  std::vector<int> order;
+  size_t maxThreadCount = 0;
+  std::promise<void> lastMessageSeen;
+
+  void handleNotification(std::string /*method*/,
+                          nlohmann::json params) override {
+    this->record(params["seq"]);
+  }
+
+  void handleRequest(std::string method, nlohmann::json callId,
+                     nlohmann::json params,
+                     std::shared_ptr<CancellationToken> /*token*/) override {
+    if (method == "block") {
+      // Only finishes after the last message in the stream was handled
+      this->lastMessageSeen.get_future().wait();
+    }
+    this->record(params["seq"]);
+    this->server->reply(callId, params["seq"]);
+  }
+
+private:
+  void record(int seq) {
+    const auto numThreads = currentThreadCount();
+    std::scoped_lock const lock(this->mtx);
+    this->threads.insert(std::this_thread::get_id());
+    this->order.push_back(seq);
+    this->maxThreadCount = std::max(this->maxThreadCount, numThreads);
+    if ((size_t)seq == NUM_MESSAGES - 1) {
+      this->lastMessageSeen.set_value();
+    }
+  }
+};
+
+static std::string frame(const nlohmann::json &data) {
+  const auto &payload = data.dump();
+  return std::format("Content-Length: {}\r\n\r\n{}", payload.size(), payload);
+}
+
+static std::string makeScript(bool blockFirst) {
+  std::string ret;
+  for (size_t i = 0; i < NUM_MESSAGES; i++) {
+    nlohmann::json data;
+    data["jsonrpc"] = "2.0";
+    data["params"] = {{"seq", i}};
+    if (i % 3 == 0) {
+      data["id"] = i;
+      data["method"] = (i == 0 && blockFirst) ? "block" : "request";
+    } else {
+      data["method"] = "notification";
+    }
+    ret += frame(data);
+  }
+  return ret;
+}
+
+static size_t countReplies(const std::string &output) {
+  size_t ret = 0;
+  for (auto pos = output.find("Content-Length"); pos != std::string::npos;
+       pos = output.find("Content-Length", pos + 1)) {
+    ret++;
+  }
+  return ret;
+}
+
+static std::pair<std::shared_ptr<RecordingHandler>, std::string>
+runScript(const std::string &script, size_t numWorkers) {
+  auto handler = std::make_shared<RecordingHandler>();
+  std::istringstream input(script);
+  std::ostringstream output;
+  {
+    auto server =
+        std::make_shared<jsonrpc::JsonRpcServer>(input, output, numWorkers);
+    handler->server = server;
+    server->loop(handler);
+    server->wait();
+    handler->server = nullptr;
+  }
+  return {handler, output.str()};
+}
+
+TEST(WorkerPoolTest, testThreadCountIsBounded) {
+  constexpr size_t NUM_WORKERS = 4;
+  const auto &[handler, output] = runScript(makeScript(false), NUM_WORKERS);
+  ASSERT_EQ(NUM_MESSAGES, handler->order.size());
+  ASSERT_LE(handler->threads.size(), NUM_WORKERS);
+#ifdef __linux__
+  // Main thread + writer + workers
+  ASSERT_LE(handler->maxThreadCount, NUM_WORKERS + 2);
+#endif
+  ASSERT_EQ((NUM_MESSAGES + 2) / 3, countReplies(output));
+}
+
+TEST(WorkerPoolTest, testSingleWorkerKeepsOrder) {
+  const auto &[handler, output] = runScript(makeScript(false), 1);
+  ASSERT_EQ(1, handler->threads.size());
+  ASSERT_EQ(NUM_MESSAGES, handler->order.size());
+  for (size_t i = 0; i < NUM_MESSAGES; i++) {
+    ASSERT_EQ(i, handler->order[i]);
+  }
+}
+
+TEST(WorkerPoolTest, testSlowRequestDoesNotBlockLaterMessages) {
+  const auto &[handler, output] = runScript(makeScript(true), 2);
+  ASSERT_EQ(NUM_MESSAGES, handler->order.size());
+  // The blocked request can only finish after everything else
+  ASSERT_EQ(0, handler->order.back());
+  ASSERT_EQ((NUM_MESSAGES + 2) / 3, countReplies(output));
+}
+
+TEST(WorkerPoolTest, testCancelledRequestIsNotHandled) {
+  auto handler = std::make_shared<RecordingHandler>();
+  std::string script;
+  script += frame({{"jsonrpc", "2.0"},
+                   {"id", 0},
+                   {"method", "block"},
+                   {"params", {{"seq", 0}}}});
+  script += frame({{"jsonrpc", "2.0"},
+                   {"id", 1},
+                   {"method", "request"},
+                   {"params", {{"seq", 1}}}});
+  script += frame({{"jsonrpc", "2.0"},
+                   {"method", "$/cancelRequest"},
+                   {"params", {{"id", 1}}}});
+  std::istringstream input(script);
+  std::ostringstream output;
+  {
+    auto server = std::make_shared<jsonrpc::JsonRpcServer>(input, output, 1);
+    handler->server = server;
+    // Everything is read before the single worker is free again
+    server->loop(handler);
+    handler->lastMessageSeen.set_value();
+    server->wait();
+    handler->server = nullptr;
+  }
+  ASSERT_EQ(std::vector<int>{0}, handler->order);
+  ASSERT_EQ(2, countReplies(output.str()));
+  ASSERT_NE(std::string::npos, output.str().find("-32800"));
+}
+
+TEST(WorkerPoolTest, testSubmitBlocksIfQueueIsFull) {
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  std::atomic<size_t> finished = 0;
+  jsonrpc::WorkerPool pool(1, 2);
+  std::promise<void> started;
+  pool.submit([&started, released, &finished]() {
+    started.set_value();
+    released.wait();
+    finished++;
+  });
+  started.get_future().wait();
+  pool.submit([&finished]() { finished++; });
+  pool.submit([&finished]() { finished++; });
+  std::atomic<bool> submitted = false;
+  std::thread submitter([&pool, &submitted, &finished]() {
+    pool.submit([&finished]() { finished++; });
+    submitted = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_FALSE(submitted);
+  release.set_value();
+  submitter.join();
+  ASSERT_TRUE(submitted);
+  pool.waitIdle();
+  ASSERT_EQ(4, finished);
+}
+
+TEST(WorkerPoolTest, testLanesArePrioritized) {
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  std::promise<void> started;
+  std::mutex mtx;
+  std::vector<jsonrpc::Lane> order;
+  jsonrpc::WorkerPool pool(1);
+  pool.submit([&started, released]() {
+    started.set_value();
+    released.wait();
+  });
+  started.get_future().wait();
+  for (const auto lane : {jsonrpc::Lane::BACKGROUND, jsonrpc::Lane::EDIT,
+                          jsonrpc::Lane::INTERACTIVE}) {
+    pool.submit(
+        [&mtx, &order, lane]() {
+          std::scoped_lock const lock(mtx);
+          order.push_back(lane);
+        },
+        lane);
+  }
+  release.set_value();
+  pool.waitIdle();
+  ASSERT_EQ((std::vector<jsonrpc::Lane>{jsonrpc::Lane::INTERACTIVE,
+                                        jsonrpc::Lane::EDIT,
+                                        jsonrpc::Lane::BACKGROUND}),
+            order);
+}
+
+TEST(WorkerPoolTest, testInteractiveRunsOnReservedWorker) {
+  constexpr auto BLOCKED_FOR = std::chrono::milliseconds(50);
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  std::promise<void> started;
+  jsonrpc::WorkerPool pool(2, jsonrpc::DEFAULT_QUEUE_CAPACITY, 1);
+  pool.submit(
+      [&started, released]() {
+        started.set_value();
+        released.wait();
+      },
+      jsonrpc::Lane::BACKGROUND);
+  started.get_future().wait();
+  // Has to wait, the only other worker is reserved
+  pool.submit([released]() { released.wait(); }, jsonrpc::Lane::BACKGROUND);
+  std::promise<void> interactive;
+  pool.submit([&interactive]() { interactive.set_value(); },
+              jsonrpc::Lane::INTERACTIVE);
+  ASSERT_EQ(std::future_status::ready,
+            interactive.get_future().wait_for(std::chrono::seconds(5)));
+  std::this_thread::sleep_for(BLOCKED_FOR);
+  release.set_value();
+  pool.waitIdle();
+  const auto &interactiveStats = pool.laneStats(jsonrpc::Lane::INTERACTIVE);
+  const auto &backgroundStats = pool.laneStats(jsonrpc::Lane::BACKGROUND);
+  ASSERT_EQ(1, interactiveStats.jobs);
+  ASSERT_EQ(2, backgroundStats.jobs);
+  ASSERT_EQ(0, pool.laneStats(jsonrpc::Lane::EDIT).jobs);
+  ASSERT_GE(backgroundStats.maxWait, BLOCKED_FOR);
+  ASSERT_LT(interactiveStats.maxWait, BLOCKED_FOR);
+  ASSERT_LE(backgroundStats.maxWait, backgroundStats.totalWait);
+}
+
+class InlineHandler : public RecordingHandler {
+public:
+  jsonrpc::Lane lane(const std::string &method,
+                     const nlohmann::json & /*params*/) override {
+    return method == "trivial" ? jsonrpc::Lane::INLINE : jsonrpc::Lane::EDIT;
+  }
+};
+
+TEST(WorkerPoolTest, testTrivialRequestRunsOnReader) {
+  auto handler = std::make_shared<InlineHandler>();
+  const auto &script = frame({{"jsonrpc", "2.0"},
+                              {"id", 0},
+                              {"method", "trivial"},
+                              {"params", {{"seq", 0}}}});
+  std::istringstream input(script);
+  std::ostringstream output;
+  {
+    auto server = std::make_shared<jsonrpc::JsonRpcServer>(input, output, 2);
+    handler->server = server;
+    server->loop(handler);
+    server->wait();
+    handler->server = nullptr;
+  }
+  ASSERT_EQ(std::set<std::thread::id>{std::this_thread::get_id()},
+            handler->threads);
+  ASSERT_EQ(1, countReplies(output.str()));
+}
+
+// Like text synchronization in the language server: The notifications must
+// be applied in the order they arrived, the requests may run in parallel.
+class SyncHandler : public RecordingHandler {
+public:
+  jsonrpc::Lane lane(const std::string &method,
+                     const nlohmann::json & /*params*/) override {
+    return method == "notification" ? jsonrpc::Lane::INLINE
+                                     : jsonrpc::Lane::EDIT;
+  }
+};
+
+TEST(WorkerPoolTest, testInlineNotificationsKeepOrderWithManyWorkers) {
+  constexpr size_t NUM_WORKERS = 4;
+  auto handler = std::make_shared<SyncHandler>();
+  std::istringstream input(makeScript(false));
+  std::ostringstream output;
+  {
+    auto server =
+        std::make_shared<jsonrpc::JsonRpcServer>(input, output, NUM_WORKERS);
+    handler->server = server;
+    server->loop(handler);
+    server->wait();
+    handler->server = nullptr;
+  }
+  ASSERT_EQ(NUM_MESSAGES, handler->order.size());
+  ASSERT_GT(handler->threads.size(), 1);
+  std::vector<int> notifications;
+  std::ranges::copy_if(handler->order, std::back_inserter(notifications),
+                       [](int seq) { return seq % 3 != 0; });
+  ASSERT_EQ(NUM_MESSAGES - ((NUM_MESSAGES + 2) / 3), notifications.size());
+  ASSERT_TRUE(std::ranges::is_sorted(notifications));
+  ASSERT_EQ((NUM_MESSAGES + 2) / 3, countReplies(output.str()));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
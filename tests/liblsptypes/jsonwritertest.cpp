@@ -0,0 +1,101 @@
+#include "jsonwriter.hpp"
+#include "lsptypes.hpp"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <limits>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+template <typename T> static std::string streamed(const T &value) {
+  std::string ret;
+  JsonWriter writer(ret);
+  value.writeJson(writer);
+  return ret;
+}
+
+static LSPRange makeRange() {
+  return {LSPPosition(1, 2), LSPPosition(3, 4)};
+}
+
+TEST(JsonWriterTest, testPrimitives) {
+  std::string out;
+  JsonWriter writer(out);
+  writer.beginObject();
+  writer.key("a");
+  writer.beginArray();
+  writer.number(-5);
+  writer.number(std::numeric_limits<uint64_t>::max());
+  writer.boolean(true);
+  writer.boolean(false);
+  writer.null();
+  writer.beginObject();
+  writer.endObject();
+  writer.beginArray();
+  writer.endArray();
+  writer.endArray();
+  writer.key("b");
+  writer.string("c");
+  writer.endObject();
+  ASSERT_EQ(nlohmann::json::parse(out).dump(), out);
+}
+
+TEST(JsonWriterTest, testEscaping) {
+  const std::string text = "\"quoted\" \\ \b\f\n\r\t \x01\x1f\x7f / äöü 🙂";
+  std::string out;
+  JsonWriter writer(out);
+  writer.string(text);
+  ASSERT_EQ(nlohmann::json(text).dump(), out);
+  ASSERT_EQ(text, nlohmann::json::parse(out).get<std::string>());
+}
+
+TEST(JsonWriterTest, testInvalidUtf8IsReplaced) {
+  // Strings are split where a hex escape would swallow the next character
+  const std::vector<std::string> texts{
+      "a\xff"
+      "b",
+      // Truncated sequences, at the end and before other characters
+      "\xE2\x82",
+      "\xE2\x82"
+      "A\xF0\x9F\x99",
+      // Overlong encoding and surrogate
+      "\xC0\xAF",
+      "\xED\xA0\x80",
+      // Beyond U+10FFFF and stray continuation bytes
+      "\xF4\x90\x80\x80",
+      "\x80\xBF\xE4\xB8\xAD",
+  };
+  for (const auto &text : texts) {
+    std::string out;
+    JsonWriter writer(out);
+    writer.string(text);
+    ASSERT_EQ(nlohmann::json(text).dump(
+                  -1, ' ', false, nlohmann::json::error_handler_t::replace),
+              out);
+    ASSERT_TRUE(nlohmann::json::accept(out));
+  }
+}
+
+TEST(JsonWriterTest, testMatchesDom) {
+  const auto &range = makeRange();
+  ASSERT_EQ(range.toJson().dump(), streamed(range));
+  const InlayHint hint(LSPPosition(5, 6), "str");
+  ASSERT_EQ(hint.toJson().dump(), streamed(hint));
+  const FoldingRange folding(7, 8);
+  ASSERT_EQ(folding.toJson().dump(), streamed(folding));
+  const LSPLocation location("file:///a/meson.build", range);
+  ASSERT_EQ(location.toJson().dump(), streamed(location));
+  const SymbolInformation symbol("foo", SymbolKind::LIST_KIND, location);
+  ASSERT_EQ(symbol.toJson().dump(), streamed(symbol));
+  const DocumentHighlight highlight(range, DocumentHighlightKind::WRITE_KIND);
+  ASSERT_EQ(highlight.toJson().dump(), streamed(highlight));
+  const CompletionItem item("files()", CompletionItemKind::FUNCTION,
+                            TextEdit(range, "files(${1:\"a\"})"));
+  ASSERT_EQ(item.toJson().dump(), streamed(item));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
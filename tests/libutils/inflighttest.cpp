@@ -0,0 +1,82 @@
+#include "inflight.hpp"
+#include "stats.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <latch>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+static uint64_t deduplicated(const std::string &method) {
+  return globalStats().methods.get(method).deduplicated.load();
+}
+
+TEST(InFlightTest, testIdenticalRequestsShareResult) {
+  InFlight<std::vector<int>> inFlight("inflight/shared");
+  std::atomic<int> computations = 0;
+  std::latch started(1);
+  const auto compute = [&computations, &started]() {
+    computations++;
+    started.count_down();
+    // Keep running until the second caller joined
+    while (deduplicated("inflight/shared") == 0) {
+      std::this_thread::yield();
+    }
+    return std::vector<int>{1, 2, 3};
+  };
+  std::vector<int> first;
+  std::thread owner([&]() { first = inFlight.run("a@1", compute); });
+  started.wait();
+  const auto second = inFlight.run("a@1", compute);
+  owner.join();
+  ASSERT_EQ(1, computations);
+  ASSERT_EQ((std::vector<int>{1, 2, 3}), first);
+  ASSERT_EQ(first, second);
+  ASSERT_EQ(1, deduplicated("inflight/shared"));
+}
+
+TEST(InFlightTest, testFinishedRequestsAreNotCached) {
+  InFlight<int> inFlight("inflight/sequential");
+  int computations = 0;
+  const auto compute = [&computations]() { return ++computations; };
+  ASSERT_EQ(1, inFlight.run("a@1", compute));
+  ASSERT_EQ(2, inFlight.run("a@1", compute));
+  ASSERT_EQ(3, inFlight.run("b@1", compute));
+  ASSERT_EQ(0, deduplicated("inflight/sequential"));
+}
+
+TEST(InFlightTest, testDifferentKeysRunSeparately) {
+  InFlight<int> inFlight("inflight/keys");
+  std::latch bothRunning(2);
+  const auto compute = [&bothRunning](int val) {
+    return [&bothRunning, val]() {
+      // Would never return, if the second key had to wait for the first
+      bothRunning.arrive_and_wait();
+      return val;
+    };
+  };
+  int first = 0;
+  std::thread owner([&]() { first = inFlight.run("a@1", compute(1)); });
+  const auto second = inFlight.run("a@2", compute(2));
+  owner.join();
+  ASSERT_EQ(1, first);
+  ASSERT_EQ(2, second);
+  ASSERT_EQ(0, deduplicated("inflight/keys"));
+}
+
+TEST(InFlightTest, testErrorsAreRethrown) {
+  InFlight<int> inFlight("inflight/errors");
+  ASSERT_THROW(inFlight.run("a@1",
+                            []() -> int { throw std::runtime_error("x"); }),
+               std::runtime_error);
+  // The failed computation does not stay around
+  ASSERT_EQ(5, inFlight.run("a@1", []() { return 5; }));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
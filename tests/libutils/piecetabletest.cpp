@@ -0,0 +1,170 @@
+#include "piecetable.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The offset of an LSP position, computed the slow and obvious way
+static size_t referenceOffset(const std::string &text, uint64_t line,
+                              uint64_t character) {
+  size_t offset = 0;
+  for (uint64_t i = 0; i < line; i++) {
+    const auto lineBreak = text.find_first_of("\r\n", offset);
+    if (lineBreak == std::string::npos) {
+      return text.size();
+    }
+    offset = text.compare(lineBreak, 2, "\r\n") == 0 ? lineBreak + 2
+                                                      : lineBreak + 1;
+  }
+  uint64_t units = 0;
+  while (offset < text.size() && text[offset] != '\n' &&
+         text[offset] != '\r' && units < character) {
+    const auto byte = (unsigned char)text[offset];
+    size_t bytes = 1;
+    if (byte >= 0xF0) {
+      bytes = 4;
+    } else if (byte >= 0xE0) {
+      bytes = 3;
+    } else if (byte >= 0xC0) {
+      bytes = 2;
+    }
+    units += bytes == 4 ? 2 : 1;
+    offset += bytes;
+  }
+  return offset;
+}
+
+TEST(PieceTableTest, testEmpty) {
+  const PieceTable table;
+  ASSERT_EQ(0, table.size());
+  ASSERT_EQ("", table.str());
+  ASSERT_EQ(0, table.offsetOf(3, 4));
+  ASSERT_EQ("abc", table.replace(0, 0, "abc").str());
+}
+
+TEST(PieceTableTest, testOffsets) {
+  const PieceTable table("project('a')\n\nx = 'ä😀b'\n");
+  ASSERT_EQ(0, table.offsetOf(0, 0));
+  ASSERT_EQ(8, table.offsetOf(0, 8));
+  // Clamped to the end of the line
+  ASSERT_EQ(12, table.offsetOf(0, 100));
+  ASSERT_EQ(13, table.offsetOf(1, 0));
+  ASSERT_EQ(19, table.offsetOf(2, 5));
+  // After the two bytes of ä
+  ASSERT_EQ(21, table.offsetOf(2, 6));
+  // After the four bytes of the emoji, which are two UTF-16 code units
+  ASSERT_EQ(25, table.offsetOf(2, 8));
+  ASSERT_EQ(table.size(), table.offsetOf(3, 0));
+  ASSERT_EQ(table.size(), table.offsetOf(100, 0));
+}
+
+TEST(PieceTableTest, testCarriageReturns) {
+  const PieceTable table("a\r\nb\rc\n\r\nd");
+  ASSERT_EQ(3, table.offsetOf(1, 0));
+  // Clamped before the line break
+  ASSERT_EQ(4, table.offsetOf(1, 5));
+  ASSERT_EQ(5, table.offsetOf(2, 0));
+  ASSERT_EQ(7, table.offsetOf(3, 0));
+  ASSERT_EQ(9, table.offsetOf(4, 0));
+  // A "\r\n" made of two pieces is still one line break. Both are too
+  // large to be merged.
+  const std::string first = std::string(100, 'a') + "\r";
+  const std::string second = "\n" + std::string(100, 'b') + "\r";
+  const auto &joined = PieceTable(first).replace(101, 101, second);
+  ASSERT_EQ(2, joined.pieces());
+  ASSERT_EQ(102, joined.offsetOf(1, 0));
+  ASSERT_EQ(102 + 50, joined.offsetOf(1, 50));
+  ASSERT_EQ(joined.size(), joined.offsetOf(2, 0));
+  const auto &third = joined.replace(joined.size(), joined.size(),
+                                     "\n" + std::string(100, 'c'));
+  ASSERT_EQ(3, third.pieces());
+  ASSERT_EQ(joined.size() + 1, third.offsetOf(2, 0));
+  ASSERT_EQ(third.size(), third.offsetOf(3, 0));
+}
+
+TEST(PieceTableTest, testTypingKeepsFewPieces) {
+  PieceTable table(std::string(1000, 'x'));
+  std::string expected(1000, 'x');
+  for (size_t i = 0; i < 1000; i++) {
+    const auto offset = 500 + i;
+    table = table.replace(offset, offset, "a");
+    expected.insert(offset, "a");
+  }
+  ASSERT_EQ(expected, table.str());
+  ASSERT_LE(table.pieces(), 2 + (1000 / 32));
+  // Deleting them again merges what is left around the deleted bytes
+  for (size_t i = 0; i < 1000; i++) {
+    table = table.replace(500, 501, "");
+    expected.erase(500, 1);
+  }
+  ASSERT_EQ(expected, table.str());
+}
+
+TEST(PieceTableTest, testEditsKeepOldVersions) {
+  const PieceTable first("foo = 1\nbar = 2\n");
+  const auto second = first.replace(first.offsetOf(1, 0),
+                                    first.offsetOf(1, 3), "baz");
+  const auto third = second.replace(0, 3, "");
+  ASSERT_EQ("foo = 1\nbar = 2\n", first.str());
+  ASSERT_EQ("foo = 1\nbaz = 2\n", second.str());
+  ASSERT_EQ(" = 1\nbaz = 2\n", third.str());
+}
+
+// Random edit sequences have to give the same text as applying them to a
+// plain string, for each of the versions in between.
+TEST(PieceTableTest, testRandomEditsMatchFullReplacement) {
+  // The long ones are never merged with others
+  const std::array<std::string, 12> snippets{"",
+                                             "x",
+                                             "\n",
+                                             "foo = 'bar'\n",
+                                             "ä",
+                                             "😀",
+                                             "\n\n\n",
+                                             "if a\nendif",
+                                             "\r",
+                                             "\r\n",
+                                             std::string(70, 'y') + "\r",
+                                             "\n" + std::string(70, 'z')};
+  std::mt19937 rng(42); // NOLINT
+  for (int round = 0; round < 50; round++) {
+    std::string expected = "project('fuzz')\n";
+    PieceTable table(expected);
+    std::vector<std::pair<PieceTable, std::string>> versions;
+    for (int step = 0; step < 200; step++) {
+      const auto lines = (uint64_t)std::ranges::count(expected, '\n') + 2;
+      const auto startLine = rng() % lines;
+      const auto startCharacter = rng() % 20;
+      const auto endLine = startLine + (rng() % 3);
+      const auto endCharacter = rng() % 20;
+      const auto start = referenceOffset(expected, startLine, startCharacter);
+      auto end = referenceOffset(expected, endLine, endCharacter);
+      if (end < start) {
+        end = start;
+      }
+      ASSERT_EQ(start, table.offsetOf(startLine, startCharacter));
+      const auto &text = snippets[rng() % snippets.size()];
+      expected.replace(start, end - start, text);
+      table = table.replace(start, end, text);
+      ASSERT_EQ(expected.size(), table.size());
+      if (step % 20 == 0) {
+        versions.emplace_back(table, expected);
+      }
+    }
+    ASSERT_EQ(expected, table.str());
+    for (const auto &[version, text] : versions) {
+      ASSERT_EQ(text, version.str());
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
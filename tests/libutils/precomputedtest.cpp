@@ -0,0 +1,69 @@
+#include "precomputed.hpp"
+#include "stats.hpp"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+static uint64_t hits(const std::string &method) {
+  return globalStats().methods.get(method).precomputedHits.load();
+}
+
+static uint64_t misses(const std::string &method) {
+  return globalStats().methods.get(method).precomputedMisses.load();
+}
+
+TEST(PrecomputedTest, testResultIsFoundByKey) {
+  Precomputed<std::vector<int>> precomputed("precomputed/key");
+  precomputed.put("a", "a@1", 0, {1, 2, 3});
+  ASSERT_EQ((std::vector<int>{1, 2, 3}), precomputed.get("a", "a@1"));
+  // Still there, e.g. for an editor asking again when switching tabs
+  ASSERT_EQ((std::vector<int>{1, 2, 3}), precomputed.get("a", "a@1"));
+  ASSERT_EQ(std::nullopt, precomputed.get("a", "a@2"));
+  ASSERT_EQ(std::nullopt, precomputed.get("b", "a@1"));
+  ASSERT_EQ(2, hits("precomputed/key"));
+  ASSERT_EQ(2, misses("precomputed/key"));
+}
+
+TEST(PrecomputedTest, testNewerKeyReplacesOlder) {
+  Precomputed<int> precomputed("precomputed/replace");
+  precomputed.put("a", "a@1", 0, 1);
+  precomputed.put("a", "a@2", 0, 2);
+  ASSERT_EQ(std::nullopt, precomputed.get("a", "a@1"));
+  ASSERT_EQ(2, precomputed.get("a", "a@2"));
+}
+
+TEST(PrecomputedTest, testEraseDropsDocument) {
+  Precomputed<int> precomputed("precomputed/erase");
+  precomputed.put("a", "a@1", 0, 1);
+  precomputed.put("b", "b@1", 0, 2);
+  precomputed.erase("a");
+  ASSERT_EQ(std::nullopt, precomputed.get("a", "a@1"));
+  ASSERT_EQ(2, precomputed.get("b", "b@1"));
+}
+
+TEST(PrecomputedTest, testAdvanceDropsOlderGenerations) {
+  Precomputed<int> precomputed("precomputed/advance");
+  precomputed.put("a", "a@1#0", 0, 1);
+  precomputed.put("b", "b@1#1", 1, 2);
+  precomputed.advance(1);
+  ASSERT_EQ(1, precomputed.size());
+  ASSERT_EQ(std::nullopt, precomputed.get("a", "a@1#0"));
+  ASSERT_EQ(2, precomputed.get("b", "b@1#1"));
+  precomputed.advance(2);
+  ASSERT_EQ(0, precomputed.size());
+  // Finished computing only after the generation advanced
+  precomputed.put("a", "a@1#1", 1, 3);
+  ASSERT_EQ(0, precomputed.size());
+  precomputed.put("a", "a@1#2", 2, 4);
+  ASSERT_EQ(4, precomputed.get("a", "a@1#2"));
+  ASSERT_EQ(2, hits("precomputed/advance"));
+  ASSERT_EQ(1, misses("precomputed/advance"));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
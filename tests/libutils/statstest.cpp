@@ -0,0 +1,85 @@
+#include "polyfill.hpp"
+#include "stats.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+TEST(StatsTest, testBucketsCoverEverything) {
+  uint64_t previousUpper = 0;
+  for (size_t bucket = 1; bucket < Histogram::NUM_BUCKETS; bucket++) {
+    const auto upper = Histogram::upperBound(bucket);
+    ASSERT_GT(upper, previousUpper);
+    ASSERT_EQ(bucket, Histogram::bucketFor(previousUpper + 1));
+    ASSERT_EQ(bucket, Histogram::bucketFor(upper));
+    previousUpper = upper;
+  }
+}
+
+TEST(StatsTest, testPercentiles) {
+  Histogram histogram;
+  for (int i = 1; i <= 100; i++) {
+    histogram.record(std::chrono::microseconds(i));
+  }
+  ASSERT_EQ(100, histogram.total());
+  ASSERT_EQ(5050, histogram.sum());
+  ASSERT_EQ(100, histogram.max());
+  // Accurate to a quarter of the value
+  ASSERT_GE(histogram.percentile(50), 50);
+  ASSERT_LE(histogram.percentile(50), 50 * 5 / 4);
+  ASSERT_GE(histogram.percentile(95), 95);
+  ASSERT_LE(histogram.percentile(99), 100);
+  ASSERT_EQ(0, Histogram().percentile(50));
+}
+
+constexpr size_t NUM_THREADS = 8;
+constexpr size_t NUM_METHODS = 50;
+
+TEST(StatsTest, testMethodsAreRegisteredOnce) {
+  MethodTable table;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < NUM_THREADS; i++) {
+    threads.emplace_back([&table]() {
+      for (size_t j = 0; j < NUM_METHODS; j++) {
+        table.get(std::format("method{}", j))
+            .latency.record(std::chrono::microseconds(j));
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  std::set<std::string> names;
+  table.forEach([&names](std::string_view name, const MethodStats &stats) {
+    ASSERT_EQ(NUM_THREADS, stats.latency.total());
+    names.emplace(name);
+  });
+  ASSERT_EQ(NUM_METHODS, names.size());
+}
+
+TEST(StatsTest, testFullTableCountsAsOther) {
+  MethodTable table;
+  for (size_t i = 0; i < MethodTable::CAPACITY + 1; i++) {
+    table.get(std::format("method{}", i))
+        .latency.record(std::chrono::microseconds(1));
+  }
+  size_t numMethods = 0;
+  bool sawOther = false;
+  table.forEach([&](std::string_view name, const MethodStats & /*stats*/) {
+    numMethods++;
+    sawOther = sawOther || name == "<other>";
+  });
+  ASSERT_EQ(MethodTable::CAPACITY + 1, numMethods);
+  ASSERT_TRUE(sawOther);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}